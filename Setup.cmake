@@ -1,28 +1,58 @@
 # SIMD
 ###########################
 
-option(WITH_AVX "Enable AVX support" OFF)
+# The convolution kernels (decay_fconv*) are compiled for the scalar
+# baseline, AVX2, and AVX-512. The kernels are selected at runtime (cpuid),
+# so that one binary uses the instruction set of the node it runs on.
+# WITH_AVX additionally compiles the whole module for the build host.
+option(WITH_AVX "Compile for the instruction set of the build host" OFF)
 
-if (WITH_AVX AND NOT APPLE AND CMAKE_HOST_SYSTEM_PROCESSOR STREQUAL "x86_64")
+if (CMAKE_SYSTEM_PROCESSOR MATCHES "^(x86_64|AMD64|amd64)$")
     set(CMAKE_MODULE_PATH ${CMAKE_MODULE_PATH} ${CMAKE_CURRENT_SOURCE_DIR}/dependency)
     include(simd)
+    include(CheckCXXSourceCompiles)
+    message("SIMD of build host: AVX=${AVX_FOUND} AVX2=${AVX2_FOUND} AVX512F=${AVX512F_FOUND}")
 
-    if (${AVX_FOUND})
-        message("BUILD WITH SIMD")
-        add_definitions(-DWITH_AVX)
+    if (MSVC)
+        # Intrinsics are available without /arch
+        set(SIMD_DISPATCH_FOUND ON)
+    else (MSVC)
+        check_cxx_source_compiles(
+                "
+#include <immintrin.h>
+__attribute__((target(\"avx2,fma\"))) double f2(const double* x){
+    __m256d v = _mm256_loadu_pd(x);
+    v = _mm256_fmadd_pd(v, v, v);
+    return _mm_cvtsd_f64(_mm256_castpd256_pd128(v));
+}
+__attribute__((target(\"avx512f\"))) double f5(const double* x){
+    return _mm512_reduce_add_pd(_mm512_loadu_pd(x));
+}
+int main(){
+    double x[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports(\"avx512f\")) return (int) f5(x);
+    if (__builtin_cpu_supports(\"avx2\")) return (int) f2(x);
+    return 0;
+}"
+                SIMD_DISPATCH_FOUND)
+    endif (MSVC)
 
+    if (SIMD_DISPATCH_FOUND)
+        message("BUILD WITH SIMD RUNTIME DISPATCH")
+        add_definitions(-DIMPBFF_SIMD_DISPATCH)
+    endif (SIMD_DISPATCH_FOUND)
+
+    if (WITH_AVX AND AVX2_FOUND)
+        message("BUILD FOR BUILD HOST (AVX2)")
         if (MSVC)
-            # https://devblogs.microsoft.com/cppblog/simd-extension-to-c-openmp-in-visual-studio/
             # /Oi is for intrinsics
-            set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} /arch:AVX /Oi")
+            set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} /arch:AVX2 /Oi")
         else (MSVC)
-            set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -mavx -mfma")
+            set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -mavx2 -mfma")
         endif (MSVC)
-    else (${AVX_FOUND})
-        unset(WITH_AVX)
-    endif (${AVX_FOUND})
+    endif (WITH_AVX AND AVX2_FOUND)
 else ()
-    # AVX only on x86_64 and not on Apple
+    # SIMD kernels only on x86_64
     message("BUILD WITHOUT SIMD")
-    unset(WITH_AVX)
-endif()
\ No newline at end of file
+endif()
@@ -15,11 +15,15 @@
 #include <IMP/Decorator.h>
 #include <IMP/algebra/Vector3D.h>
 #include <IMP/algebra/Transformation3D.h>
+#include <IMP/algebra/Gaussian3D.h>
 #include <IMP/core/XYZ.h>
+#include <IMP/core/Gaussian.h>
+#include <IMP/core/rigid_bodies.h>
 #include <IMP/log.h>
 
 
 #include <IMP/bff/PathMap.h>
+#include <IMP/bff/PathMapPool.h>
 
 #include <string>
 #include <cmath>
@@ -27,6 +31,7 @@
 #include <limits>
 #include <iostream>            // std::cout, std::cout, std::flush
 
+#include <IMP/bff/internal/AVState.h>
 #include <IMP/bff/internal/json.h>
 #include <IMP/bff/internal/InverseSampler.h>
 // requires C++14
@@ -48,6 +53,13 @@ typedef enum{
 
 
 
+/// Contact volume trapped fraction of AVs without contact volume
+const double AV_CONTACT_VOLUME_DISABLED = -1.0;
+
+
+class AVCache;
+
+
 /// Container for experimental distance measurement
 class IMPBFFEXPORT AVPairDistanceMeasurement{
 
@@ -61,9 +73,35 @@ public:
     std::string position_1;
     std::string position_2;
 
+    /// Equally spaced distances (bin centers) of a distance distribution (pRDA)
+    std::vector<double> distribution_axis;
+
+    /// Experimental distance distribution on distribution_axis
+    std::vector<double> distribution;
+
+    /// Errors of the distance distribution (optional)
+    std::vector<double> distribution_error;
+
+    /// Weight of the score of the distance distribution
+    double distribution_weight = 1.0;
+
     /// Get a JSON string
     std::string get_json();
 
+    /**
+    @brief Score a model distance distribution against the experimental distribution.
+
+    Both distributions are normalized. If the experimental distribution
+    has errors the score is 0.5 chi2, otherwise the score is the
+    Kullback-Leibler divergence of the model from the experimental
+    distribution. Both scores are scaled by distribution_weight (e.g.
+    the number of molecules of a PDA histogram).
+
+    @param model The model distribution on distribution_axis.
+    @return The score of the model distribution.
+    */
+    double score_distribution(const std::vector<double> &model);
+
     /**
     @brief Score a model distance against the experimental distance.
     @param model The model distance to be scored.
@@ -71,6 +109,13 @@ public:
     */
     double score_model(double model);
 
+    /**
+    @brief Derivative of the score with respect to the model distance.
+    @param model The model distance.
+    @return The derivative of score_model at the model distance.
+    */
+    double score_model_derivative(double model);
+
 };
 
 
@@ -82,6 +127,10 @@ parameters and modify derivatives.
  AV must have IMP.Hierarchy parent with XYZ -> is labeling site
  AV coordinates = AV mean position
 
+ The path map, the AV in the frame of a rigid body, and the parameter
+ variants are stored on the AV particle. All AV decorators of a
+ particle share them.
+
 \ingroup helper
 \ingroup decorators
 \include AV_Decorator.py
@@ -89,12 +138,39 @@ parameters and modify derivatives.
 */
 class IMPBFFEXPORT AV : public IMP::core::Gaussian {
 
+    friend class AVCache;
+
 private:
 
-    IMP::bff::PathMap* av_map_ = nullptr;
+    /// Key of the AVState of the AV particle
+    static IMP::ObjectKey get_state_key();
+
+    /// State of the AV shared by all decorators of the particle (see AVState)
+    AVState* get_state() const;
+
+    /// Resample the accessible densities of the parameter variants
+    void resample_variants();
 
-protected:
+    /// True if obstacles that are not in the rigid body are in reach
+    bool get_has_foreign_obstacles() const;
 
+    /// Store the current AV in the internal frame of the rigid body
+    void store_rigid_body_av();
+
+    /// Set the Gaussian to the mean position and covariance of the AV
+    void set_gaussian_from_density();
+
+public:
+
+    /**
+     * @brief Get the AV parameters as a vector.
+     *
+     * linker_length, radius1, radius2, radius3, linker_width,
+     * allowed_sphere_radius, contact_volume_thickness,
+     * contact_volume_trapped_fraction, simulation_grid_resolution
+     *
+     * @return The AV parameters.
+     */
     IMP::algebra::VectorD<9> get_parameter() const {
         IMP::algebra::VectorD<9> v;
         v[0] = get_linker_length();
@@ -109,8 +185,6 @@ protected:
         return v;
     }
 
-public:
-
     /**
     @brief Creates a path map header.
     @return The created path map header.
@@ -171,7 +245,8 @@ public:
      * @param linker_width The width of the linker.
      * @param allowed_sphere_radius The radius of the allowed sphere.
      * @param contact_volume_thickness The thickness of the contact volume.
-     * @param contact_volume_trapped_fraction The fraction of the contact volume that is trapped.
+     * @param contact_volume_trapped_fraction The fraction of the contact volume that is trapped
+     * (AV_CONTACT_VOLUME_DISABLED disables the contact volume).
      * @param simulation_grid_resolution The resolution of the simulation grid.
      */
     static void do_setup_particle(Model *m, ParticleIndex pi,
@@ -181,7 +256,7 @@ public:
                                 double linker_width = 0.5,
                                 double allowed_sphere_radius = 1.5,
                                 double contact_volume_thickness = 0.0,
-                                double contact_volume_trapped_fraction = -1,
+                                double contact_volume_trapped_fraction = AV_CONTACT_VOLUME_DISABLED,
                                 double simulation_grid_resolution = 1.5) {
         if (!IMP::core::Gaussian::get_is_setup(m, pi)) {
             IMP::core::Gaussian::setup_particle(m, pi);
@@ -196,6 +271,7 @@ public:
         m->add_attribute(get_av_key(7), pi, contact_volume_trapped_fraction);
         m->add_attribute(get_av_key(8), pi, simulation_grid_resolution);
         m->add_attribute(get_particle_key(0), pi, pi_source);
+        m->add_attribute(get_state_key(), pi, new AVState());
     }
 
     /**
@@ -257,6 +333,18 @@ public:
     IMP_DECORATOR_GET_SET(contact_volume_trapped_fraction, get_av_key(7), Float, Float);
     IMP_DECORATOR_GET_SET(simulation_grid_resolution, get_av_key(8), Float, Float);
 
+    /**
+     * @brief Returns true if the density in the contact volume is weighted.
+     *
+     * The contact volume is used if its thickness is positive and the
+     * trapped fraction is in [0, 1]. A trapped fraction of
+     * AV_CONTACT_VOLUME_DISABLED (the default) disables the contact volume.
+     */
+    bool get_contact_volume_is_enabled() const {
+        double f = get_contact_volume_trapped_fraction();
+        return (get_contact_volume_thickness() > 0.0) && (f >= 0.0) && (f <= 1.0);
+    }
+
 
     /**
      * @brief Returns the radii of an object.
@@ -292,6 +380,29 @@ public:
         get_particle()->set_is_optimized(get_av_key(7), tf);
     }
 
+    /**
+     * @brief Sets the AV parameters from a vector (see get_parameter).
+     * @param v The AV parameters.
+     */
+    void set_parameter(const IMP::algebra::VectorD<9> &v){
+        set_linker_length(v[0]);
+        set_radius1(v[1]);
+        set_radius2(v[2]);
+        set_radius3(v[3]);
+        set_linker_width(v[4]);
+        set_allowed_sphere_radius(v[5]);
+        set_contact_volume_thickness(v[6]);
+        set_contact_volume_trapped_fraction(v[7]);
+        set_simulation_grid_resolution(v[8]);
+    }
+
+    /**
+     * @brief Get the AV parameters from a JSON object (with defaults).
+     * @param j The JSON object containing the AV parameter.
+     * @return The AV parameters (see get_parameter).
+     */
+    static IMP::algebra::VectorD<9> get_parameter(const nlohmann::json &j);
+
     /**
      * @brief Sets the AV parameter using a JSON object.
      *
@@ -315,6 +426,11 @@ public:
 
     /**
      * @brief Get the PathMap associated with the AV object.
+     *
+     * In rigid body mode the map is only updated if the AV is
+     * recomputed. Use the density accessors of the AV
+     * (e.g. get_xyz_density) for the current AV.
+     *
      * @return A pointer to the PathMap object.
      */
     IMP::bff::PathMap* get_map() const;
@@ -325,12 +441,149 @@ public:
      */
     void resample(bool shift_xyz=true);
 
+    /**
+     * @brief Returns the path map to the pool of path maps.
+     *
+     * The accessible density (points and moments) is kept, so that the
+     * density accessors of the AV (e.g. get_xyz_density) are valid until
+     * the next resample. The next resample acquires a map from the pool
+     * (see PathMapPool), which recycles grids of the same dimensions.
+     * Releasing the maps of AVs after resampling bounds the memory of
+     * large AV networks.
+     */
+    void release_map();
+
+    /// Returns true if the AV holds a path map
+    bool get_has_map() const { return get_state()->av_map.get() != nullptr; }
+
+    /// Number of times the AV was resampled (by any decorator of the particle)
+    unsigned get_update_count() const { return get_state()->update_count; }
+
+    /**
+     * @brief Set the rigid body mode.
+     *
+     * If the source and all obstacles in reach of the source belong to
+     * one rigid body, the AV is invariant in the frame of the body. In
+     * rigid body mode the AV is computed once in the internal frame of
+     * the rigid body of the source. On resample only the reference
+     * frame of the body is applied to the stored points and moments.
+     * The AV is recomputed if obstacles that are not members of the
+     * rigid body are in reach of the source or if the AV parameters
+     * changed.
+     *
+     * @param tf Flag to enable the rigid body mode. The source needs to
+     * be a rigid member of a rigid body (see IMP::core::RigidMember).
+     */
+    void set_rigid_body_mode(bool tf);
+
+    /// Returns true if the AV is in rigid body mode
+    bool get_rigid_body_mode() const { return get_state()->rigid_body_mode; }
+
+    /**
+     * @brief Set the cache of the AV.
+     *
+     * On resample the AV is taken from the cache if an AV with the same
+     * parameters and the same obstacles around the labeling site (in the
+     * local frame of the site) was computed before. Otherwise, the AV is
+     * computed and stored in the cache. AVs can share a cache. The cache
+     * is not used in rigid body mode and for AVs with parameter variants.
+     *
+     * @param cache The cache (nullptr to disable caching).
+     */
+    void set_cache(AVCache* cache);
+
+    /// The cache of the AV (nullptr if the AV is not cached)
+    AVCache* get_cache() const;
+
+    /**
+     * @brief Set discrete variants of the AV parameters.
+     *
+     * The variants differ in the linker length and the dye radius (all
+     * other parameters of the AV are used). On resample the map is
+     * sampled once with the grid of the longest linker. One path search
+     * serves all (nested) linker lengths. The obstacles of the linker, the
+     * dye radii, and the contact volumes are thresholds of one sampling of
+     * the obstacle clearance (see PathMap::sample_obstacle_clearance), as
+     * for a single AV. Thus, the map is not reallocated and the cost is
+     * the cost of one AV on the grid of the longest linker plus one pass
+     * over the grid per variant. The density of the AV is the weighted mixture of the normalized
+     * densities of the variants. The rigid body mode is not used for
+     * AVs with variants.
+     *
+     * @param linker_lengths Linker lengths of the variants.
+     * @param radii Dye radii of the variants.
+     * @param weights Prior weights of the variants (uniform if empty).
+     */
+    void set_parameter_variants(
+            const std::vector<double> &linker_lengths,
+            const std::vector<double> &radii,
+            std::vector<double> weights = std::vector<double>()
+    );
+
+    /// Removes the parameter variants
+    void clear_parameter_variants(){
+        set_parameter_variants(std::vector<double>(), std::vector<double>());
+    }
+
+    /// Number of parameter variants (zero if no variants are set)
+    int get_number_of_parameter_variants() const {
+        return (int) get_state()->variant_linker_lengths.size();
+    }
+
+    /// Normalized prior weight of a parameter variant
+    double get_parameter_variant_weight(int variant) const {
+        return get_state()->variant_weights[variant];
+    }
+
+    /**
+     * @brief Get the accessible density of a parameter variant.
+     *
+     * The densities of the variants are computed by resample, which
+     * needs to be called after the variants were set.
+     *
+     * @param variant The index of the variant.
+     * @return Vector of (x, y, z, density) of the accessible tiles.
+     */
+    std::vector<IMP::algebra::Vector4D> get_xyz_density(int variant) const;
+
+    /**
+     * @brief Distance from the source in which obstacles affect the AV.
+     * @return The maximum distance of an obstacle surface to the source.
+     */
+    double get_obstacle_reach() const;
+
+    /**
+     * @brief Get the accessible density of the AV.
+     * @return Vector of (x, y, z, density) of the accessible tiles.
+     */
+    std::vector<IMP::algebra::Vector4D> get_xyz_density() const;
+
+    /// Get the sum of the accessible density of the AV.
+    double get_density_sum() const;
+
+    /// Get the density weighted mean of the accessible density (without source).
+    IMP::algebra::Vector3D get_density_mean() const;
+
     /**
      * @brief Get the mean position of the AV object.
+     *
+     * The mean position is computed from the moments of the accessible
+     * density that are accumulated in the path search (O(1)).
+     *
      * @return The mean position as a Vector3D.
      */
     IMP::algebra::Vector3D get_mean_position(bool include_source=true) const;
 
+    /**
+     * @brief Get the covariance of the accessible density of the AV object.
+     *
+     * If resampled with shift_xyz the AV (a core::Gaussian) is set to
+     * a Gaussian with this covariance centered at the mean position.
+     *
+     * @return The covariance matrix of the accessible density.
+     */
+    Eigen::Matrix3d get_covariance() const;
+
     /**
      * @brief Get the source coordinates of the AV object.
      * @return The source coordinates as a Vector3D.
@@ -360,6 +613,20 @@ T inline fret_efficiency(T distance, double forster_radius){
     return 1. / (1. + rda_r0_6);
 }
 
+/**
+ * @brief Rotation matrix of a transformation.
+ * @param t The transformation.
+ * @return The rotation matrix of the transformation.
+ */
+inline Eigen::Matrix3d get_rotation_matrix(const IMP::algebra::Transformation3D &t){
+    Eigen::Matrix3d m;
+    for(int i = 0; i < 3; i++){
+        IMP::algebra::Vector3D row = t.get_rotation().get_rotation_matrix_row(i);
+        m.row(i) << row[0], row[1], row[2];
+    }
+    return m;
+}
+
 /**
  * @brief Computes the distance between two volumes given the FRET efficiency and Forster radius.
  * @tparam T The type of the distance.
@@ -372,6 +639,159 @@ T inline distance_fret(double fret_efficiency, double forster_radius){
     return forster_radius * std::pow(1. / fret_efficiency - 1.0, 1. / 6.);
 }
 
+/**
+ * @brief Orientation factor kappa2 of two dyes with order parameters.
+ *
+ * Eq. 9 in Sindbert et al., J. Am. Chem. Soc. 133, 2463-2480 (2011).
+ * The angles beta1 and beta2 enter only through their cosines.
+ *
+ * @param cos_delta Cosine of the angle between the symmetry axes of the dyes.
+ * @param sD2 Second rank order parameter of the donor.
+ * @param sA2 Second rank order parameter of the acceptor.
+ * @param cos_beta1 Cosine of the angle between the donor axis and RDA.
+ * @param cos_beta2 Cosine of the angle between the acceptor axis and RDA.
+ * @return The orientation factor kappa2.
+ */
+template<typename T>
+T inline kappasq_cos(T cos_delta, double sD2, double sA2, T cos_beta1, T cos_beta2){
+    T s2delta = (3.0 * cos_delta * cos_delta - 1.0) / 2.0;
+    T s2beta1 = (3.0 * cos_beta1 * cos_beta1 - 1.0) / 2.0;
+    T s2beta2 = (3.0 * cos_beta2 * cos_beta2 - 1.0) / 2.0;
+    return 2.0 / 3.0 * (
+            1.0 + sD2 * s2beta1 + sA2 * s2beta2 +
+            sD2 * sA2 * (
+                    s2delta + 6.0 * s2beta1 * s2beta2 + 1.0 +
+                    2.0 * s2beta1 + 2.0 * s2beta2 -
+                    9.0 * cos_beta1 * cos_beta2 * cos_delta
+            )
+    );
+}
+
+/**
+ * @brief Orientation factor kappa2 of two dyes with order parameters.
+ * @param delta Angle between the symmetry axes of the dyes (rad).
+ * @param sD2 Second rank order parameter of the donor.
+ * @param sA2 Second rank order parameter of the acceptor.
+ * @param beta1 Angle between the donor symmetry axis and RDA (rad).
+ * @param beta2 Angle between the acceptor symmetry axis and RDA (rad).
+ * @return The orientation factor kappa2.
+ */
+inline double kappasq(double delta, double sD2, double sA2, double beta1, double beta2){
+    return kappasq_cos<double>(std::cos(delta), sD2, sA2, std::cos(beta1), std::cos(beta2));
+}
+
+/**
+ * @brief Orientation factor distribution of a wobbling in a cone model.
+ *
+ * The donor axis is sampled on a grid of beta1 (0, pi/2) and the acceptor
+ * axis on a cone with the opening angle delta around the donor axis
+ * (phi in (0, 2 pi)). The grid starts at 0.001 rad and uses the same
+ * step for beta1 and phi. For every beta1 the kappa2 values of all phi
+ * are computed in a contiguous loop and histogrammed. The histograms are
+ * weighted by sin(beta1).
+ *
+ * @param delta Angle between the symmetry axes of the dyes (rad).
+ * @param sD2 Second rank order parameter of the donor.
+ * @param sA2 Second rank order parameter of the acceptor.
+ * @param step Step size of the angles in degree.
+ * @param n_bins Number of bin edges of the kappa2 axis.
+ * @param k2_min Lower kappa2 bound (first bin edge).
+ * @param k2_max Upper kappa2 bound (last bin edge).
+ * @return The kappa2 histogram (n_bins - 1 bins).
+ */
+IMPBFFEXPORT std::vector<double> kappasq_all_delta(
+        double delta,
+        double sD2,
+        double sA2,
+        double step = 0.25,
+        int n_bins = 31,
+        double k2_min = 0.0,
+        double k2_max = 4.0
+);
+
+/**
+ * @brief kappa2 values of the angle grid of kappasq_all_delta.
+ * @param[out] output kappa2 values (number of beta1 x number of phi).
+ * @param[out] n_output1 Number of beta1 angles.
+ * @param[out] n_output2 Number of phi angles.
+ * @param delta Angle between the symmetry axes of the dyes (rad).
+ * @param sD2 Second rank order parameter of the donor.
+ * @param sA2 Second rank order parameter of the acceptor.
+ * @param step Step size of the angles in degree.
+ */
+IMPBFFEXPORT void kappasq_all_delta_values(
+        double** output, int* n_output1, int* n_output2,
+        double delta,
+        double sD2,
+        double sA2,
+        double step = 0.25
+);
+
+/**
+ * @brief kappa2 histograms for many sets of dye parameters.
+ *
+ * Computes kappasq_all_delta for every row (delta, sD2, sA2) of the input
+ * in parallel, e.g., for all distances of a network.
+ *
+ * @param[in] input Dye parameters (number of sets x 3) with the columns
+ * delta (rad), sD2, and sA2.
+ * @param[in] n_input1 Number of sets.
+ * @param[in] n_input2 Number of columns (3).
+ * @param[out] output kappa2 histograms (number of sets x n_bins - 1).
+ * @param[out] n_output1 Number of sets.
+ * @param[out] n_output2 Number of histogram bins.
+ * @param step Step size of the angles in degree.
+ * @param n_bins Number of bin edges of the kappa2 axis.
+ * @param k2_min Lower kappa2 bound (first bin edge).
+ * @param k2_max Upper kappa2 bound (last bin edge).
+ */
+IMPBFFEXPORT void kappasq_all_delta_histograms(
+        double *input, int n_input1, int n_input2,
+        double** output, int* n_output1, int* n_output2,
+        double step = 0.25,
+        int n_bins = 31,
+        double k2_min = 0.0,
+        double k2_max = 4.0
+);
+
+/**
+ * @brief Distance and orientation factor kappa of two dipoles.
+ *
+ * The dipoles are defined by their end points. The distance is the
+ * distance between the centers of the dipoles.
+ *
+ * @param d1 First end point of the donor dipole.
+ * @param d2 Second end point of the donor dipole.
+ * @param a1 First end point of the acceptor dipole.
+ * @param a2 Second end point of the acceptor dipole.
+ * @return The distance and kappa.
+ */
+IMPBFFEXPORT std::vector<double> kappa_distance(
+        const IMP::algebra::Vector3D &d1,
+        const IMP::algebra::Vector3D &d2,
+        const IMP::algebra::Vector3D &a1,
+        const IMP::algebra::Vector3D &a2
+);
+
+/**
+ * @brief Distances and orientation factors kappa over a trajectory.
+ * @param[in] input Frames (number of frames x 3 * number of atoms).
+ * @param[in] n_input1 Number of frames.
+ * @param[in] n_input2 Number of coordinates per frame.
+ * @param[out] output Distances and kappa (number of frames x 2).
+ * @param[out] n_output1 Number of frames.
+ * @param[out] n_output2 Number of columns (2).
+ * @param aid1 Atom index of the first end point of the donor dipole.
+ * @param aid2 Atom index of the second end point of the donor dipole.
+ * @param aia1 Atom index of the first end point of the acceptor dipole.
+ * @param aia2 Atom index of the second end point of the acceptor dipole.
+ */
+IMPBFFEXPORT void kappa_distances(
+        double *input, int n_input1, int n_input2,
+        double** output, int* n_output1, int* n_output2,
+        int aid1, int aid2, int aia1, int aia2
+);
+
 /**
  * @brief Computes the distance to another accessible volume.
  * @param a The first accessible volume.
@@ -389,6 +809,132 @@ IMPBFFEXPORT double av_distance(
         int n_samples = 10000
 );
 
+/**
+ * @brief Computes the distance between two AVs approximated by Gaussians.
+ *
+ * Each AV is approximated by a normal distribution with the mean and
+ * the covariance of its accessible density. The difference vector of two
+ * AVs is normal with the difference of the means and the sum of the
+ * covariances. The expectation of the distance (or the FRET efficiency)
+ * over the difference vector is evaluated by a tensor product
+ * Gauss-Hermite quadrature in the principal axes of the covariance.
+ * The computation cost does not depend on the size of the AVs (fast
+ * distance mode for coarse sampling).
+ *
+ * @param a The first accessible volume.
+ * @param b The second accessible volume.
+ * @param forster_radius The Forster radius.
+ * @param distance_type The type of distance to compute.
+ * @param n_quadrature Number of quadrature nodes per dimension.
+ * @return The distance between the two accessible volumes (NaN for empty AVs).
+ */
+IMPBFFEXPORT double av_gaussian_distance(
+        const AV& a,
+        const AV& b,
+        double forster_radius = 52.0,
+        int distance_type = DYE_PAIR_DISTANCE_MEAN,
+        int n_quadrature = 5
+);
+
+/**
+ * @brief Gradient of the distance with respect to the position of the first AV.
+ *
+ * The AVs are approximated as translating with their sources and the
+ * gradient is computed for Gaussian AVs (see av_gaussian_distance)
+ * using the same quadrature. The gradient with respect to the position
+ * of the second AV is the negative gradient.
+ *
+ * @param a The first accessible volume.
+ * @param b The second accessible volume.
+ * @param forster_radius The Forster radius.
+ * @param distance_type The type of distance.
+ * @param n_quadrature Number of quadrature nodes per dimension.
+ * @return The gradient (zero for empty AVs).
+ */
+IMPBFFEXPORT IMP::algebra::Vector3D av_distance_gradient(
+        const AV& a,
+        const AV& b,
+        double forster_radius = 52.0,
+        int distance_type = DYE_PAIR_DISTANCE_MEAN,
+        int n_quadrature = 5
+);
+
+/**
+ * @brief Compares the Gaussian approximation to the sampled distance.
+ *
+ * @param a The first accessible volume.
+ * @param b The second accessible volume.
+ * @param forster_radius The Forster radius.
+ * @param distance_type The type of distance to compute.
+ * @param n_samples The number of samples used for the sampled distance.
+ * @param n_quadrature Number of quadrature nodes per dimension.
+ * @return Vector of the Gaussian approximation, the sampled (exact) distance,
+ * and the relative error of the approximation.
+ */
+IMPBFFEXPORT std::vector<double> av_gaussian_distance_error(
+        const AV& a,
+        const AV& b,
+        double forster_radius = 52.0,
+        int distance_type = DYE_PAIR_DISTANCE_MEAN,
+        int n_samples = 10000,
+        int n_quadrature = 5
+);
+
+/**
+ * @brief Computes the distances between the parameter variants of two AVs.
+ *
+ * AVs without parameter variants are treated as a single variant. The
+ * distance types DYE_PAIR_DISTANCE_MP and DYE_PAIR_XYZ_DISTANCE do not
+ * depend on the variants (single value).
+ *
+ * @param a The first accessible volume.
+ * @param b The second accessible volume.
+ * @param forster_radius The Forster radius.
+ * @param distance_type The type of distance to compute.
+ * @param n_samples The number of samples used per distance.
+ * @return The distances of the variant pairs (variants of a major).
+ */
+IMPBFFEXPORT std::vector<double> av_variant_distances(
+        const AV& a,
+        const AV& b,
+        double forster_radius = 52.0,
+        int distance_type = DYE_PAIR_DISTANCE_MEAN,
+        int n_samples = 10000
+);
+
+/**
+ * @brief Prior weights of the variant pairs of two AVs (see av_variant_distances).
+ * @param a The first accessible volume.
+ * @param b The second accessible volume.
+ * @param distance_type The type of distance.
+ * @return The products of the prior weights of the variants.
+ */
+IMPBFFEXPORT std::vector<double> av_variant_weights(
+        const AV& a,
+        const AV& b,
+        int distance_type = DYE_PAIR_DISTANCE_MEAN
+);
+
+/**
+ * @brief Distance distribution of two AVs on an axis.
+ *
+ * The distance distribution is the weighted histogram of all pair
+ * distances of the accessible densities of the AVs. Densities with more
+ * than n_points points are subsampled (inverse transform sampling).
+ *
+ * @param a The first accessible volume.
+ * @param b The second accessible volume.
+ * @param axis Equally spaced distances (bin centers).
+ * @param n_points Maximum number of points per AV.
+ * @return The normalized distance distribution.
+ */
+IMPBFFEXPORT std::vector<double> av_distance_histogram(
+        const AV& a,
+        const AV& b,
+        const std::vector<double> &axis,
+        int n_points = 1000
+);
+
 // Draw random points in AV. Returns (x,y,z,d) vector
 IMPBFFEXPORT std::vector<double> av_random_points(
         const AV& av1,
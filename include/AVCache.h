@@ -0,0 +1,190 @@
+/**
+ *  \file IMP/bff/AVCache.h
+ *  \brief Cache of accessible volumes keyed by the local environment.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+
+#ifndef IMPBFF_AVCACHE_H
+#define IMPBFF_AVCACHE_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <IMP/Object.h>
+#include <IMP/algebra/Vector3D.h>
+#include <IMP/algebra/VectorD.h>
+#include <IMP/algebra/Rotation3D.h>
+#include <IMP/algebra/Transformation3D.h>
+#include <IMP/core/XYZR.h>
+#include <IMP/atom/Atom.h>
+#include <IMP/atom/Residue.h>
+#include <IMP/atom/Hierarchy.h>
+
+#include <IMP/bff/AV.h>
+
+#include <Eigen/Dense>
+
+#include <list>
+#include <array>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include <mutex>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+/**
+ * @class AVCache
+ * @brief Library of precomputed accessible volumes (AVs).
+ *
+ * The AVCache stores the accessible density of AVs in a local frame
+ * of the labeling site. The key of an AV is a hash of the obstacles
+ * within reach of the source (in the local frame, quantized by a
+ * tolerance) and the AV parameters. AVs consult their cache on
+ * resample (see AV::set_cache). If an AV with the same key is
+ * requested, the path search is skipped and the stored density is
+ * transformed into the current frame. Entries are evicted in least
+ * recently used (LRU) order if the memory budget is exceeded.
+ *
+ * The local frame is defined by the source and the N, CA, and C atoms
+ * of the residue of the source. If these are not available, the local
+ * frame is only translated to the source.
+ *
+ * A cache can be shared by AVs that are resampled by multiple threads
+ * (e.g. by get_av_network_scores). Misses of the same AV in different
+ * threads compute the AV in each thread.
+ */
+class IMPBFFEXPORT AVCache : public IMP::Object {
+
+private:
+
+    struct Entry{
+        std::vector<std::int64_t> descriptor;
+        std::vector<IMP::algebra::Vector4D> points;
+        IMP::algebra::Vector3D mean;
+        Eigen::Matrix3d covariance;
+        double density_sum;
+        size_t memory;
+    };
+
+    using LRUList = std::list<std::uint64_t>;
+
+    size_t memory_budget_;
+    size_t memory_usage_ = 0;
+    double tolerance_;
+    size_t n_hits_ = 0;
+    size_t n_misses_ = 0;
+
+    LRUList lru_;
+    std::unordered_map<std::uint64_t, std::pair<Entry, LRUList::iterator>> entries_;
+
+    // AVs of different models (e.g. replicas scored in parallel) share a
+    // cache. Entries, LRU list, and counts are accessed under the lock.
+    mutable std::mutex mutex_;
+
+    /// Quantized obstacles within reach of the source and AV parameters
+    std::vector<std::int64_t> get_descriptor(
+            const AV &av,
+            const IMP::algebra::Transformation3D &frame
+    ) const;
+
+    /// Remove least recently used entries until the budget is met (needs lock)
+    void evict();
+
+    /// Lookup an entry. Returns nullptr for cache misses (needs lock).
+    Entry* find(
+            std::uint64_t key,
+            const std::vector<std::int64_t> &descriptor
+    );
+
+    /**
+     * Set the stored density of an AV to a cached AV (see AV::resample).
+     * @return false for cache misses.
+     */
+    bool load(AV &av);
+
+    /// Store the density of a resampled AV (see AV::resample)
+    void store(const AV &av);
+
+    friend class AV;
+
+public:
+
+    /**
+     * @brief Constructs an AV cache.
+     * @param memory_budget Maximum memory used by the stored AVs in bytes.
+     * @param tolerance Obstacle coordinates and radii are quantized by this
+     * tolerance (in Angstrom) before hashing.
+     * @param name The name of the cache.
+     */
+    AVCache(
+            size_t memory_budget = 256 * 1024 * 1024,
+            double tolerance = 0.05,
+            std::string name = "AVCache%1%"
+    );
+
+    /**
+     * @brief Local frame of the labeling site of an AV.
+     * @param av The accessible volume.
+     * @return Transformation from the local frame to the global frame.
+     */
+    static IMP::algebra::Transformation3D get_local_frame(const AV &av);
+
+    /**
+     * @brief Accessible density of an AV.
+     *
+     * Sets the cache of the AV to this cache (see AV::set_cache) and
+     * resamples the AV. On a cache hit the stored density is transformed
+     * into the current frame. On a miss the AV is computed and stored.
+     *
+     * @param av The accessible volume.
+     * @param shift_xyz If true the AV is set to the Gaussian approximation
+     * of the accessible density (as in AV::resample).
+     * @return Vector of (x, y, z, density) of the accessible tiles.
+     */
+    std::vector<IMP::algebra::Vector4D> get_xyz_density(
+            AV &av, bool shift_xyz = true);
+
+    /**
+     * @brief Check if an AV is in the cache.
+     * @param av The accessible volume.
+     * @return true if the AV is stored.
+     */
+    bool get_is_cached(const AV &av);
+
+    /// Remove all stored AVs
+    void clear();
+
+    /// Number of stored AVs
+    size_t get_number_of_entries() const;
+
+    /// Number of cache hits
+    size_t get_number_of_hits() const;
+
+    /// Number of cache misses
+    size_t get_number_of_misses() const;
+
+    /// Estimated memory used by the stored AVs in bytes
+    size_t get_memory_usage() const;
+
+    /// Maximum memory used by the stored AVs in bytes
+    size_t get_memory_budget() const;
+
+    /// Set the maximum memory used by the stored AVs in bytes
+    void set_memory_budget(size_t v);
+
+    IMP_OBJECT_METHODS(AVCache);
+
+};
+
+IMP_OBJECTS(AVCache, AVCaches);
+
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_AVCACHE_H
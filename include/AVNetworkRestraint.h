@@ -17,13 +17,17 @@
 #include <IMP/Restraint.h>
 #include <IMP/Object.h>
 #include <IMP/Pointer.h>
+#include <IMP/thread_macros.h>
 #include <IMP/atom/Hierarchy.h>
 #include <IMP/UnaryFunction.h>
 
 #include <IMP/bff/AV.h>
+#include <IMP/bff/AVUpdater.h>
+#include <IMP/bff/AVRegistry.h>
 #include <IMP/bff/internal/FPSReaderWriter.h>
 #include <IMP/bff/internal/json.h>
 
+#include <set>
 #include <vector>
 #include <algorithm>
 
@@ -83,10 +87,41 @@ private:
     /// Map of experimental distance measurements (incl. errors)
     std::map<std::string, AVPairDistanceMeasurement> distances_;
 
+    /// If true only AVs with changed inputs are resampled
+    bool lazy_evaluation_ = false;
+
+    /// If true the path maps of AVs are released after resampling
+    bool release_path_maps_ = false;
+
+    /// Maximum number of points per AV in distance distributions
+    int n_distribution_points_ = 1000;
+
+    /// Registry of the AVs shared in the model
+    IMP::PointerMember<AVRegistry> av_registry_;
+
+    /// Score state that resamples the AVs (optional)
+    IMP::PointerMember<AVUpdater> av_updater_;
+
+    // Cache of the last evaluation. AVs are resampled if particles in
+    // reach of their source moved or if their parameters changed (see
+    // AVRegistry::update_avs). Model distances are recomputed if one of
+    // the two AVs was resampled (see AV::get_update_count).
+    mutable bool cache_valid_ = false;
+    mutable int n_updated_avs_ = 0;
+    mutable std::map<std::string, unsigned> av_update_counts_;
+    mutable std::map<std::string, double> model_distances_;
+    mutable std::map<std::string, double> model_scores_;
+    mutable std::map<std::string, double> model_score_derivatives_;
+    mutable std::map<std::string, IMP::algebra::Vector3D> model_gradients_;
+
+    /// Names of the AVs that changed since the last evaluation
+    std::set<std::string> get_changed_avs() const;
+
     /// Find and decorate labeled particles with accessible volume (AVs)
     /** This is method is automatically called by the constructor.
      *  You only need to call this if you change parameters of
-     *  AVs (e.g., the linker length).
+     *  AVs (e.g., the linker length). The AVs are shared with other
+     *  restraints of the model via the AVRegistry of the model.
      */
     std::map<std::string, IMP::bff::AV*> create_av_decorated_particles(
             nlohmann::json used_positions,
@@ -154,6 +189,101 @@ public:
     ) const;
 
 
+    /**
+     * @brief Sets the rigid body mode of the AVs.
+     *
+     * The rigid body mode is set for all AVs with a source that is a
+     * rigid member of a rigid body (see AV::set_rigid_body_mode).
+     * @param[in] tf Flag to enable the rigid body mode.
+     */
+    void set_rigid_body_mode(bool tf);
+
+    /**
+     * @brief Marginalizes the score over parameter variants of an AV.
+     *
+     * The distance scores of the AV are marginalized over the variants
+     * (linker length, dye radius) with their prior weights, i.e., the
+     * score of a distance is -log(sum_ij w_ij exp(-score_ij)) over the
+     * variant pairs of the two AVs. The variants share one path search
+     * (see AV::set_parameter_variants). The AV is shared with other
+     * restraints of the model that use the same labeling site.
+     *
+     * @param[in] position_name The name of the labeling position.
+     * @param[in] linker_lengths Linker lengths of the variants.
+     * @param[in] radii Dye radii of the variants.
+     * @param[in] weights Prior weights of the variants (uniform if empty).
+     */
+    void set_parameter_variants(
+            std::string position_name,
+            const std::vector<double> &linker_lengths,
+            const std::vector<double> &radii,
+            const std::vector<double> &weights = std::vector<double>()
+    );
+
+    /**
+     * @brief Sets the lazy evaluation of the restraint.
+     *
+     * In lazy evaluation only the AVs that have moved particles in reach
+     * of their source (or changed parameters) are resampled, and only the
+     * model distances of these AVs are recomputed. The score is summed
+     * from the cached terms. Lazy evaluation is disabled by default.
+     * @param[in] tf Flag to enable lazy evaluation.
+     */
+    void set_lazy_evaluation(bool tf){
+        lazy_evaluation_ = tf;
+        cache_valid_ = false;
+    }
+
+    /**
+     * @brief Sets a score state that resamples the AVs.
+     *
+     * The AVs of the restraint are replaced by the (shared) AVs of the
+     * updater. The restraint does not resample the AVs and reads the
+     * AV particles that are outputs of the updater. Thus, multiple
+     * restraints can share the AVs of one updater.
+     * @param[in] updater The AV updater.
+     */
+    void set_av_updater(AVUpdater* updater);
+
+    /**
+     * @brief Sets the number of points per AV in distance distributions.
+     *
+     * Distance distributions (pRDA) are scored by the pair distance
+     * histogram of the AVs (see av_distance_histogram). AVs with more
+     * accessible tiles are subsampled to the number of points.
+     * @param[in] n The maximum number of points per AV.
+     */
+    void set_number_of_distribution_points(int n){
+        n_distribution_points_ = n;
+        cache_valid_ = false;
+    }
+
+    /**
+     * @brief Release the path maps of the AVs after resampling.
+     *
+     * The AVs keep their accessible densities and return their grids to
+     * the pool of path maps (see AV::release_map and PathMapPool). Thus,
+     * only one grid per AV parameter set is allocated at a time.
+     * @param[in] tf Flag to release the path maps.
+     */
+    void set_release_path_maps(bool tf){ release_path_maps_ = tf; }
+
+    /// Returns the score state that resamples the AVs (may be nullptr)
+    AVUpdater* get_av_updater() const { return av_updater_; }
+
+    /// Returns true if the restraint is lazily evaluated
+    bool get_lazy_evaluation() const { return lazy_evaluation_; }
+
+    /// Model distances (or FRET efficiencies) of the last evaluation
+    /** For AVs with parameter variants the prior weighted mean over the
+     *  variants is reported. */
+    std::map<std::string, double> get_model_distances() const {
+        return model_distances_;
+    }
+
+    /// Number of AVs resampled in the last evaluation
+    int get_number_of_updated_avs() const { return n_updated_avs_; }
+
     /**
      * @brief Returns the particle indexes of the AVs.
      * @return The particle indexes.
@@ -164,6 +294,11 @@ public:
 
     /**
      * @brief Evaluates the restraint.
+     *
+     * Derivatives are computed in a mean position approximation:
+     * the AVs translate with their source particles and the gradient
+     * of a distance is computed for Gaussian AVs (see av_distance_gradient).
+     *
      * @param[in] accum The derivative accumulator.
      * @return The score of the restraint.
      */
@@ -185,6 +320,30 @@ public:
 
 };
 
+IMP_OBJECTS(AVNetworkRestraint, AVNetworkRestraints);
+
+/**
+ * @brief Scores multiple AV network restraints in parallel.
+ *
+ * The restraints are evaluated over the threads of IMP (see
+ * IMP::set_number_of_threads), e.g., the restraints of the replicas of a
+ * replica exchange in one process. Each restraint must have its own model
+ * and must not use an AVUpdater, as the AVs are resampled by the
+ * restraints. The models are updated (see IMP::Model::update) before the
+ * restraints are scored, so that the score states (e.g. rigid bodies)
+ * are applied to the coordinates of every replica. Derivatives are not
+ * computed. Each AV reuses its path map and buffers over evaluations.
+ * The neighbor offsets of the path search are shared by the path maps
+ * of the same grid, and released path maps are recycled by the
+ * PathMapPool (see AVNetworkRestraint::set_release_path_maps).
+ *
+ * @param[in] restraints The restraints (e.g. one per replica).
+ * @return The scores of the restraints.
+ */
+IMPBFFEXPORT std::vector<double> get_av_network_scores(
+        const AVNetworkRestraints &restraints
+);
+
 
 IMPBFF_END_NAMESPACE
 
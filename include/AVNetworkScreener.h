@@ -0,0 +1,152 @@
+/**
+ *  \file IMP/bff/AVNetworkScreener.h
+ *  \brief Screening of structures against a network of accessible volumes.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+
+#ifndef IMPBFF_AVNETWORKSCREENER_H
+#define IMPBFF_AVNETWORKSCREENER_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <IMP/Model.h>
+#include <IMP/Object.h>
+#include <IMP/Pointer.h>
+#include <IMP/atom/Hierarchy.h>
+
+#include <IMP/bff/AVNetworkRestraint.h>
+
+#include <string>
+#include <vector>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+/**
+ * @class AVNetworkScreener
+ * @brief Scores many frames of a structure against one fps.json network.
+ *
+ * The screener reads the topology (a PDB file) once. Each worker has
+ * its own model, parsed from the topology, with an AVNetworkRestraint of
+ * the fps.json network. The frames are distributed over the workers in
+ * parallel (see IMP::set_number_of_threads). The AVs, path maps, and
+ * buffers of a worker are reused over the frames of the worker.
+ *
+ * A frame is a flat array of the coordinates (x1, y1, z1, x2, ...) of
+ * the leaves of the hierarchy in the order of IMP::atom::get_leaves.
+ * The per-frame scores and the model values (distances or FRET
+ * efficiencies) of the used distances are kept by the screener and can
+ * be written to a NumPy structured array (.npy) file.
+ */
+class IMPBFFEXPORT AVNetworkScreener : public IMP::Object {
+
+private:
+
+    std::vector<IMP::PointerMember<IMP::Model>> models_;
+    std::vector<IMP::ParticleIndexes> leaves_;
+    AVNetworkRestraints restraints_;
+    std::vector<std::string> distance_names_;
+
+    /// Scores of the frames
+    std::vector<double> scores_;
+
+    /// Model values of the frames (frame major)
+    std::vector<double> model_values_;
+
+    /// Sets the coordinates of a worker and scores the frame
+    void score_frame(int worker, const double *xyz, int frame);
+
+public:
+
+    /**
+     * @brief Constructs an AV network screener.
+     * @param[in] pdb_fn The PDB file of the topology.
+     * @param[in] fps_json_fn The filename of the fps.json file.
+     * @param[in] score_set The name of the score set in the fps.json file.
+     * @param[in] n_samples The number of samples in distance computations.
+     * @param[in] n_workers The number of workers (models). If smaller
+     * than one, the number of IMP threads is used.
+     * @param[in] name The name of the screener.
+     */
+    AVNetworkScreener(
+            std::string pdb_fn,
+            std::string fps_json_fn,
+            std::string score_set = "",
+            int n_samples = 50000,
+            int n_workers = -1,
+            std::string name = "AVNetworkScreener%1%"
+    );
+
+    /// Number of workers (models) of the screener
+    int get_number_of_workers() const { return (int) restraints_.size(); }
+
+    /// Number of coordinates of a frame (three times the number of leaves)
+    int get_number_of_coordinates() const { return 3 * (int) leaves_[0].size(); }
+
+    /// Names of the distances of the score set (columns of the model values)
+    std::vector<std::string> get_distance_names() const { return distance_names_; }
+
+    /// The restraint of a worker
+    AVNetworkRestraint* get_restraint(int worker = 0) const {
+        return restraints_[worker];
+    }
+
+    /**
+     * @brief Scores frames.
+     *
+     * The results are appended to the scores and model values of the
+     * screener.
+     *
+     * @param[in] input Frames (number of frames x number of coordinates).
+     * @param[in] n_input1 Number of frames.
+     * @param[in] n_input2 Number of coordinates per frame.
+     * @return The scores of the frames.
+     */
+    std::vector<double> score_frames(double *input, int n_input1, int n_input2);
+
+    /// Removes the scores and model values of the screened frames
+    void clear(){
+        scores_.clear();
+        model_values_.clear();
+    }
+
+    /// Number of screened frames
+    int get_number_of_frames() const { return (int) scores_.size(); }
+
+    /// Scores of the screened frames
+    std::vector<double> get_scores() const { return scores_; }
+
+    /**
+     * @brief Model values of the screened frames.
+     * @param[out] output Model values (number of frames x number of distances).
+     * @param[out] n_output1 Number of frames.
+     * @param[out] n_output2 Number of distances.
+     */
+    void get_model_values(double** output, int* n_output1, int* n_output2) const;
+
+    /**
+     * @brief Writes the results of the screened frames to a file.
+     *
+     * The file is a NumPy (.npy) structured array with one
+     * record per frame. The first field "score" is the score of the frame
+     * followed by one field per distance (see get_distance_names). All
+     * fields are little-endian float64. Version 2.0 of the format is
+     * written if the header is too long for version 1.0.
+     *
+     * @param[in] filename The output filename.
+     */
+    void write(std::string filename) const;
+
+    IMP_OBJECT_METHODS(AVNetworkScreener);
+
+};
+
+IMP_OBJECTS(AVNetworkScreener, AVNetworkScreeners);
+
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_AVNETWORKSCREENER_H
@@ -0,0 +1,144 @@
+/**
+ *  \file IMP/bff/AVRegistry.h
+ *  \brief Registry of accessible volumes shared in a model.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+
+#ifndef IMPBFF_AVREGISTRY_H
+#define IMPBFF_AVREGISTRY_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <IMP/Model.h>
+#include <IMP/Object.h>
+#include <IMP/Pointer.h>
+#include <IMP/key_types.h>
+
+#include <IMP/bff/AV.h>
+#include <IMP/bff/internal/AVInputTracker.h>
+#include <IMP/bff/internal/json.h>
+
+#include <set>
+#include <memory>
+#include <vector>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+/**
+ * @class AVRegistry
+ * @brief Per-model registry of accessible volumes (AVs).
+ *
+ * AVs are keyed by the labeling site (the source particle) and the AV
+ * parameter vector. Restraints that request an AV of a registered
+ * labeling site with the same parameters share the AV particle and its
+ * path map, e.g., AVNetworkRestraints over different score sets of the
+ * same fps.json file. The registry of a model is stored in the model
+ * data (see get_registry).
+ */
+class IMPBFFEXPORT AVRegistry : public IMP::Object {
+
+private:
+
+    IMP::WeakPointer<IMP::Model> model_;
+    std::vector<std::unique_ptr<AV>> avs_;
+
+    // Inputs of the AVs. AVs are resampled once after their inputs
+    // changed, no matter how many restraints or updaters use them.
+    IMP::ParticleIndexes model_ps_;
+    std::set<IMP::ParticleIndex> model_ps_set_;
+    AVInputTracker tracker_;
+    std::vector<bool> outdated_;
+
+public:
+
+    /**
+     * @brief Constructs an AV registry.
+     * @param[in] m The model.
+     * @param[in] name The name of the registry.
+     */
+    AVRegistry(IMP::Model* m, std::string name = "AVRegistry%1%");
+
+    /**
+     * @brief Returns the registry of a model (created if needed).
+     * @param[in] m The model.
+     * @return The AV registry of the model.
+     */
+    static AVRegistry* get_registry(IMP::Model* m);
+
+    /**
+     * @brief Returns the AV of a labeling site.
+     *
+     * A new AV particle is created if no AV with the same labeling site
+     * and the same parameters is registered.
+     *
+     * @param[in] source The particle index of the labeling site.
+     * @param[in] parameter The AV parameters (see AV::get_parameter).
+     * @param[in] name The name of a new AV particle.
+     * @return The registered AV.
+     */
+    AV* get_av(
+            IMP::ParticleIndex source,
+            const IMP::algebra::VectorD<9> &parameter,
+            std::string name = "AV%1%"
+    );
+
+    /**
+     * @brief Returns the AV of a labeling site.
+     * @param[in] source The particle index of the labeling site.
+     * @param[in] parameter JSON object with the AV parameters.
+     * @param[in] name The name of a new AV particle.
+     * @return The registered AV.
+     */
+    AV* get_av(
+            IMP::ParticleIndex source,
+            const nlohmann::json &parameter,
+            std::string name = "AV%1%"
+    ){
+        return get_av(source, AV::get_parameter(parameter), name);
+    }
+
+    /**
+     * @brief Returns the registered AV of an AV particle.
+     * @param[in] av_pi The particle index of the AV.
+     * @return The registered AV (nullptr if the AV is not registered).
+     */
+    AV* get_registered_av(IMP::ParticleIndex av_pi) const;
+
+    /**
+     * @brief Resamples the AVs with changed inputs.
+     *
+     * The inputs (the coordinates of the particles of the hierarchies of
+     * the labeling sites and the AV parameters) of all registered AVs are
+     * tracked by the registry (see AVInputTracker). An AV is outdated if
+     * its inputs changed since it was resampled by the registry. Only the
+     * outdated AVs in avs are resampled. Thus, an AV that is shared by
+     * multiple restraints is resampled once per change of its inputs.
+     *
+     * @param[in] avs Registered AVs.
+     * @return Flags of the resampled AVs.
+     */
+    std::vector<bool> update_avs(const std::vector<AV*> &avs);
+
+    /// Particles of the hierarchies of the labeling sites of the AVs
+    const IMP::ParticleIndexes& get_model_particles() const { return model_ps_; }
+
+    /// Returns the registered AVs
+    AVs get_avs() const;
+
+    /// Number of registered AVs
+    unsigned get_number_of_avs() const { return (unsigned) avs_.size(); }
+
+    IMP_OBJECT_METHODS(AVRegistry);
+
+};
+
+IMP_OBJECTS(AVRegistry, AVRegistries);
+
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_AVREGISTRY_H
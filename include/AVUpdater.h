@@ -0,0 +1,108 @@
+/**
+ *  \file IMP/bff/AVUpdater.h
+ *  \brief Score state that resamples accessible volumes.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+
+#ifndef IMPBFF_AVUPDATER_H
+#define IMPBFF_AVUPDATER_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <IMP/Model.h>
+#include <IMP/ScoreState.h>
+#include <IMP/atom/Hierarchy.h>
+
+#include <IMP/bff/AV.h>
+#include <IMP/bff/AVRegistry.h>
+
+#include <vector>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+/**
+ * @class AVUpdater
+ * @brief A score state that resamples accessible volumes (AVs).
+ *
+ * The AVUpdater resamples its AVs once per model update before the
+ * restraints are evaluated. The AV particles are outputs and the
+ * particles of the hierarchies of the labeling sites are inputs of the
+ * score state. Thus, the AVUpdater is part of the dependency graph of
+ * restraints that read the AVs. AVs with the same labeling site and the
+ * same AV parameters are shared, e.g., by multiple AVNetworkRestraints
+ * that use different score sets. Only AVs with moved particles in reach
+ * of their labeling site are resampled.
+ */
+class IMPBFFEXPORT AVUpdater : public IMP::ScoreState {
+
+private:
+
+    /// Registry that owns the AVs and tracks their inputs
+    IMP::PointerMember<AVRegistry> registry_;
+    std::vector<AV*> avs_;
+    bool lazy_evaluation_ = false;
+
+public:
+
+    /**
+     * @brief Constructs an AV updater.
+     * @param[in] m The model.
+     * @param[in] name The name of the score state.
+     */
+    AVUpdater(IMP::Model* m, std::string name = "AVUpdater%1%");
+
+    /**
+     * @brief Adds an AV to the updater.
+     *
+     * The AV needs to be registered in the AVRegistry of the model. The
+     * updater resamples the AV of the registry.
+     *
+     * @param[in] av_pi The particle index of the AV.
+     * @return The AV updated by the score state.
+     */
+    AV* add_av(IMP::ParticleIndex av_pi);
+
+    /// Returns the AVs updated by the score state
+    AVs get_avs() const;
+
+    /**
+     * @brief Number of times an AV was resampled (see AV::get_update_count).
+     * @param[in] av_pi The particle index of the AV.
+     * @return The number of updates (zero for unknown AVs).
+     */
+    unsigned get_update_count(IMP::ParticleIndex av_pi) const;
+
+    /**
+     * If true only AVs with changed inputs are resampled. The inputs are
+     * tracked per AV by the registry (see AVRegistry::update_avs). Lazy
+     * evaluation is disabled by default (as in AVNetworkRestraint).
+     */
+    void set_lazy_evaluation(bool tf){
+        lazy_evaluation_ = tf;
+    }
+
+    /// Returns true if only AVs with changed inputs are resampled
+    bool get_lazy_evaluation() const { return lazy_evaluation_; }
+
+    virtual void do_before_evaluate() override;
+
+    virtual void do_after_evaluate(IMP::DerivativeAccumulator *da) override;
+
+    virtual IMP::ModelObjectsTemp do_get_inputs() const override;
+
+    virtual IMP::ModelObjectsTemp do_get_outputs() const override;
+
+    IMP_OBJECT_METHODS(AVUpdater);
+
+};
+
+IMP_OBJECTS(AVUpdater, AVUpdaters);
+
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_AVUPDATER_H
@@ -0,0 +1,211 @@
+/**
+ * \file IMP/bff/DecayBatchFit.h
+ * \brief Parallel fits of many fluorescence decays (FLIM pixels, bursts)
+ *
+ * \authors Thomas-Otavio Peulen
+ * Copyright 2007-2023 IMP Inventors. All rights reserved.
+ *
+ */
+
+#ifndef IMPBFF_DECAYBATCHFIT_H
+#define IMPBFF_DECAYBATCHFIT_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <IMP/bff/DecayCurve.h>
+#include <IMP/bff/DecayConvolution.h>
+#include <IMP/bff/DecayLinearization.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+/**
+ * @brief Fits the decays of an image stack or of bursts in parallel.
+ *
+ * DecayConvolution and DecayScore keep mutable state (corrected IRF,
+ * convolution buffers, model and data curves) and cannot be shared
+ * between threads. The batch fit has one worker per thread. A worker has
+ * its own pipeline (lifetime handler, convolution, scatter, background,
+ * scale, score, DecayModel, and DecayFit) that is reused over the decays
+ * of the worker. The IRF and the linearization are shared by all workers
+ * and are only read while fitting.
+ *
+ * The model of a decay is the convolution of the lifetime spectrum with
+ * the IRF, a scatter fraction (the IRF as pattern), a constant
+ * background, the linearization (optional), and the scaling to the
+ * number of photons of the decay. Every decay is fitted starting from the
+ * same initial lifetime spectrum (see DecayFit).
+ */
+class IMPBFFEXPORT DecayBatchFit {
+
+private:
+    struct Worker;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    int n_workers_ = 1;
+
+    // shared read-only data
+    DecayCurve irf_;
+    std::unique_ptr<DecayLinearization> linearization_;
+
+    // settings of the workers
+    int convolution_method_ = DecayConvolution::FAST;
+    double excitation_period_ = 100.0;
+    double irf_shift_channels_ = 0.0;
+    double irf_background_counts_ = 0.0;
+    double scatter_fraction_ = 0.0;
+    double constant_background_ = 0.0;
+    int start_ = 0;
+    int stop_ = -1;
+    std::string score_type_ = "poisson";
+    std::vector<double> lifetime_spectrum_;
+    std::vector<double> lower_bounds_;
+    std::vector<double> upper_bounds_;
+    std::vector<int> fixed_;
+    int max_iterations_ = 100;
+    double tolerance_ = 1e-8;
+    double min_number_of_photons_ = 0.0;
+
+    // results, one entry (row) per decay
+    std::vector<double> parameters_;
+    std::vector<double> scores_;
+    std::vector<int> iterations_;
+
+    void build_workers();
+
+    /// Fit decay i of input with worker w
+    void fit_decay(int w, const double *input, int n_channels, int i);
+
+public:
+
+    /// Number of channels of the decays (size of the IRF)
+    int get_number_of_channels() const;
+
+    /// Number of workers (parallel pipelines)
+    int get_number_of_workers() const;
+
+    /**
+     * Set the initial lifetime spectrum of the fits (amplitude1,
+     * lifetime1, amplitude2, lifetime2, ...).
+     */
+    void set_lifetime_spectrum(std::vector<double> v);
+
+    /// Initial lifetime spectrum of the fits
+    std::vector<double> get_lifetime_spectrum() const;
+
+    /// Number of parameters of a fit (size of the lifetime spectrum)
+    int get_number_of_parameters() const;
+
+    /// Set the bounds of the parameters (see DecayFit::set_bounds)
+    void set_bounds(std::vector<double> lower, std::vector<double> upper);
+
+    /// Set the parameters that are not optimized (see DecayFit::set_fixed)
+    void set_fixed(std::vector<int> v);
+
+    /// Set the maximum number of iterations of a fit
+    void set_max_iterations(int v);
+
+    /// Maximum number of iterations of a fit
+    int get_max_iterations() const;
+
+    /// Set the relative decrease of the score at which a fit converged
+    void set_tolerance(double v);
+
+    /// Relative decrease of the score at which a fit converged
+    double get_tolerance() const;
+
+    /// Set the score type (see DecayScore)
+    void set_score_type(std::string v);
+
+    /// Score type
+    std::string get_score_type() const;
+
+    /// Set the fraction of scattered light (IRF) in the model decays
+    void set_scatter_fraction(double v);
+
+    /// Fraction of scattered light in the model decays
+    double get_scatter_fraction() const;
+
+    /// Set the constant background counts of the model decays
+    void set_constant_background(double v);
+
+    /// Constant background counts of the model decays
+    double get_constant_background() const;
+
+    /**
+     * Set the minimum number of photons of a decay. Decays with fewer
+     * photons are not fitted (the score is NaN and the parameters are the
+     * initial lifetime spectrum).
+     */
+    void set_min_number_of_photons(double v);
+
+    /// Minimum number of photons of a fitted decay
+    double get_min_number_of_photons() const;
+
+    /**
+     * Set the linearization of the model decays.
+     * \param linearization_table The linearization table (see DecayLinearization).
+     * \param n_window The window of the moving average of the table.
+     */
+    void set_linearization_table(DecayCurve* linearization_table, int n_window = 5);
+
+    /**
+     * @brief Fits the decays in parallel.
+     *
+     * The decays are distributed over the workers in blocks. The
+     * parameters, the scores, and the number of iterations of the fits
+     * are kept until the next call.
+     *
+     * @param input Decays, one decay per row. The number of columns
+     * matches the number of channels of the IRF. An image stack of
+     * nx*ny pixels is passed as nx*ny rows.
+     * @return The scores of the fits.
+     */
+    std::vector<double> fit(double *input, int n_input1, int n_input2);
+
+    /**
+     * @brief Optimized parameters of the last fit.
+     * @param output Lifetime spectra, one row per decay.
+     */
+    void get_parameters(double** output, int* n_output1, int* n_output2) const;
+
+    /// Scores of the last fit
+    std::vector<double> get_scores() const;
+
+    /// Number of iterations of the last fit (negative if not converged)
+    std::vector<int> get_number_of_iterations() const;
+
+    /**
+     * Construct a batch fit.
+     * \param irf The instrument response function (copied).
+     * \param lifetime_spectrum The initial lifetime spectrum of the fits.
+     * \param convolution_method The convolution method (see DecayConvolution).
+     * \param excitation_period The excitation period.
+     * \param irf_shift_channels The shift of the IRF in channels.
+     * \param irf_background_counts The background counts of the IRF.
+     * \param start The start of the convolution and score range.
+     * \param stop The stop of the convolution and score range.
+     * \param score_type The score type (see DecayScore).
+     * \param n_workers The number of workers. If smaller than one, the
+     * number of threads of IMP is used (see IMP::get_number_of_threads).
+     */
+    DecayBatchFit(
+            DecayCurve* irf,
+            std::vector<double> lifetime_spectrum = std::vector<double>(),
+            int convolution_method = DecayConvolution::FAST,
+            double excitation_period = 100.0,
+            double irf_shift_channels = 0.0,
+            double irf_background_counts = 0.0,
+            int start = 0, int stop = -1,
+            std::string score_type = "poisson",
+            int n_workers = -1
+    );
+
+    ~DecayBatchFit();
+};
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_DECAYBATCHFIT_H
@@ -16,6 +16,7 @@
 #include <cmath> /* std::fmod */
 #include <iostream>
 #include <algorithm> /* std::fill */
+#include <cstdlib> /* calloc */
 
 #include <IMP/bff/DecayRoutines.h>
 
@@ -38,7 +39,9 @@ public:
         FAST_PERIODIC,
         FAST,
         FAST_AVX,
-        FAST_PERIODIC_AVX
+        FAST_PERIODIC_AVX,
+        FFT,
+        FFT_PERIODIC
     } ConvolutionType;
 
     static void compute_corrected_irf(
@@ -133,11 +136,74 @@ private:
     /// Tracks if the computed corrected irf matched the input
     bool corrected_irf_valid = false;
 
+    /// Half-step corrected irf and buffers of the convolution routines
+    DecayConvolutionWorkspace workspace;
+
+    /// Model histogram and convolved histogram of the FFT convolution
+    std::vector<double> fft_buffer;
+
+    /// True for convolution methods with periodic excitation
+    bool is_periodic(int cm) const {
+        return (cm == FAST_PERIODIC_TIME) || (cm == FAST_PERIODIC) ||
+               (cm == FAST_PERIODIC_AVX) || (cm == FFT_PERIODIC);
+    }
+
+    /*!
+     * Convolves a model histogram with the irf by FFTs and adds the
+     * convolved histogram scaled by dt to my. Periodic methods treat the
+     * model as one excitation period.
+     */
+    void add_fft_convolution(
+            double *my, int nm, double *p, int n_model,
+            double *iy, int ni, int start, int stop,
+            double dt, bool periodic
+    ){
+        int n = std::min(nm, ni);
+        stop = (stop < 0) ? n : std::min(stop, n);
+        if(fft_buffer.size() < (size_t) (n_model + n)) fft_buffer.resize(n_model + n);
+        double *c = fft_buffer.data() + n_model;
+        if(periodic){
+            decay_fftconv_per(c, p, iy, n_model, start, stop, n, &workspace);
+        } else{
+            if(n_model < stop) std::fill(p + n_model, p + stop, 0.0);
+            decay_fftconv(c, p, iy, start, stop, &workspace);
+        }
+        for(int i = start; i < stop; i++) my[i] += dt * c[i];
+    }
+
+    /// Convolves the lifetime spectrum as decay histogram by FFTs
+    void convolve_lifetimes_fft(
+            double *my, int nm, const double *lt, int numexp,
+            double *iy, int ni, int start, int stop,
+            double dt, double period, bool periodic
+    ){
+        int n = std::min(nm, ni);
+        int n_model = periodic ? std::max(1, (int) std::ceil(period / dt - 0.5)) : n;
+        // model followed by the convolved histogram (see add_fft_convolution)
+        if(fft_buffer.size() < (size_t) (std::max(n_model, n) + n))
+            fft_buffer.resize(std::max(n_model, n) + n);
+        double *p = fft_buffer.data();
+        std::fill(p, p + n_model, 0.0);
+        for(int ne = 0; ne < numexp; ne++){
+            double a = lt[2 * ne], tau = lt[2 * ne + 1];
+            if((a == 0.0) || (tau <= 0.0)) continue;
+            // sum over the previous excitation periods
+            if(periodic) a /= 1. - std::exp(-period / tau);
+            double e = std::exp(-dt / tau), y = a;
+            for(int i = 0; i < n_model; i++){ p[i] += y; y *= e; }
+            // trapezoidal rule: mean of the decay before and after the pulse
+            if(periodic) p[0] -= 0.5 * lt[2 * ne];
+        }
+        add_fft_convolution(my, nm, p, n_model, iy, ni, start, stop, dt, periodic);
+    }
+
     void convolve_lifetimes(DecayCurve* decay, bool zero_fill = true){
         // Get lifetime spectrum
-        auto lh = lifetime_handler->get_lifetime_spectrum();
-        auto lt = lh.data(); int ln = lh.size();
+        auto &lh = lifetime_handler->get_lifetime_spectrum();
+        convolve_lifetimes(decay, lh.data(), (int) lh.size(), zero_fill);
+    }
 
+    void convolve_lifetimes(DecayCurve* decay, double *lt, int ln, bool zero_fill = true){
         // corrected irf
         auto irfc = &get_corrected_irf();
 
@@ -172,22 +238,25 @@ private:
                         iy, ni,
                         lt, ln,
                         start, stop,
-                        ex_per);
+                        ex_per, &workspace);
             } else if (cm == FAST_TIME) {
                 decay_fconv_cs_time_axis(
                         my, nm,
                         mx, nm,
                         iy, ni,
                         lt, ln,
-                        start, stop);
+                        start, stop, &workspace);
             } else if (cm == FAST_PERIODIC) {
-                decay_fconv_per(my, lt, iy, ln / 2, start, stop, nm, ex_per, dt);
+                decay_fconv_per(my, lt, iy, ln / 2, start, stop, nm, ex_per, dt, &workspace);
             } else if (cm == FAST) {
-                decay_fconv(my, lt, iy, ln / 2, start, stop, dt);
+                decay_fconv(my, lt, iy, ln / 2, start, stop, dt, &workspace);
             } else if (cm == FAST_AVX) {
-                decay_fconv_avx(my, lt, iy, ln / 2, start, stop, dt);
+                decay_fconv_avx(my, lt, iy, ln / 2, start, stop, dt, &workspace);
             } else if (cm == FAST_PERIODIC_AVX) {
-                decay_fconv_per_avx(my, lt, iy, ln / 2, start, stop, nm, ex_per, dt);
+                decay_fconv_per_avx(my, lt, iy, ln / 2, start, stop, nm, ex_per, dt, &workspace);
+            } else if ((cm == FFT) || (cm == FFT_PERIODIC)) {
+                convolve_lifetimes_fft(my, nm, lt, ln / 2, iy, ni, start, stop,
+                                       dt, ex_per, cm == FFT_PERIODIC);
             }
         }
 #if IMPBFF_VERBOSE
@@ -209,6 +278,7 @@ private:
             corrected_irf->set_x(irf->x);
             corrected_irf->set_y(irf->y);
         }
+        corrected_irf_valid = false;
     }
 
     void update_irf(){
@@ -217,6 +287,8 @@ private:
                     get_irf(), corrected_irf,
                     get_irf_shift_channels(),
                     get_irf_background_counts());
+            // the half-step irf follows the corrected irf
+            workspace.invalidate();
         }
         corrected_irf_valid = true;
     }
@@ -273,9 +345,15 @@ public:
      * 3 - fconv
      * 4 - fconv with AVX optimization
      * 5 - fconv_per with AVX optimization
+     * 6 - fftconv of the decay histogram
+     * 7 - fftconv_per of the decay histogram of one excitation period
+     *
+     * The fconv methods use the SIMD kernels selected for the CPU at runtime
+     * (see get_simd_level). The FFT methods scale as O(N log N) and convolve
+     * model histograms of any shape (see convolve_model).
      */
     void set_convolution_method(int v) {
-        convolution_method = std::max(0, std::min(5, v));
+        convolution_method = std::max(0, std::min(7, v));
     }
 
     int get_convolution_method() const {
@@ -290,6 +368,87 @@ public:
         return excitation_period;
     }
 
+    /**
+     * @brief Convolves many lifetime spectra with the corrected IRF.
+     *
+     * The lifetime spectra (e.g. the pixels of a FLIM image or the curves
+     * of a global fit) share the corrected IRF, the convolution range, and
+     * the excitation period. The IRF is prepared once and several decays
+     * are convolved at once (see decay_fconv_batch). Periodic convolution
+     * methods use decay_fconv_per_batch. The channel width is the average
+     * channel width of the IRF. The spectra are used as given (the
+     * settings of the lifetime handler are not applied).
+     *
+     * @param input Lifetime spectra, one spectrum per row (amplitude1,
+     * lifetime1, amplitude2, lifetime2, ...). Spectra with fewer lifetimes
+     * are padded with zero amplitudes.
+     * @param output Convolved decays, one decay per row on the channels of
+     * the IRF.
+     */
+    void convolve_lifetime_spectra(
+            double *input, int n_input1, int n_input2,
+            double** output, int* n_output1, int* n_output2
+    ){
+        auto irfc = &get_corrected_irf();
+        int n = (int) irfc->size();
+        int start = get_start(irfc);
+        int stop = get_stop(irfc);
+        int cm = get_convolution_method();
+        double* o = (double*) calloc((size_t) n_input1 * n, sizeof(double));
+        if((n > 1) && (n_input1 > 0)){
+            // the corrected irf does not keep the time axis of the irf
+            double dt = get_irf()->get_average_dx();
+            double* iy = irfc->get_y().data();
+            if(is_periodic(cm)){
+                decay_fconv_per_batch(
+                        o, input, iy, n_input1, n_input2 / 2,
+                        start, stop, n, get_excitation_period(), dt, &workspace);
+            } else{
+                decay_fconv_batch(
+                        o, input, iy, n_input1, n_input2 / 2,
+                        start, stop, n, dt, &workspace);
+            }
+        }
+        *output = o;
+        *n_output1 = n_input1;
+        *n_output2 = n;
+    }
+
+    /**
+     * @brief Convolves a model histogram with the corrected IRF by FFTs.
+     *
+     * The model is sampled on the channels of the IRF and can have any
+     * shape. The convolution is scaled by the average channel width of the
+     * IRF (as the convolution of lifetime spectra). For periodic convolution
+     * methods the model is one excitation period that is repeated over the
+     * channels of the IRF.
+     *
+     * @param input Model histogram
+     * @param output Convolved model on the channels of the IRF
+     */
+    void convolve_model(
+            double *input, int n_input,
+            double** output, int* n_output
+    ){
+        auto irfc = &get_corrected_irf();
+        int n = (int) irfc->size();
+        int start = get_start(irfc);
+        int stop = get_stop(irfc);
+        double* o = (double*) calloc(n, sizeof(double));
+        bool periodic = is_periodic(get_convolution_method());
+        int n_model = periodic ? n_input : std::min(n_input, n);
+        if((n > 1) && (n_model > 0)){
+            std::vector<double> p(std::max(n_model, n), 0.0);
+            std::copy(input, input + n_model, p.begin());
+            add_fft_convolution(
+                    o, n, p.data(), n_model,
+                    irfc->get_y().data(), n,
+                    start, stop, get_irf()->get_average_dx(), periodic);
+        }
+        *output = o;
+        *n_output = n;
+    }
+
     double get_mean_lifetime(DecayCurve* decay){
         auto irf = get_corrected_irf().y;
         auto data = decay->y;
@@ -347,6 +506,61 @@ public:
         }
     }
 
+    /**
+     * @brief Convolves the lifetime spectrum and computes the derivatives
+     * by the lifetime spectrum.
+     *
+     * The first rows of the jacobian are the derivatives by the lifetime
+     * spectrum of the lifetime handler (amplitude1, lifetime1, amplitude2,
+     * ...). The other rows are set to zero. The fast convolution methods
+     * and the FFT methods use decay_fconv_jacobian and
+     * decay_fconv_per_jacobian (for FFT_PERIODIC this assumes that the
+     * excitation period covers the IRF). The methods on a time axis use
+     * finite differences.
+     *
+     * @param out Convolved decay (resized to the IRF).
+     * @param jacobian Derivatives, one row of n_channels (size of the IRF)
+     * per parameter.
+     */
+    void add_jacobian(DecayCurve* out, double* jacobian, int n_parameters, int n_channels) override{
+        if ((out == nullptr) || !is_active()) return;
+        out->resize(get_data()->size(), 0.0);
+        IMP_USAGE_CHECK(n_channels == (int) out->size(),
+                        "Jacobian does not match the channels of the IRF.");
+        std::vector<double> lt = lifetime_handler->get_lifetime_spectrum();
+        int ln = (int) lt.size();
+        IMP_USAGE_CHECK(n_parameters >= ln,
+                        "Jacobian has fewer rows than the lifetime spectrum.");
+        convolve_lifetimes(out, lt.data(), ln);
+        std::fill(jacobian, jacobian + (size_t) n_parameters * n_channels, 0.0);
+
+        auto irfc = &get_corrected_irf();
+        int start = get_start(irfc);
+        int stop = get_stop(irfc);
+        double dt = out->get_average_dx();
+        double* iy = irfc->get_y().data();
+        int cm = get_convolution_method();
+        if ((cm == FAST) || (cm == FAST_AVX) || (cm == FFT)) {
+            decay_fconv_jacobian(jacobian, lt.data(), iy, ln / 2, start, stop,
+                                 n_channels, dt, &workspace);
+        } else if ((cm == FAST_PERIODIC) || (cm == FAST_PERIODIC_AVX) || (cm == FFT_PERIODIC)) {
+            decay_fconv_per_jacobian(jacobian, lt.data(), iy, ln / 2, start, stop,
+                                     n_channels, get_excitation_period(), dt, &workspace);
+        } else {
+            // finite differences (convolution on a time axis)
+            DecayCurve yp(*out);
+            for (int p = 0; p < ln; p++) {
+                double v = lt[p];
+                double h = 1e-7 * std::max(std::abs(v), 1.0);
+                lt[p] = v + h;
+                convolve_lifetimes(&yp, lt.data(), ln);
+                lt[p] = v;
+                double *j = jacobian + (size_t) p * n_channels;
+                for (int i = 0; i < n_channels; i++) j[i] = (yp.y[i] - out->y[i]) / h;
+            }
+        }
+    }
+
 };
 
 
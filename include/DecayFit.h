@@ -0,0 +1,151 @@
+/**
+ * \file IMP/bff/DecayFit.h
+ * \brief Optimization of the parameters of a decay model
+ *
+ * \authors Thomas-Otavio Peulen
+ * Copyright 2007-2023 IMP Inventors. All rights reserved.
+ *
+ */
+
+#ifndef IMPBFF_DECAYFIT_H
+#define IMPBFF_DECAYFIT_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <vector>
+#include <IMP/bff/DecayModel.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+/**
+ * @brief Fits the parameters of a DecayModel to the data of its score.
+ *
+ * The fit minimizes the score of the model (see DecayScore) by a damped
+ * Gauss-Newton method. The gradient and the approximate Hessian of the
+ * score are computed from the Jacobian of the model (see
+ * DecayModel::update_jacobian) and the derivatives of the score by the
+ * model counts (see statistics::chi2_counting_derivatives). For "sswr" this
+ * is the Levenberg-Marquardt method. For "poisson" the Hessian is the
+ * Fisher information (Fisher scoring) and the damping acts as a trust
+ * region. "neyman", "gauss", and "cnp" use the curvature of the measure.
+ *
+ * The parameters are the lifetime spectrum of the lifetime handler of the
+ * model. Bounded parameters are optimized in an unbounded internal
+ * representation (see Functions::internal2value and
+ * Functions::value2internal). Fixed parameters are not optimized.
+ */
+class IMPBFFEXPORT DecayFit {
+
+private:
+    DecayModel* model_ = nullptr;
+    std::vector<double> lower_bounds_;      //!< Lower bounds of the parameters
+    std::vector<double> upper_bounds_;      //!< Upper bounds of the parameters
+    std::vector<int> fixed_;                //!< Parameters that are not optimized (non-zero)
+    int max_iterations_ = 100;              //!< Maximum number of iterations
+    double tolerance_ = 1e-8;               //!< Relative decrease of the score at convergence
+
+    // results of the last fit
+    std::vector<double> parameters_;
+    double score_ = 0.0;
+    int n_iterations_ = 0;
+    bool converged_ = false;
+
+    // buffers reused between fits
+    std::vector<double> jacobian_;
+    std::vector<double> gradient_;
+    std::vector<double> curvature_;
+
+    bool is_bounded(int i) const;
+
+    /// Map the internal (free) parameters to the parameters of the model
+    void to_parameters(const std::vector<double>& internal, const std::vector<int>& free,
+                       std::vector<double>& parameters) const;
+
+    /// Set the parameters of the model, update the model, and return the score
+    double evaluate(std::vector<double>& parameters);
+
+public:
+
+    /// Set the model that is fitted
+    void set_model(DecayModel* v);
+
+    /// The model that is fitted
+    DecayModel* get_model();
+
+    /**
+     * Set the bounds of the parameters. A parameter is bounded if its
+     * lower bound is smaller than its upper bound. Parameters beyond the
+     * size of the bounds are not bounded.
+     * \param lower Lower bounds.
+     * \param upper Upper bounds.
+     */
+    void set_bounds(std::vector<double> lower, std::vector<double> upper);
+
+    /// Lower bounds of the parameters
+    std::vector<double> get_lower_bounds() const;
+
+    /// Upper bounds of the parameters
+    std::vector<double> get_upper_bounds() const;
+
+    /**
+     * Set the parameters that are not optimized.
+     * \param v Non-zero values fix the parameter.
+     */
+    void set_fixed(std::vector<int> v);
+
+    /// Parameters that are not optimized
+    std::vector<int> get_fixed() const;
+
+    /// Set the maximum number of iterations
+    void set_max_iterations(int v);
+
+    /// Maximum number of iterations
+    int get_max_iterations() const;
+
+    /// Set the relative decrease of the score at which the fit converged
+    void set_tolerance(double v);
+
+    /// Relative decrease of the score at which the fit converged
+    double get_tolerance() const;
+
+    /**
+     * @brief Fit the model starting from the current lifetime spectrum.
+     *
+     * The lifetime spectrum of the model is set to the optimized
+     * parameters and the model decay is updated.
+     *
+     * @return The score of the optimized parameters.
+     */
+    double fit();
+
+    /**
+     * @brief Fit the model starting from the parameters in input.
+     * @param input Initial lifetime spectrum.
+     * @return The score of the optimized parameters.
+     */
+    double fit(double *input, int n_input);
+
+    /// Optimized parameters of the last fit
+    std::vector<double> get_parameters() const;
+
+    /// Score of the last fit
+    double get_score() const;
+
+    /// Number of iterations of the last fit
+    int get_number_of_iterations() const;
+
+    /// True if the last fit converged
+    bool is_converged() const;
+
+    /**
+     * Construct a fit.
+     * \param model The model that is fitted.
+     * \param max_iterations The maximum number of iterations.
+     * \param tolerance The relative decrease of the score at convergence.
+     */
+    DecayFit(DecayModel* model = nullptr, int max_iterations = 100, double tolerance = 1e-8);
+};
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_DECAYFIT_H
@@ -0,0 +1,112 @@
+/**
+ * \file IMP/bff/DecayLifetimeBasis.h
+ * \brief Convolved exponential basis of lifetime distributions
+ *
+ * \authors Thomas-Otavio Peulen
+ * Copyright 2007-2023 IMP Inventors. All rights reserved.
+ *
+ */
+
+#ifndef IMPBFF_DECAYLIFETIMEBASIS_H
+#define IMPBFF_DECAYLIFETIMEBASIS_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <vector>
+#include <IMP/bff/DecayRoutines.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+/**
+ * @brief Convolved exponential basis on a fixed lifetime grid.
+ *
+ * Lifetime distributions (e.g. MEM analyses) use hundreds of lifetimes.
+ * Convolving every lifetime for every new set of amplitudes costs a full
+ * pass over the channels per lifetime. The basis holds the decays of the
+ * lifetime grid (unit amplitude) convolved with the instrument response
+ * function. It is computed once per irf. The model decay of a
+ * distribution of amplitudes is a matrix-vector product with the basis
+ * and the basis is the derivative of the model by the amplitudes.
+ */
+class IMPBFFEXPORT DecayLifetimeBasis {
+
+private:
+    std::vector<double> lifetimes_;     //!< Lifetime grid
+    std::vector<double> basis_;         //!< Convolved decays, one row per lifetime
+    int n_channels_ = 0;                //!< Number of channels of the basis
+    bool valid_ = false;                //!< True if the basis matches the lifetimes
+    DecayConvolutionWorkspace workspace_;
+
+public:
+
+    /**
+     * Set the lifetime grid. The basis needs to be computed again.
+     * \param v The lifetimes.
+     */
+    void set_lifetimes(std::vector<double> v);
+
+    /// Lifetime grid
+    std::vector<double> get_lifetimes() const;
+
+    /// Number of lifetimes of the grid
+    int get_number_of_lifetimes() const;
+
+    /// Number of channels of the basis
+    int get_number_of_channels() const;
+
+    /// True if the basis was computed for the current lifetime grid
+    bool is_valid() const;
+
+    /**
+     * @brief Convolves the decays of the lifetime grid with the irf.
+     *
+     * Uses decay_fconv_batch or, for a positive excitation period,
+     * decay_fconv_per_batch.
+     *
+     * @param irf Instrument response function (n_irf channels).
+     * @param dt Time difference between two micro time channels.
+     * @param period Excitation period (no periodic excitation if <= 0).
+     * @param start Start index of the convolution.
+     * @param stop Stop index of the convolution (n_irf for negative values).
+     */
+    void compute(
+            double *irf, int n_irf,
+            double dt, double period = -1.0,
+            int start = 0, int stop = -1
+    );
+
+    /**
+     * @brief Model decay of a lifetime distribution.
+     *
+     * Computes fit = basis^T amplitudes over blocks of channels, so that a
+     * block of the fit stays in the cache while the basis is streamed.
+     * Lifetimes with zero amplitude are skipped.
+     *
+     * @param amplitudes Amplitudes of the lifetime grid.
+     * @param fit Model decay (number of channels of the basis).
+     */
+    void evaluate(const double *amplitudes, double *fit) const;
+
+    /**
+     * @brief Model decay of a lifetime distribution.
+     * @param input Amplitudes of the lifetime grid.
+     * @param output Model decay on the channels of the basis.
+     */
+    void evaluate(double *input, int n_input, double **output, int *n_output) const;
+
+    /**
+     * @brief Convolved decays of the lifetime grid.
+     * @param output Basis, one row per lifetime of the grid.
+     */
+    void get_basis(double **output, int *n_output1, int *n_output2) const;
+
+    /**
+     * Construct a basis on a lifetime grid.
+     * \param lifetimes The lifetimes of the grid (default: empty).
+     */
+    DecayLifetimeBasis(std::vector<double> lifetimes = std::vector<double>());
+};
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_DECAYLIFETIMEBASIS_H
@@ -58,6 +58,12 @@ public:
      */
     void add(DecayCurve* out) override;
 
+    /**
+     * Apply the linearization table to the input DecayCurve and to its
+     * derivatives (see DecayModifier::add_jacobian).
+     */
+    void add_jacobian(DecayCurve* out, double* jacobian, int n_parameters, int n_channels) override;
+
     /**
      * Construct a DecayLinearization object.
      * \param linearization_table The linearization table
@@ -0,0 +1,132 @@
+/**
+ * \file IMP/bff/DecayModel.h
+ * \brief Model of a fluorescence decay computed by a chain of modifiers
+ *
+ * \authors Thomas-Otavio Peulen
+ * Copyright 2007-2023 IMP Inventors. All rights reserved.
+ *
+ */
+
+#ifndef IMPBFF_DECAYMODEL_H
+#define IMPBFF_DECAYMODEL_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <vector>
+#include <IMP/bff/DecayCurve.h>
+#include <IMP/bff/DecayModifier.h>
+#include <IMP/bff/DecayLifetimeHandler.h>
+#include <IMP/bff/DecayScore.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+/**
+ * @brief Model decay computed by a chain of decay modifiers.
+ *
+ * The model holds the modifiers (e.g. DecayConvolution, DecayPattern,
+ * DecayScale) in the order they are applied to the model decay and
+ * the score of the model decay. The parameters of the model are the
+ * lifetime spectrum of the lifetime handler. A model decay and its score
+ * are computed in a single call (see evaluate), so that pixel-wise or
+ * burst-wise analyses do not pass every modifier through the Python layer.
+ *
+ * The model does not own the modifiers, the score, and the lifetime
+ * handler. They must outlive the model.
+ */
+class IMPBFFEXPORT DecayModel {
+
+private:
+    DecayScore* score_ = nullptr;                   //!< Score of the model decay
+    DecayLifetimeHandler* lifetime_handler_ = nullptr; //!< Parameters of the model
+    std::vector<DecayModifier*> modifiers_;         //!< Modifiers in the order they are applied
+    DecayCurve default_model_;                      //!< Model decay if there is no score
+
+public:
+
+    /// Append a modifier to the chain
+    void add_modifier(DecayModifier* v);
+
+    /// Remove all modifiers from the chain
+    void clear_modifiers();
+
+    /// Number of modifiers in the chain
+    int get_number_of_modifiers() const;
+
+    /// Modifier at position i in the chain
+    DecayModifier* get_modifier(int i);
+
+    /// Set the score of the model decay
+    void set_score(DecayScore* v);
+
+    /// Score of the model decay
+    DecayScore* get_score();
+
+    /// Set the lifetime handler that holds the model parameters
+    void set_lifetime_handler(DecayLifetimeHandler* v);
+
+    /// Lifetime handler that holds the model parameters
+    DecayLifetimeHandler* get_lifetime_handler();
+
+    /**
+     * Model decay. The model decay of the score if a score is set.
+     * \return Pointer to the model decay.
+     */
+    DecayCurve* get_model();
+
+    /**
+     * Number of parameters of the model (size of the lifetime spectrum).
+     * \return The number of parameters.
+     */
+    int get_number_of_parameters();
+
+    /**
+     * Apply the modifiers to the model decay in the order of the chain.
+     */
+    void update();
+
+    /**
+     * Update the model decay and compute its score.
+     * \return The score of the model decay.
+     */
+    double score();
+
+    /**
+     * @brief Set the parameters, update the model decay, and compute its score.
+     * @param input The lifetime spectrum (amplitude, lifetime, ...).
+     * @return The score of the model decay.
+     */
+    double evaluate(double* input, int n_input);
+
+    /**
+     * @brief Update the model decay and its derivatives by the parameters.
+     *
+     * Passes the model decay and the Jacobian through DecayModifier::add_jacobian
+     * of every modifier in the chain.
+     *
+     * @param jacobian Derivatives of the model decay, one row of n_channels
+     * per parameter.
+     * @param n_parameters Number of parameters (rows).
+     * @param n_channels Number of channels of the model decay (columns).
+     */
+    void update_jacobian(double* jacobian, int n_parameters, int n_channels);
+
+    /**
+     * @brief Derivatives of the model decay by the parameters.
+     * @param output The Jacobian, one row per parameter (the lifetime spectrum).
+     */
+    void get_jacobian(double** output, int* n_output1, int* n_output2);
+
+    /**
+     * Construct a model.
+     * \param score The score of the model decay (optional).
+     * \param lifetime_handler The lifetime handler that holds the parameters (optional).
+     */
+    DecayModel(
+            DecayScore* score = nullptr,
+            DecayLifetimeHandler* lifetime_handler = nullptr
+    );
+};
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_DECAYMODEL_H
@@ -82,6 +82,19 @@ public:
      */
     virtual void add(DecayCurve* out) = 0;
 
+    /**
+     * Modify the DecayCurve object and the derivatives of the decay by the
+     * model parameters (chain rule). The default differentiates add
+     * numerically along every row of the jacobian (one call of add per
+     * parameter). Modifiers override this with the analytic derivatives.
+     * \param out The DecayCurve object to be modified.
+     * \param jacobian Derivatives of out by the model parameters. One
+     * row of n_channels (size of out) per parameter.
+     * \param n_parameters The number of parameters (rows).
+     * \param n_channels The number of channels (columns).
+     */
+    virtual void add_jacobian(DecayCurve* out, double* jacobian, int n_parameters, int n_channels);
+
     /**
      * Construct a DecayModifier object.
      * \param data The DecayCurve object to be modified.
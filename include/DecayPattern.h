@@ -74,6 +74,14 @@ public:
      */
     void add(DecayCurve* out) override;
 
+    /**
+     * @brief Add the background pattern and propagate the derivatives.
+     *
+     * The pattern is scaled by the sum of the decay. Thus, the derivatives
+     * are mixed with the pattern scaled by the sum of the derivatives.
+     */
+    void add_jacobian(DecayCurve* out, double* jacobian, int n_parameters, int n_channels) override;
+
     /**
      * @brief Constructor for the DecayPattern class.
      * @param constant_offset The constant offset in the model (default: 0.0).
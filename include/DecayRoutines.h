@@ -16,25 +16,122 @@
 #include <numeric> /* std::accumulate */
 #include <iostream>
 #include <vector>
+#include <complex>
 #include <algorithm> /* std::max */
 #include <string.h> /* strcmp */
 
-#if defined(__AVX__)
- #if defined(_MSC_VER)
-   /* Microsoft C/C++-compatible compiler */
-   #include <intrin.h>
-   #include <immintrin.h>
- #endif
- #if (defined(__GNUC__) || defined(__clang__))
-   #include <immintrin.h>
- #endif
- #if !defined(__FMA__)
-   #define __FMA__ 1
- #endif
-#endif //__AVX__
-
 IMPBFF_BEGIN_NAMESPACE
 
+/// Instruction set levels of the convolution kernels
+typedef enum{
+    SIMD_SCALAR = 0,    /// Portable scalar kernels
+    SIMD_AVX2 = 1,      /// AVX2 and FMA (four lifetimes per register)
+    SIMD_AVX512 = 2     /// AVX-512F (eight lifetimes per register)
+} SIMDLevels;
+
+/**
+ * @brief Highest instruction set level supported by the CPU.
+ *
+ * The convolution kernels (decay_fconv*) are compiled for all levels and
+ * the kernels are selected when the library is loaded (cpuid). Builds
+ * without runtime dispatch (non x86-64) only support SIMD_SCALAR.
+ * Spectra with fewer lifetimes than doubles per register are convolved
+ * with time channels in the register lanes (prefix scan over channels),
+ * larger spectra with lifetimes in the register lanes.
+ *
+ * @return The supported level (see SIMDLevels).
+ */
+IMPBFFEXPORT int get_supported_simd_level();
+
+/// Instruction set level of the used convolution kernels
+IMPBFFEXPORT int get_simd_level();
+
+/**
+ * @brief Select the instruction set level of the convolution kernels.
+ *
+ * Levels above the supported level are clamped. This is meant for
+ * testing and benchmarking. The level is read atomically by every
+ * convolution, so that changing it does not race with convolutions in
+ * other threads (running convolutions finish with their kernels).
+ *
+ * @param level The instruction set level (see SIMDLevels).
+ */
+IMPBFFEXPORT void set_simd_level(int level);
+
+/**
+ * @brief Buffers of the fast convolution routines.
+ *
+ * A workspace keeps the half-step instrument response function
+ * (dt * 0.5 * irf), the irf spectrum of the FFT convolution, and the
+ * scratch buffers of the convolution kernels between calls. The irf is only
+ * processed again if the workspace was invalidated, or if the irf array, dt,
+ * the number of channels, or the FFT length changed.
+ * Buffers only grow. Thus, repeated convolutions (e.g. in an optimizer) do
+ * not allocate memory. Routines called without a workspace use a buffer
+ * per thread and recompute the half-step irf. A workspace must not be
+ * shared between threads.
+ */
+class IMPBFFEXPORT DecayConvolutionWorkspace{
+
+private:
+    std::vector<double> half_step_irf_;
+    std::vector<double> lifetimes_;
+    std::vector<double> buffer_;
+    std::vector<std::complex<double>> irf_spectrum_;
+    std::vector<std::complex<double>> spectrum_;
+    const double *irf_ = nullptr;
+    size_t n_half_step_irf_ = 0;
+    double dt_ = 0.0;
+    bool valid_ = false;
+    size_t n_updates_ = 0;
+    const double *spectrum_irf_ = nullptr;
+    int spectrum_n_ = 0;
+    int spectrum_n_period_ = 0;
+    int spectrum_n_fft_ = 0;
+    bool spectrum_valid_ = false;
+
+public:
+
+    /// Marks the cached irf as outdated (call if the irf values changed)
+    void invalidate(){ valid_ = false; spectrum_valid_ = false; }
+
+    /// True if the half-step irf is up to date
+    bool is_valid() const { return valid_; }
+
+    /// Number of computations of the half-step irf and the irf spectrum
+    size_t get_number_of_updates() const { return n_updates_; }
+
+    /**
+     * @brief Half-step instrument response function.
+     * @param irf instrument response function
+     * @param n number of channels
+     * @param dt time difference between two micro time channels
+     * @return dt * 0.5 * irf for the first n channels
+     */
+    const double* get_half_step_irf(const double *irf, int n, double dt);
+
+    /// Buffer of the (padded) lifetime spectrum with at least n elements
+    double* get_lifetime_buffer(size_t n);
+
+    /// Scratch buffer with at least n elements
+    double* get_buffer(size_t n);
+
+    /**
+     * @brief Half spectrum of the zero padded instrument response function.
+     * @param irf instrument response function
+     * @param n number of channels
+     * @param n_period the irf is wrapped into n_period channels (no wrapping
+     * for n_period < 1)
+     * @param n_fft length of the FFT
+     * @return n_fft / 2 + 1 Fourier coefficients
+     */
+    const std::complex<double>* get_irf_spectrum(const double *irf, int n, int n_period, int n_fft);
+
+    /// Scratch buffer for Fourier coefficients with at least n elements
+    std::complex<double>* get_spectrum_buffer(size_t n);
+
+};
+
 /**
  * \brief Compute the modulo of a number with respect to a positive integer.
  *  
@@ -127,14 +224,20 @@ IMPBFFEXPORT void decay_rescale_w_bg(double *fit, double *decay, double *e_sq, d
  * @param start[in] start micro time index for convolution (not used)
  * @param stop[in] stop micro time index for convolution.
  * @param dt[in] time difference between two micro time channels
+ * @param workspace[in] buffers of the convolution (optional, see DecayConvolutionWorkspace)
  */
-IMPBFFEXPORT void decay_fconv(double *fit, double *x, double *lamp, int numexp, int start, int stop, double dt=0.05);
+IMPBFFEXPORT void decay_fconv(
+        double *fit, double *x, double *lamp, int numexp, int start, int stop, double dt=0.05,
+        DecayConvolutionWorkspace *workspace=nullptr
+);
 
 /**
  * @brief Convolve lifetime spectrum with instrument response (fast convolution, AVX optimized for large lifetime spectra)
  *
- * This function is a modification of fconv for large lifetime spectra. The lifetime spectrum is processed by AVX intrinsics.
- * Four lifetimes are convolved at once. Spectra with lifetimes that are not multiple of four are zero padded.
+ * This function is a modification of fconv for large lifetime spectra. The lifetime spectrum is processed by SIMD
+ * intrinsics (four or eight lifetimes at once, depending on get_simd_level). Spectra with lifetimes that are not
+ * multiple of the register size are zero padded. Contrary to fconv, the model function is set to zero before the
+ * convolution. On CPUs without AVX2 the scalar kernel is used.
  *
  * @param fit[out] model function. The convoluted decay is written to this array
  * @param x[in] lifetime spectrum (amplitude1, lifetime1, amplitude2, lifetime2, ...)
@@ -144,8 +247,12 @@ IMPBFFEXPORT void decay_fconv(double *fit, double *x, double *lamp, int numexp,
  * @param stop[in] stop micro time index for convolution.
  * @param n_points[in] number of points in the lifetime spectrum
  * @param dt[in] time difference between two micro time channels
+ * @param workspace[in] buffers of the convolution (optional, see DecayConvolutionWorkspace)
  */
-IMPBFFEXPORT void decay_fconv_avx(double *fit, double *x, double *lamp, int numexp, int start, int stop, double dt=0.05);
+IMPBFFEXPORT void decay_fconv_avx(
+        double *fit, double *x, double *lamp, int numexp, int start, int stop, double dt=0.05,
+        DecayConvolutionWorkspace *workspace=nullptr
+);
 
 /**
  * @brief Convolve lifetime spectrum with instrument response (fast convolution, high repetition rate)
@@ -163,10 +270,12 @@ IMPBFFEXPORT void decay_fconv_avx(double *fit, double *x, double *lamp, int nume
  * @param n_points number of points in the model function.
  * @param period excitation period in units of the fluorescence lifetimes (typically nanoseconds)
  * @param dt[in] time difference between two micro time channels
+ * @param workspace[in] buffers of the convolution (optional, see DecayConvolutionWorkspace)
  */
 IMPBFFEXPORT void decay_fconv_per(
         double *fit, double *x, double *lamp, int numexp, int start, int stop,
-        int n_points, double period, double dt=0.05
+        int n_points, double period, double dt=0.05,
+        DecayConvolutionWorkspace *workspace=nullptr
 );
 
 /**
@@ -174,7 +283,8 @@ IMPBFFEXPORT void decay_fconv_per(
  *
  * This function computes the convolution of a lifetime spectrum (a set of lifetimes with corresponding amplitudes)
  * with an instrument response function (irf). This function considers periodic excitation and is suited for experiments
- * at high repetition rate. It is an AVX optimized version.
+ * at high repetition rate. It is an AVX optimized version. The model function is set to zero before the convolution.
+ * On CPUs without AVX2 the scalar kernel is used.
  *
  * @param fit[out] model function. The convoluted decay is written to this array
  * @param x[in] lifetime spectrum (amplitude1, lifetime1, amplitude2, lifetime2, ...)
@@ -185,10 +295,108 @@ IMPBFFEXPORT void decay_fconv_per(
  * @param n_points number of points in the model function.
  * @param period excitation period in units of the fluorescence lifetimes (typically nanoseconds)
  * @param dt[in] time difference between two micro time channels
+ * @param workspace[in] buffers of the convolution (optional, see DecayConvolutionWorkspace)
  */
 IMPBFFEXPORT void decay_fconv_per_avx(
         double *fit, double *x, double *lamp, int numexp, int start, int stop,
-        int n_points, double period, double dt=0.05
+        int n_points, double period, double dt=0.05,
+        DecayConvolutionWorkspace *workspace=nullptr
+);
+
+/**
+ * @brief Derivatives of the fast convolution by the lifetime spectrum
+ *
+ * Differentiates the recursion of decay_fconv. The derivatives by the
+ * lifetimes are computed along with the convolution in the same pass
+ * (d exp(-dt/tau) / d tau = exp(-dt/tau) dt / tau^2). The derivatives are
+ * exact for the discretized model.
+ *
+ * @param jacobian[out] Derivatives of the model function. One row of
+ * n_points channels per parameter (d/d amplitude1, d/d lifetime1,
+ * d/d amplitude2, ...). The derivatives are added to the rows.
+ * @param x[in] lifetime spectrum (amplitude1, lifetime1, amplitude2, lifetime2, ...)
+ * @param lamp[in] instrument response function
+ * @param numexp[in] number of fluorescence lifetimes
+ * @param start[in] start micro time index for convolution
+ * @param stop[in] stop micro time index for convolution (n_points for negative values)
+ * @param n_points number of points in the model function
+ * @param dt[in] time difference between two micro time channels
+ * @param workspace[in] buffers of the convolution (optional, see DecayConvolutionWorkspace)
+ */
+IMPBFFEXPORT void decay_fconv_jacobian(
+        double *jacobian, double *x, double *lamp, int numexp,
+        int start, int stop, int n_points, double dt=0.05,
+        DecayConvolutionWorkspace *workspace=nullptr
+);
+
+/**
+ * @brief Derivatives of the periodic fast convolution by the lifetime spectrum
+ *
+ * Same as decay_fconv_jacobian for decay_fconv_per.
+ *
+ * @param jacobian[out] Derivatives of the model function (see decay_fconv_jacobian).
+ * @param x[in] lifetime spectrum (amplitude1, lifetime1, amplitude2, lifetime2, ...)
+ * @param lamp[in] instrument response function
+ * @param numexp[in] number of fluorescence lifetimes
+ * @param start[in] start micro time index for convolution
+ * @param stop[in] stop micro time index for convolution (n_points for negative values)
+ * @param n_points number of points in the model function
+ * @param period excitation period in units of the fluorescence lifetimes (typically nanoseconds)
+ * @param dt[in] time difference between two micro time channels
+ * @param workspace[in] buffers of the convolution (optional, see DecayConvolutionWorkspace)
+ */
+IMPBFFEXPORT void decay_fconv_per_jacobian(
+        double *jacobian, double *x, double *lamp, int numexp,
+        int start, int stop, int n_points, double period, double dt=0.05,
+        DecayConvolutionWorkspace *workspace=nullptr
+);
+
+/**
+ * @brief Convolve many lifetime spectra with one instrument response (fast convolution, batch)
+ *
+ * This function convolves n_decays lifetime spectra with the same instrument response function (irf), e.g., the
+ * pixels of a FLIM image or the curves of a global fit. The irf is prepared once for all decays and the SIMD
+ * kernels process several decays at once (decays in register lanes). Like fconv, the convolved decays are added
+ * to fit. Spectra with fewer lifetimes are padded with zero amplitudes.
+ *
+ * @param fit[out] model functions (n_decays rows of n_points channels). The convoluted decays are added to this array
+ * @param x[in] lifetime spectra (n_decays rows of amplitude1, lifetime1, amplitude2, lifetime2, ...)
+ * @param lamp[in] instrument response function
+ * @param n_decays[in] number of decays (number of lifetime spectra)
+ * @param numexp[in] number of fluorescence lifetimes per spectrum
+ * @param start[in] start micro time index for convolution
+ * @param stop[in] stop micro time index for convolution (negative values: n_points).
+ * @param n_points[in] number of points in a model function.
+ * @param dt[in] time difference between two micro time channels
+ * @param workspace[in] buffers of the convolution (optional, see DecayConvolutionWorkspace)
+ */
+IMPBFFEXPORT void decay_fconv_batch(
+        double *fit, double *x, double *lamp, int n_decays, int numexp,
+        int start, int stop, int n_points, double dt=0.05,
+        DecayConvolutionWorkspace *workspace=nullptr
+);
+
+/**
+ * @brief Convolve many lifetime spectra with one instrument response (fast convolution, high repetition rate, batch)
+ *
+ * Batch version of fconv_per (see decay_fconv_batch). The convolved decays are added to fit.
+ *
+ * @param fit[out] model functions (n_decays rows of n_points channels). The convoluted decays are added to this array
+ * @param x[in] lifetime spectra (n_decays rows of amplitude1, lifetime1, amplitude2, lifetime2, ...)
+ * @param lamp[in] instrument response function
+ * @param n_decays[in] number of decays (number of lifetime spectra)
+ * @param numexp[in] number of fluorescence lifetimes per spectrum
+ * @param start[in] start micro time index for convolution
+ * @param stop[in] stop micro time index for convolution (negative values: n_points).
+ * @param n_points[in] number of points in a model function.
+ * @param period excitation period in units of the fluorescence lifetimes (typically nanoseconds)
+ * @param dt[in] time difference between two micro time channels
+ * @param workspace[in] buffers of the convolution (optional, see DecayConvolutionWorkspace)
+ */
+IMPBFFEXPORT void decay_fconv_per_batch(
+        double *fit, double *x, double *lamp, int n_decays, int numexp,
+        int start, int stop, int n_points, double period, double dt=0.05,
+        DecayConvolutionWorkspace *workspace=nullptr
 );
 
 /**
@@ -246,6 +454,45 @@ IMPBFFEXPORT void decay_fconv_ref(double *fit, double *x, double *lamp, int nume
  */
 IMPBFFEXPORT void decay_sconv(double *fit, double *p, double *lamp, int start, int stop);
 
+/*!
+ * @brief Convolve a model function with the irf using FFTs
+ *
+ * Computes the same convolution as decay_sconv (trapezoidal rule) for
+ * arbitrary model functions in O(N log N). The irf and the model are zero
+ * padded to a FFT length of at least 2 * stop - 1 that factors into 2, 3,
+ * and 5. The FFT plans are cached per length and thread and the spectrum of
+ * the irf is kept in the workspace.
+ *
+ * @param fit convolved model function
+ * @param p model function before convolution (at least stop channels)
+ * @param lamp instrument response function (at least stop channels)
+ * @param start start index of the convolution
+ * @param stop stop index of the convolution
+ * @param workspace buffers and irf spectrum kept between calls (optional)
+ */
+IMPBFFEXPORT void decay_fftconv(double *fit, double *p, double *lamp, int start, int stop,
+                                DecayConvolutionWorkspace *workspace=nullptr);
+
+/*!
+ * @brief Circular convolution of a periodic model function with the irf
+ *
+ * Convolves one period of a model function (e.g. the decay of a periodic
+ * excitation) with the irf wrapped into the period. The convolved period
+ * is repeated up to stop. Uses FFTs (see decay_fftconv).
+ *
+ * @param fit convolved model function
+ * @param p model function of one period (n_period channels)
+ * @param lamp instrument response function (n_points channels)
+ * @param n_period number of channels of the period
+ * @param start start index of the convolution
+ * @param stop stop index of the convolution (n_points for negative values)
+ * @param n_points number of channels of the irf and fit
+ * @param workspace buffers and irf spectrum kept between calls (optional)
+ */
+IMPBFFEXPORT void decay_fftconv_per(double *fit, double *p, double *lamp, int n_period,
+                                    int start, int stop, int n_points,
+                                    DecayConvolutionWorkspace *workspace=nullptr);
+
 /*!
  * @brief shift instrument response function
  *
@@ -339,6 +586,7 @@ IMPBFFEXPORT void discriminate_small_amplitudes(
 * @param convolution_stop[in] convolution stop channel (the index on the time-axis)
 * @param period Period of repetition in units of the lifetime (usually,
 * nano-seconds)
+* @param workspace[in] buffers of the convolution (optional)
 */
 IMPBFFEXPORT void decay_fconv_per_cs_time_axis(
         double *model, int n_model,
@@ -347,7 +595,8 @@ IMPBFFEXPORT void decay_fconv_per_cs_time_axis(
         double *lifetime_spectrum, int n_lifetime_spectrum,
         int convolution_start = 0,
         int convolution_stop = -1,
-        double period = 100.0
+        double period = 100.0,
+        DecayConvolutionWorkspace *workspace = nullptr
 );
 
 /*!
@@ -386,6 +635,7 @@ IMPBFFEXPORT void decay_fconv_per_cs_time_axis(
 * with an absolute value of that is smaller than `amplitude_threshold` are
 * not omitted in the convolution.
 * @param amplitude_threshold[in] Threshold value for the amplitudes
+* @param workspace[in] buffers of the convolution (optional)
 */
 IMPBFFEXPORT void decay_fconv_cs_time_axis(
         double *inplace_output, int n_output,
@@ -393,7 +643,8 @@ IMPBFFEXPORT void decay_fconv_cs_time_axis(
         double *irf, int n_irf,
         double *lifetime_spectrum, int n_lifetime_spectrum,
         int convolution_start = 0,
-        int convolution_stop = -1
+        int convolution_stop = -1,
+        DecayConvolutionWorkspace *workspace = nullptr
 );
 
 
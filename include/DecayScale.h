@@ -100,6 +100,14 @@ public:
      * \param decay The DecayCurve to be added.
      */
     void add(DecayCurve* decay);
+
+    /**
+     * Scale a DecayCurve and propagate the derivatives. The scale depends
+     * on the decay, thus its derivative is added to the scaled derivatives.
+     * \param decay The DecayCurve to be scaled.
+     * \param jacobian Derivatives of the decay (see DecayModifier::add_jacobian).
+     */
+    void add_jacobian(DecayCurve* decay, double* jacobian, int n_parameters, int n_channels) override;
 };
 
 IMPBFF_END_NAMESPACE
@@ -19,6 +19,7 @@
 #include <unordered_set>
 #include <queue>
 #include <vector>
+#include <memory>
 #include <utility>  /* std::pair */
 #include <Eigen/Dense>
 
@@ -53,13 +54,31 @@ private:
     std::vector<bool>  edge_computed;
     std::vector<float> cost;
 
+    // Moments of the accessible density. The moments are accumulated
+    // while the path costs are written back to the tiles and are
+    // relative to the start tile to limit cancellation.
+    long n_accessible_ = 0;
+    double density_m0_ = 0.0;
+    Eigen::Vector3d density_m1_ = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d density_m2_ = Eigen::Matrix3d::Zero();
+    IMP::algebra::Vector3D density_moment_origin_ = {0.0, 0.0, 0.0};
+
+    // Distance of the tiles to the nearest obstacle surface
+    std::vector<float> obstacle_clearance_;
+
 protected:
 
     std::vector<PathMapTile> tiles;
     PathMapHeader pathMapHeader_;
-    std::vector<int> offsets_;
+    std::shared_ptr<const std::vector<int>> offsets_;
     std::vector<PathMapTileEdge>& get_edges(int tile_idx);
 
+    /// Neighbor offsets shared by all path maps with the same grid
+    std::shared_ptr<const std::vector<int>> get_shared_neighbor_idx_offsets();
+
+    /// Reset the moments of the accessible density
+    void reset_density_moments();
+
 public:
 
 
@@ -85,11 +104,15 @@ public:
      * @brief Resizes the PathMap object.
      *
      * This function resizes the PathMap object to accommodate the specified number of voxels.
+     * The buffers (data and tiles) are reused if the number of voxels does not change.
      *
      * @param nvox The number of voxels to resize the PathMap to.
      */
     void resize(unsigned int nvox);
 
+    /// Estimated memory used by the map (data, tiles, and edges) in bytes
+    size_t get_memory_usage() const;
+
     /**
 
     @brief Sets the data for the path map.
@@ -311,6 +334,91 @@ public:
     */
     void find_path_astar(long path_begin_idx, long path_end_idx = -1);
 
+    /**
+     * @brief Number of accessible voxels found in the last path search.
+     */
+    long get_number_of_accessible_voxels() const { return n_accessible_; }
+
+    /**
+     * @brief Sum of the accessible density found in the last path search.
+     *
+     * The moments of the accessible density (PM_TILE_ACCESSIBLE_DENSITY
+     * with path lengths in [0, max_path_length)) are accumulated by
+     * find_path. They are complete only for searches without an end tile.
+     */
+    double get_accessible_density_sum() const { return density_m0_; }
+
+    /**
+     * @brief Reweights the accessible density in a contact volume (CV).
+     *
+     * Accessible tiles that are obstacles in the current map data (e.g.
+     * obstacles sampled with the dye radius plus the CV thickness) are
+     * in the CV. The tile densities are scaled so that the fraction
+     * trapped_fraction of the accessible density is in the CV. The sum
+     * of the accessible density is preserved and the moments are updated.
+     * Needs a path search without end tile before.
+     *
+     * @param trapped_fraction Fraction of the density in the CV [0, 1].
+     * @param obstacle_threshold Tiles with map data larger than the
+     * threshold are in the CV.
+     */
+    void weight_contact_volume(
+            double trapped_fraction,
+            float obstacle_threshold = TILE_OBSTACLE_THRESHOLD
+    );
+
+    /**
+     * @brief Recomputes the moments of the accessible density.
+     *
+     * Needs to be called if the densities of the tiles were modified
+     * after a path search. The origin of the moments is not changed.
+     */
+    void update_density_moments();
+
+    /**
+     * @brief Samples the distance of the tiles to the obstacle surfaces.
+     *
+     * The distance of a tile center to the surface of the nearest obstacle
+     * particle is clipped at max_distance (negative inside of obstacles).
+     * A tile is an obstacle for a sphere of radius r if its clearance is
+     * not larger than r (same as sample_obstacles(r) with a binarized
+     * sphere kernel). Thus, one sampling serves the linker width, multiple
+     * dye radii, and contact volume thicknesses.
+     *
+     * @param max_distance Largest distance of interest. Needs to exceed
+     * the radii of the obstacle masks.
+     */
+    void sample_obstacle_clearance(double max_distance);
+
+    /**
+     * @brief Sets the map data to the obstacles of a sphere.
+     *
+     * The data of tiles with an obstacle clearance (see
+     * sample_obstacle_clearance) not larger than the radius is one, the
+     * data of all other tiles is zero (as sample_obstacles(radius)). The
+     * obstacle clearance is not resampled.
+     *
+     * @param radius Radius of the sphere.
+     */
+    void set_obstacles_from_clearance(double radius);
+
+    /// Distance of the tiles to the obstacle surfaces (see sample_obstacle_clearance)
+    const std::vector<float>& get_obstacle_clearance() const {
+        return obstacle_clearance_;
+    }
+
+    /**
+     * @brief Density weighted mean position of the accessible volume.
+     * @return mean of the accessible density (zero vector if empty).
+     */
+    IMP::algebra::Vector3D get_accessible_density_mean() const;
+
+    /**
+     * @brief Density weighted covariance of the accessible volume.
+     * @return covariance matrix of the accessible density (zero if empty).
+     */
+    Eigen::Matrix3d get_accessible_density_covariance() const;
+
     /**
 
     @brief Get the XYZ density of the path map.
@@ -0,0 +1,121 @@
+/**
+ *  \file IMP/bff/PathMapPool.h
+ *  \brief Pool of path maps recycled between accessible volumes.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+
+#ifndef IMPBFF_PATHMAPPOOL_H
+#define IMPBFF_PATHMAPPOOL_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <IMP/Object.h>
+#include <IMP/Pointer.h>
+
+#include <IMP/bff/PathMap.h>
+#include <IMP/bff/PathMapHeader.h>
+
+#include <list>
+#include <mutex>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+/**
+ * @class PathMapPool
+ * @brief Pool of path maps that recycles grids of identical dimensions.
+ *
+ * Accessible volumes (AVs) acquire their path maps from a pool. Maps
+ * that are released (see AV::release_map) are kept idle and handed to
+ * the next AV that needs a grid of the same dimensions. Thus, the
+ * buffers of the map (data and tiles) are not reallocated. Idle maps
+ * are freed in least recently used order if the memory of the idle maps
+ * exceeds a memory cap. Maps that are still referenced elsewhere (e.g.
+ * by a Python object) are never reused.
+ */
+class IMPBFFEXPORT PathMapPool : public IMP::Object {
+
+private:
+
+    // idle maps and their memory usage at release
+    std::list<std::pair<IMP::Pointer<PathMap>, size_t>> idle_;
+    size_t max_idle_memory_;
+    size_t idle_memory_ = 0;
+    size_t n_allocated_ = 0;
+    size_t n_reused_ = 0;
+    mutable std::mutex mutex_;
+
+    /// Frees idle maps exceeding the memory cap (needs lock)
+    void evict();
+
+public:
+
+    /**
+     * @brief Constructs a path map pool.
+     * @param max_idle_memory Maximum memory of idle maps in bytes.
+     * @param name The name of the pool.
+     */
+    PathMapPool(
+            size_t max_idle_memory = 256 * 1024 * 1024,
+            std::string name = "PathMapPool%1%"
+    );
+
+    /// The pool used by the AVs
+    static PathMapPool* get_default_pool();
+
+    /**
+     * @brief Returns a path map for a header.
+     *
+     * An idle map with the same grid dimensions is reused. Otherwise a
+     * new map is allocated.
+     *
+     * @param header The header of the path map.
+     * @return The path map.
+     */
+    PathMap* acquire(PathMapHeader &header);
+
+    /**
+     * @brief Returns a path map to the pool.
+     *
+     * The reference of the caller is moved to the pool and set to
+     * nullptr under the lock of the pool. Thus, maps can be released
+     * and acquired by multiple threads.
+     *
+     * @param map Reference to the path map (nullptr on return).
+     */
+    void release(IMP::Pointer<PathMap> &map);
+
+    /// Frees all idle maps
+    void clear();
+
+    /// Number of idle maps
+    size_t get_number_of_idle_maps() const;
+
+    /// Estimated memory of the idle maps in bytes
+    size_t get_idle_memory() const;
+
+    /// Maximum memory of the idle maps in bytes
+    size_t get_maximum_idle_memory() const { return max_idle_memory_; }
+
+    /// Set the maximum memory of the idle maps in bytes
+    void set_maximum_idle_memory(size_t v);
+
+    /// Number of maps allocated by the pool
+    size_t get_number_of_allocated_maps() const { return n_allocated_; }
+
+    /// Number of acquired maps that were recycled
+    size_t get_number_of_reused_maps() const { return n_reused_; }
+
+    IMP_OBJECT_METHODS(PathMapPool);
+
+};
+
+IMP_OBJECTS(PathMapPool, PathMapPools);
+
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_PATHMAPPOOL_H
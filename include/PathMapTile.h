@@ -29,6 +29,7 @@ const float TILE_EDGE_COST_DEFAULT  = 100000.0f;
 const float TILE_PENALTY_THRESHOLD  = 100000.0f;
 const float TILE_OBSTACLE_THRESHOLD = 0.000001f;
 const float TILE_OBSTACLE_PENALTY   = 100000.0f;
+const float TILE_DENSITY_DEFAULT    = 1.0f;
 
 
 /// Value types that can be read from a PathMapTile
@@ -88,7 +89,7 @@ private:
     void update_edges_2(
             int nx, int ny, int nz,
             std::vector<PathMapTile>& tiles,
-            std::vector<int> neighbor_idxs,
+            const std::vector<int> &neighbor_idxs,
             float tile_penalty_threshold =TILE_PENALTY_THRESHOLD
     );
 
@@ -133,7 +134,7 @@ public:
     explicit PathMapTile(
             long index=-1,
             float visit_penalty = 0.0,
-            float tile_density = 1.0
+            float tile_density = TILE_DENSITY_DEFAULT
     ) :
             idx(index),
             penalty(visit_penalty),
@@ -0,0 +1,103 @@
+#ifndef IMPBFF_AVINPUTTRACKER_H
+#define IMPBFF_AVINPUTTRACKER_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <vector>
+#include <algorithm>
+
+#include <IMP/Model.h>
+#include <IMP/core/XYZR.h>
+#include <IMP/algebra/Vector3D.h>
+#include <IMP/algebra/VectorD.h>
+
+#include <IMP/bff/AV.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+/// Detects AVs with changed inputs
+/** The coordinates of the obstacle particles and the AV parameters of
+ *  the last call are stored. An AV has changed inputs if its parameters
+ *  changed or if a particle moved within reach of its source (old or new
+ *  position in reach). IMP has no coordinate versions, thus coordinates
+ *  are compared to the stored coordinates (one pass over the particles).
+ *  AVs are identified by their position in the list of AVs. AVs that are
+ *  appended to the list have changed inputs.
+ */
+class AVInputTracker{
+
+private:
+
+    bool valid_ = false;
+    std::vector<IMP::algebra::Vector3D> xyz_;
+    std::vector<IMP::algebra::VectorD<9>> parameter_;
+
+public:
+
+    /// Mark all AVs as changed in the next call of update
+    void reset(){
+        valid_ = false;
+    }
+
+    /// Flags of AVs with changed inputs. Updates the stored inputs.
+    std::vector<bool> update(
+            IMP::Model* m,
+            const IMP::ParticleIndexes &ps,
+            const std::vector<AV*> &avs
+    ){
+        bool init = !valid_ || (xyz_.size() != ps.size());
+        if(init){
+            xyz_.resize(ps.size());
+        }
+        // AVs appended since the last call have changed inputs
+        size_t n_known = init ? 0 : std::min(parameter_.size(), avs.size());
+        parameter_.resize(avs.size());
+
+        // Positions (old and new) of moved particles
+        std::vector<IMP::algebra::Vector3D> moved;
+        std::vector<double> moved_radii;
+        for(size_t i = 0; i < ps.size(); i++){
+            IMP::core::XYZR xyzr(m, ps[i]);
+            IMP::algebra::Vector3D x = xyzr.get_coordinates();
+            if(init || (x - xyz_[i]).get_squared_magnitude() > 0.0){
+                if(!init){
+                    moved.emplace_back(xyz_[i]);
+                    moved.emplace_back(x);
+                    moved_radii.emplace_back(xyzr.get_radius());
+                    moved_radii.emplace_back(xyzr.get_radius());
+                }
+                xyz_[i] = x;
+            }
+        }
+
+        std::vector<bool> changed(avs.size(), true);
+        for(size_t j = 0; j < avs.size(); j++){
+            IMP::algebra::VectorD<9> parameter = avs[j]->get_parameter();
+            if(j < n_known){
+                changed[j] = false;
+                if((parameter_[j] - parameter).get_squared_magnitude() > 0.0){
+                    changed[j] = true;
+                } else{
+                    IMP::algebra::Vector3D source = avs[j]->get_source_coordinates();
+                    double reach = avs[j]->get_obstacle_reach();
+                    for(size_t i = 0; i < moved.size(); i++){
+                        if(IMP::algebra::get_distance(moved[i], source) <= reach + moved_radii[i]){
+                            changed[j] = true;
+                            break;
+                        }
+                    }
+                }
+            }
+            parameter_[j] = parameter;
+        }
+        valid_ = true;
+        return changed;
+    }
+
+};
+
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_AVINPUTTRACKER_H
@@ -0,0 +1,65 @@
+#ifndef IMPBFF_AVSTATE_H
+#define IMPBFF_AVSTATE_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <vector>
+
+#include <IMP/Object.h>
+#include <IMP/Pointer.h>
+#include <IMP/base_types.h>
+#include <IMP/algebra/Vector3D.h>
+#include <IMP/algebra/VectorD.h>
+#include <IMP/algebra/Transformation3D.h>
+
+#include <IMP/bff/PathMap.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+/// State of an AV that is not a particle attribute
+/** The path map, the AV in the frame of a rigid body, and the parameter
+ *  variants are stored in an AVState object on the AV particle. Thus,
+ *  all AV decorators of a particle share the state.
+ */
+class AVState : public IMP::Object {
+public:
+
+    IMP::Pointer<PathMap> av_map;
+
+    /// Incremented whenever the AV is resampled
+    unsigned update_count = 0;
+
+    // Rigid body mode: AV in the internal frame of the rigid body
+    // of the source. Only the transformation is updated on resample.
+    // The stored AV also keeps the density of AVs with released maps
+    // and of AVs taken from a cache (in the local frame of the cache).
+    bool rigid_body_mode = false;
+    bool rigid_body_av_valid = false;
+    bool released_density = false;
+    IMP::ParticleIndex rigid_body_pi;
+    IMP::algebra::Transformation3D rigid_body_transformation;
+    IMP::algebra::VectorD<9> rigid_body_av_parameter;
+    std::vector<IMP::algebra::Vector4D> rigid_body_points;
+    IMP::algebra::Vector3D rigid_body_mean;
+    Eigen::Matrix3d rigid_body_covariance;
+    double rigid_body_density_sum = 0.0;
+
+    // Parameter variants (linker length, dye radius) marginalized in
+    // distance scores. Variants share the path map and the path search.
+    std::vector<double> variant_linker_lengths;
+    std::vector<double> variant_radii;
+    std::vector<double> variant_weights;
+    std::vector<std::vector<IMP::algebra::Vector4D>> variant_points;
+
+    // AVCache consulted on resample. AVCache includes AV.h, thus the
+    // cache is held as an IMP::Object.
+    IMP::Pointer<IMP::Object> cache;
+
+    AVState(std::string name = "AVState%1%") : IMP::Object(name){}
+
+    IMP_OBJECT_METHODS(AVState);
+};
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_AVSTATE_H
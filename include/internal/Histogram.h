@@ -97,7 +97,7 @@ inline int search_bin_idx(T value, T *bin_edges, int n_bins){
  */
 template <typename T>
 inline int calc_bin_idx(T begin, T bin_width, T value){
-    return  ((value - begin) / bin_width);
+    return (int) std::floor((value - begin) / bin_width);
 }
 
 
@@ -364,7 +364,7 @@ void histogram1D(
             }
             bin_idx = calc_bin_idx(lower, bin_width, v);
             // ignore values outside bounds
-            if ((bin_idx <= n_bins) && (bin_idx >= 0)){
+            if ((bin_idx < n_bins) && (bin_idx >= 0)){
                 hist[bin_idx] += (use_weights) ? weights[i] : 1;
             }
         }
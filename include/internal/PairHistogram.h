@@ -0,0 +1,112 @@
+#ifndef IMPBFF_PAIRHISTOGRAM_H
+#define IMPBFF_PAIRHISTOGRAM_H
+
+#include <IMP/bff/bff_config.h>
+
+#include <cmath>
+#include <vector>
+
+#include <IMP/algebra/VectorD.h>
+
+#include <IMP/bff/internal/InverseSampler.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+/// Weighted points (structure of arrays) of an accessible density
+struct WeightedPoints{
+    std::vector<double> x, y, z, w;
+
+    size_t size() const { return w.size(); }
+};
+
+
+/// Weighted points of an accessible density
+/** If the density has more than max_points points, max_points points
+ *  are drawn by inverse transform sampling (unit weights).
+ */
+inline WeightedPoints get_weighted_points(
+        std::vector<IMP::algebra::Vector4D> p,
+        int max_points
+){
+    WeightedPoints r;
+    if(p.empty()) return r;
+    size_t n = ((int) p.size() > max_points) ? max_points : p.size();
+    r.x.reserve(n); r.y.reserve(n); r.z.reserve(n); r.w.reserve(n);
+    if((int) p.size() > max_points){
+        auto el3getter = [](const IMP::algebra::Vector4D &v) { return v[3]; };
+        InverseSampler<std::vector<IMP::algebra::Vector4D>> sampler(p, el3getter);
+        for(size_t i = 0; i < n; i++){
+            auto v = sampler.get_random();
+            r.x.emplace_back(v[0]); r.y.emplace_back(v[1]); r.z.emplace_back(v[2]);
+            r.w.emplace_back(1.0);
+        }
+    } else{
+        for(auto &v : p){
+            r.x.emplace_back(v[0]); r.y.emplace_back(v[1]); r.z.emplace_back(v[2]);
+            r.w.emplace_back(v[3]);
+        }
+    }
+    return r;
+}
+
+
+/// Adds the weighted pair distances of two point sets to a histogram
+/** The histogram has n_bins bins of equal width starting at start. For
+ *  each point of a the distances to all points of b are computed in a
+ *  contiguous loop (vectorized) before binning.
+ */
+inline void add_pair_distance_histogram(
+        const WeightedPoints &a,
+        const WeightedPoints &b,
+        double start,
+        double bin_width,
+        std::vector<double> &hist
+){
+    const int n_bins = (int) hist.size();
+    const size_t nb = b.size();
+    const double inv_width = 1.0 / bin_width;
+    const double *bx = b.x.data(), *by = b.y.data(), *bz = b.z.data();
+    std::vector<double> bin(nb);
+    double *pb = bin.data();
+    for(size_t i = 0; i < a.size(); i++){
+        const double ax = a.x[i], ay = a.y[i], az = a.z[i];
+        for(size_t j = 0; j < nb; j++){
+            double dx = ax - bx[j];
+            double dy = ay - by[j];
+            double dz = az - bz[j];
+            pb[j] = (std::sqrt(dx * dx + dy * dy + dz * dz) - start) * inv_width;
+        }
+        const double wa = a.w[i];
+        for(size_t j = 0; j < nb; j++){
+            if(pb[j] < 0.0) continue;
+            int k = (int) pb[j];
+            if(k < n_bins) hist[k] += wa * b.w[j];
+        }
+    }
+}
+
+
+/// Normalized pair distance histogram on an axis of bin centers
+/** The bin centers need to be equally spaced. */
+inline std::vector<double> get_pair_distance_histogram(
+        const WeightedPoints &a,
+        const WeightedPoints &b,
+        const std::vector<double> &axis
+){
+    std::vector<double> hist(axis.size(), 0.0);
+    if(axis.size() < 2 || a.size() == 0 || b.size() == 0) return hist;
+    double bin_width = axis[1] - axis[0];
+    add_pair_distance_histogram(a, b, axis[0] - 0.5 * bin_width, bin_width, hist);
+    double sum = 0.0;
+    for(auto &v : hist) sum += v;
+    if(sum > 0.0){
+        for(auto &v : hist) v /= sum;
+    }
+    return hist;
+}
+
+
+IMPBFF_END_NAMESPACE
+
+#endif //IMPBFF_PAIRHISTOGRAM_H
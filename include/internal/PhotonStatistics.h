@@ -316,6 +316,35 @@ namespace statistics{
             int x_max = -1,
             const char* type="neyman"
     );
+
+    /**
+     * @brief Derivatives of a chi2 measure by the model counts.
+     *
+     * Computes for every channel in [x_min, x_max) the derivative of the
+     * chi2 measure (see chi2_counting) by the model counts and a
+     * non-negative curvature. The curvature is the second derivative
+     * ("sswr", "neyman", "cnp") or the Fisher information ("poisson"). It is
+     * zero where the measure is not convex. Damped Gauss-Newton fits use
+     * the curvature to approximate the Hessian of the measure.
+     *
+     * @param data The observed data.
+     * @param model The model data.
+     * @param data_noise The noise of the data (used by "sswr").
+     * @param x_min Start of the range.
+     * @param x_max Stop of the range.
+     * @param type The type of chi2 measure.
+     * @param gradient Derivatives by the model counts (size of model).
+     * @param curvature Curvatures by the model counts (size of model).
+     */
+    void chi2_counting_derivatives(
+            std::vector<double> &data,
+            std::vector<double> &model,
+            std::vector<double> &data_noise,
+            int x_min, int x_max,
+            const char* type,
+            double *gradient,
+            double *curvature
+    );
 }
 
 IMPBFF_END_NAMESPACE
@@ -1,8 +1,18 @@
 IMP_SWIG_DECORATOR(IMP::bff, AV, AVs);
+IMP_SWIG_OBJECT(IMP::bff, AVCache, AVCaches);
+IMP_SWIG_OBJECT(IMP::bff, AVUpdater, AVUpdaters);
+IMP_SWIG_OBJECT(IMP::bff, AVRegistry, AVRegistries);
 IMP_SWIG_OBJECT(IMP::bff, AVNetworkRestraint, AVNetworkRestraints);
+IMP_SWIG_OBJECT(IMP::bff, AVNetworkScreener, AVNetworkScreeners);
 
 %template(MapStringAVPairDistanceMeasurement) std::map<std::string, IMP::bff::AVPairDistanceMeasurement>;
 %attribute_py(IMP::bff::AV, IMP::bff::PathMap, map, get_map);
+%ignore IMP::bff::AV::get_parameter;
+%ignore IMP::bff::AV::set_parameter;
+%ignore IMP::bff::AVRegistry::update_avs;
 
 %include "IMP/bff/AV.h"
+%include "IMP/bff/AVUpdater.h"
+%include "IMP/bff/AVRegistry.h"
 %include "IMP/bff/AVNetworkRestraint.h"
+%include "IMP/bff/AVNetworkScreener.h"
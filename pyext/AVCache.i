@@ -0,0 +1,2 @@
+
+%include "IMP/bff/AVCache.h"
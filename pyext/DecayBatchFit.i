@@ -0,0 +1,10 @@
+%attribute(IMP::bff::DecayBatchFit, int, max_iterations, get_max_iterations, set_max_iterations);
+%attribute(IMP::bff::DecayBatchFit, double, tolerance, get_tolerance, set_tolerance);
+%attribute(IMP::bff::DecayBatchFit, double, scatter_fraction, get_scatter_fraction, set_scatter_fraction);
+%attribute(IMP::bff::DecayBatchFit, double, constant_background, get_constant_background, set_constant_background);
+%attribute(IMP::bff::DecayBatchFit, double, min_number_of_photons, get_min_number_of_photons, set_min_number_of_photons);
+%attributestring(IMP::bff::DecayBatchFit, std::string, score_type, get_score_type, set_score_type);
+%attribute_np(IMP::bff::DecayBatchFit, std::vector<double>, lifetime_spectrum, get_lifetime_spectrum, set_lifetime_spectrum);
+%attribute_np(IMP::bff::DecayBatchFit, std::vector<double>, scores, get_scores);
+
+%include "IMP/bff/DecayBatchFit.h"
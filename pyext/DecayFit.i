@@ -0,0 +1,7 @@
+%attribute(IMP::bff::DecayFit, int, max_iterations, get_max_iterations, set_max_iterations);
+%attribute(IMP::bff::DecayFit, double, tolerance, get_tolerance, set_tolerance);
+%attribute(IMP::bff::DecayFit, int, number_of_iterations, get_number_of_iterations);
+%attribute(IMP::bff::DecayFit, bool, converged, is_converged);
+%attribute_np(IMP::bff::DecayFit, std::vector<double>, parameters, get_parameters);
+
+%include "IMP/bff/DecayFit.h"
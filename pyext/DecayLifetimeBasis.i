@@ -0,0 +1,4 @@
+%ignore IMP::bff::DecayLifetimeBasis::evaluate(const double *amplitudes, double *fit) const;
+%attribute(IMP::bff::DecayLifetimeBasis, std::vector<double>, lifetimes, get_lifetimes, set_lifetimes);
+
+%include "IMP/bff/DecayLifetimeBasis.h"
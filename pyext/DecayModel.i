@@ -0,0 +1,6 @@
+%ignore IMP::bff::DecayModel::update_jacobian;
+%attribute(IMP::bff::DecayModel, int, number_of_modifiers, get_number_of_modifiers);
+%attribute(IMP::bff::DecayModel, int, number_of_parameters, get_number_of_parameters);
+%attribute_py(IMP::bff::DecayModel, IMP::bff::DecayCurve, model, get_model);
+
+%include "IMP/bff/DecayModel.h"
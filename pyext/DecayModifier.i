@@ -1,3 +1,5 @@
+%apply (double* INPLACE_ARRAY2, int DIM1, int DIM2) {(double* jacobian, int n_parameters, int n_channels)}
+
 %attribute(IMP::bff::DecayModifier, bool, active, is_active, set_active);
 %attribute_py(IMP::bff::DecayModifier, IMP::bff::DecayCurve*, data, get_data, set_data);
 %class_callable(IMP::bff::DecayModifier, add);
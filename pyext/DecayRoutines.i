@@ -16,6 +16,11 @@
     (double* irf_shift, int n_irf_shift)
 }
 
+%apply
+(double* IN_ARRAY2, int DIM1, int DIM2) {
+    (double* lifetime_spectra, int n_lifetime_spectra1, int n_lifetime_spectra2)
+}
+
 %ignore IMP::bff::decay_rescale;
 %ignore IMP::bff::decay_rescale_w;
 %ignore IMP::bff::decay_rescale_w_bg;
@@ -23,8 +28,14 @@
 %ignore IMP::bff::decay_fconv_avx;
 %ignore IMP::bff::decay_fconv_per;
 %ignore IMP::bff::decay_fconv_per_avx;
+%ignore IMP::bff::decay_fconv_jacobian;
+%ignore IMP::bff::decay_fconv_per_jacobian;
+%ignore IMP::bff::decay_fconv_batch;
+%ignore IMP::bff::decay_fconv_per_batch;
 %ignore IMP::bff::decay_fconv_per_cs;
 %ignore IMP::bff::decay_fconv_ref;
+%ignore IMP::bff::decay_fftconv;
+%ignore IMP::bff::decay_fftconv_per;
 %ignore IMP::bff::decay_sconv;
 %ignore IMP::bff::decay_shift_lamp;
 %inline %{
@@ -121,6 +132,78 @@
         IMP::bff::decay_fconv_per_avx(fit, x, irf, n_x / 2, start, stop, n_fit, period, dt);
     }
 
+    void decay_fconv_jacobian(
+            double** output, int* n_output1, int* n_output2,
+            double* irf, int n_irf,
+            double* x, int n_x,
+            int start = 0, int stop = -1,
+            double dt = 1.0
+    ){
+        stop = IMP::bff::mod_p(stop, n_irf + 1);
+        start = IMP::bff::mod_p(start, n_irf + 1);
+        auto jacobian = (double*) calloc((size_t) n_x * n_irf, sizeof(double));
+        IMP::bff::decay_fconv_jacobian(jacobian, x, irf, n_x / 2, start, stop, n_irf, dt);
+        *output = jacobian;
+        *n_output1 = n_x / 2 * 2;
+        *n_output2 = n_irf;
+    }
+
+    void decay_fconv_per_jacobian(
+            double** output, int* n_output1, int* n_output2,
+            double* irf, int n_irf,
+            double* x, int n_x,
+            double period,
+            int start = 0, int stop = -1,
+            double dt = 1.0
+    ){
+        stop = IMP::bff::mod_p(stop, n_irf + 1);
+        start = IMP::bff::mod_p(start, n_irf + 1);
+        auto jacobian = (double*) calloc((size_t) n_x * n_irf, sizeof(double));
+        IMP::bff::decay_fconv_per_jacobian(jacobian, x, irf, n_x / 2, start, stop, n_irf, period, dt);
+        *output = jacobian;
+        *n_output1 = n_x / 2 * 2;
+        *n_output2 = n_irf;
+    }
+
+    void decay_fconv_batch(
+            double** output, int* n_output1, int* n_output2,
+            double* irf, int n_irf,
+            double* lifetime_spectra, int n_lifetime_spectra1, int n_lifetime_spectra2,
+            int start = 0, int stop = -1,
+            double dt = 1.0
+    ){
+        stop = IMP::bff::mod_p(stop, n_irf + 1);
+        start = IMP::bff::mod_p(start, n_irf + 1);
+        auto fit = (double*) calloc((size_t) n_lifetime_spectra1 * n_irf, sizeof(double));
+        IMP::bff::decay_fconv_batch(
+                fit, lifetime_spectra, irf,
+                n_lifetime_spectra1, n_lifetime_spectra2 / 2,
+                start, stop, n_irf, dt);
+        *output = fit;
+        *n_output1 = n_lifetime_spectra1;
+        *n_output2 = n_irf;
+    }
+
+    void decay_fconv_per_batch(
+            double** output, int* n_output1, int* n_output2,
+            double* irf, int n_irf,
+            double* lifetime_spectra, int n_lifetime_spectra1, int n_lifetime_spectra2,
+            double period,
+            int start = 0, int stop = -1,
+            double dt = 1.0
+    ){
+        stop = IMP::bff::mod_p(stop, n_irf + 1);
+        start = IMP::bff::mod_p(start, n_irf + 1);
+        auto fit = (double*) calloc((size_t) n_lifetime_spectra1 * n_irf, sizeof(double));
+        IMP::bff::decay_fconv_per_batch(
+                fit, lifetime_spectra, irf,
+                n_lifetime_spectra1, n_lifetime_spectra2 / 2,
+                start, stop, n_irf, period, dt);
+        *output = fit;
+        *n_output1 = n_lifetime_spectra1;
+        *n_output2 = n_irf;
+    }
+
     void decay_fconv_per_cs(
             double* fit, int n_fit,
             double* irf, int n_irf,
@@ -159,6 +242,29 @@
         IMP::bff::decay_sconv(fit, model, irf, start, stop);
     }
 
+    void decay_fftconv(
+            double* fit, int n_fit,
+            double* irf, int n_irf,
+            double* model, int n_model,
+            int start = 0, int stop = -1
+    ){
+        stop = IMP::bff::mod_p(stop, n_fit + 1);
+        start = IMP::bff::mod_p(start, n_fit + 1);
+        stop = std::min(stop, std::min(n_irf, n_model));
+        IMP::bff::decay_fftconv(fit, model, irf, start, stop);
+    }
+
+    void decay_fftconv_per(
+            double* fit, int n_fit,
+            double* irf, int n_irf,
+            double* model, int n_model,
+            int start = 0, int stop = -1
+    ){
+        stop = IMP::bff::mod_p(stop, n_fit + 1);
+        start = IMP::bff::mod_p(start, n_fit + 1);
+        IMP::bff::decay_fftconv_per(fit, model, irf, n_model, start, stop, std::min(n_fit, n_irf));
+    }
+
     void decay_shift_lamp(
             double* irf, int n_irf,
             double* irf_shift, int n_irf_shift,
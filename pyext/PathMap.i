@@ -1,5 +1,6 @@
 /* Make selected classes extensible in Python */
 IMP_SWIG_OBJECT(IMP::bff, PathMap, PathMaps);
+IMP_SWIG_OBJECT(IMP::bff, PathMapPool, PathMapPools);
 
 // Use numpy.i for outputs of AV densities
 %ignore IMP::bff::PathMap::get_tile_values(
@@ -8,10 +9,13 @@ IMP_SWIG_OBJECT(IMP::bff, PathMap, PathMaps);
     const std::string &feature_name
 );
 %ignore IMP::bff::PathMap::get_xyz_density();
+// Maps are returned to the pool by AV::release_map
+%ignore IMP::bff::PathMapPool::release;
 
 
 %include "IMP/bff/PathMapHeader.h"
 %include "IMP/bff/PathMap.h"
+%include "IMP/bff/PathMapPool.h"
 %include "IMP/bff/PathMapTile.h"
 %include "IMP/bff/PathMapTileEdge.h"
 
@@ -124,7 +124,8 @@ class AVNetworkRestraintWrapper(IMP.pmi.restraints.RestraintBase):
             mean_position_restraint: bool = False,
             sigma_DA: float = 6.0,
             label: str = "AVNetworkRestraint",
-            occupy_volume: bool = True
+            occupy_volume: bool = True,
+            rigid_body_mode: bool = False
     ):
         """
 
@@ -136,6 +137,9 @@ class AVNetworkRestraintWrapper(IMP.pmi.restraints.RestraintBase):
         :param sigma_DA:
         :param label:
         :param occupy_volume:
+        :param rigid_body_mode: AVs of labeling sites in rigid bodies are
+        computed once in the frame of the rigid body and only transformed
+        if no other atoms are in reach of the labeling site.
         """
         # some parameters
         m = hier.get_model()
@@ -157,6 +161,7 @@ class AVNetworkRestraintWrapper(IMP.pmi.restraints.RestraintBase):
             )
         else:
             raise FileNotFoundError("{}".format(fps_json_fn))
+        self.av_network_restraint.set_rigid_body_mode(rigid_body_mode)
         self.rs = IMP.RestraintSet(m, 'AVNetworkRestraint')
         self.used_avs = dict([(v.get_name(), v) for v in self.av_network_restraint.get_used_avs()])
         if not self.mean_position_restraint:
@@ -244,6 +244,9 @@ class Decay(object):
             self.decay_scale,
             self.decay_background,
         ]
+        self._decay_model = IMP.bff.DecayModel(decay_score, lifetime_handler)
+        for dm in self._decay_modifier:
+            self._decay_model.add_modifier(dm)
 
     def load(self, *args, **kwargs):
         super().load(*args, **kwargs)
@@ -251,14 +254,15 @@ class Decay(object):
         self._irf.x = self._data.x
 
     def update(self):
-        dc = self
-        for dm in self._decay_modifier:
-            dm.add(dc._model)
+        self._decay_model.update()
+
+    def evaluate(self, lifetime_spectrum):
+        lifetime_spectrum = np.asarray(lifetime_spectrum, dtype=np.float64)
+        return self._decay_model.evaluate(lifetime_spectrum)
 
     @property
-    def score(self, *args, **kwargs):
-        self.update()
-        return self.decay_score.get_score(*args, **kwargs)
+    def score(self):
+        return self._decay_model.score()
 
     @property
     def mean_lifetime(self):
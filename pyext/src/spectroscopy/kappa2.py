@@ -5,6 +5,9 @@ import numba as nb
 import numpy as np
 import typing
 
+import IMP.algebra
+import IMP.bff
+
 
 def kappasq_dwt(
         sD2: float,
@@ -135,7 +138,6 @@ def kappasq_all_delta_new(
 
 
 
-@nb.jit(nopython=True)
 def kappasq_all_delta(
         delta: float,
         sD2: float,
@@ -228,36 +230,18 @@ def kappasq_all_delta(
     vol. 133, pp. 2463-2480, J. Am. Chem. Soc., 2011
 
     """
-    # beta angles
-    beta1 = np.arange(0.001, np.pi / 2.0, step * np.pi / 180.0, dtype=np.float64)
-    phi = np.arange(0.001, 2.0 * np.pi, step * np.pi / 180.0, dtype=np.float64)
-    n = beta1.shape[0]
-    m = phi.shape[0]
-    rda_vec = np.array([1, 0, 0], dtype=np.float64)
-
-    # kappa-square values for allowed betas
-    k2 = np.zeros((n, m), dtype=np.float64)
-    k2hist = np.zeros(n_bins - 1, dtype=np.float64)
-
     # histogram bin edges
     k2_step = (k2_max - k2_min) / (n_bins - 1)
     k2scale = np.arange(k2_min, k2_max + 1e-14, k2_step, dtype=np.float64)
-    for i in range(n):
-        d1 = np.array([np.cos(beta1[i]),  0, np.sin(beta1[i])])
-        n1 = np.array([-np.sin(beta1[i]), 0, np.cos(beta1[i])])
-        n2 = np.array([0, 1, 0])
-        for j in range(m):
-            d2 = (n1*np.cos(phi[j])+n2*np.sin(phi[j]))*np.sin(delta)+d1*np.cos(delta)
-            beta2 = np.arccos(np.abs(d2.dot(rda_vec)))
-            k2[i, j] = kappasq(
-                delta=delta,
-                sD2=sD2,
-                sA2=sA2,
-                beta1=beta1[i],
-                beta2=beta2
-            )
-        y, x = np.histogram(k2[i, :], bins=k2scale)
-        k2hist += y*np.sin(beta1[i])
+    k2hist = np.array(
+        IMP.bff.kappasq_all_delta(
+            delta=delta, sD2=sD2, sA2=sA2, step=step,
+            n_bins=n_bins, k2_min=k2_min, k2_max=k2_max
+        ), dtype=np.float64
+    )
+    k2 = IMP.bff.kappasq_all_delta_values(
+        delta=delta, sD2=sD2, sA2=sA2, step=step
+    )
     return k2scale, k2hist, k2
 
 
@@ -363,7 +347,6 @@ def kappasq_all(
     return k2scale, k2hist, k2
 
 
-@nb.jit(nopython=True)
 def kappa_distance(
         d1: np.array,
         d2: np.array,
@@ -440,78 +423,10 @@ def kappa_distance(
     (0.8660254037844386, 1.0000000000000002)
 
     """
-    # coordinates of the dipole
-    d11 = d1[0]
-    d12 = d1[1]
-    d13 = d1[2]
-
-    d21 = d2[0]
-    d22 = d2[1]
-    d23 = d2[2]
-
-    # distance between the two end points of the donor
-    dD21 = np.sqrt(
-        (d11 - d21) * (d11 - d21) +
-        (d12 - d22) * (d12 - d22) +
-        (d13 - d23) * (d13 - d23)
-    )
-
-    # normal vector of the donor-dipole
-    muD1 = (d21 - d11) / dD21
-    muD2 = (d22 - d12) / dD21
-    muD3 = (d23 - d13) / dD21
-
-    # vector to the middle of the donor-dipole
-    dM1 = d11 + dD21 * muD1 / 2.0
-    dM2 = d12 + dD21 * muD2 / 2.0
-    dM3 = d13 + dD21 * muD3 / 2.0
-
-    ### Acceptor ###
-    # cartesian coordinates of the acceptor
-    a11 = a1[0]
-    a12 = a1[1]
-    a13 = a1[2]
-
-    a21 = a2[0]
-    a22 = a2[1]
-    a23 = a2[2]
-
-    # distance between the two end points of the acceptor
-    dA21 = np.sqrt(
-        (a11 - a21) * (a11 - a21) +
-        (a12 - a22) * (a12 - a22) +
-        (a13 - a23) * (a13 - a23)
+    dRDA, kappa = IMP.bff.kappa_distance(
+        IMP.algebra.Vector3D(*d1), IMP.algebra.Vector3D(*d2),
+        IMP.algebra.Vector3D(*a1), IMP.algebra.Vector3D(*a2)
     )
-
-    # normal vector of the acceptor-dipole
-    muA1 = (a21 - a11) / dA21
-    muA2 = (a22 - a12) / dA21
-    muA3 = (a23 - a13) / dA21
-
-    # vector to the middle of the acceptor-dipole
-    aM1 = a11 + dA21 * muA1 / 2.0
-    aM2 = a12 + dA21 * muA2 / 2.0
-    aM3 = a13 + dA21 * muA3 / 2.0
-
-    # vector connecting the middle of the dipoles
-    RDA1 = dM1 - aM1
-    RDA2 = dM2 - aM2
-    RDA3 = dM3 - aM3
-
-    # Length of the dipole-dipole vector (distance)
-    dRDA = np.sqrt(RDA1 * RDA1 + RDA2 * RDA2 + RDA3 * RDA3)
-
-    # Normalized dipole-diple vector
-    nRDA1 = RDA1 / dRDA
-    nRDA2 = RDA2 / dRDA
-    nRDA3 = RDA3 / dRDA
-
-    # Orientation factor kappa2
-    kappa = muA1 * muD1 + \
-            muA2 * muD2 + \
-            muA3 * muD3 - \
-            3.0 * (muD1 * nRDA1 + muD2 * nRDA2 + muD3 * nRDA3) * \
-            (muA1 * nRDA1 + muA2 * nRDA2 + muA3 * nRDA3)
     return dRDA, kappa
 
 
@@ -628,20 +543,12 @@ def calculate_kappa_distance(
     :return: distances, kappa2
     """
     n_frames = xyz.shape[0]
-    ks = np.empty(n_frames, dtype=np.float32)
-    ds = np.empty(n_frames, dtype=np.float32)
-
-    for i_frame in range(n_frames):
-        try:
-            d, k = kappa_distance(
-                xyz[i_frame, aid1], xyz[i_frame, aid2],
-                xyz[i_frame, aia1], xyz[i_frame, aia2]
-            )
-            ks[i_frame] = k
-            ds[i_frame] = d
-        except:
-            print("Frame ", i_frame, "skipped, calculation error")
-
+    frames = np.ascontiguousarray(xyz, dtype=np.float64).reshape((n_frames, -1))
+    r = IMP.bff.kappa_distances(
+        frames, aid1=aid1, aid2=aid2, aia1=aia1, aia2=aia2
+    )
+    ds = r[:, 0].astype(np.float32)
+    ks = r[:, 1].astype(np.float32)
     return ds, ks
 
 
@@ -194,3 +194,40 @@ def read_xlink_table(fn: str) -> typing.Dict[int, typing.Dict]:
                 pass
     return xlinks
 
+
+
+def screen_rmf(
+        screener: IMP.bff.AVNetworkScreener,
+        rmf_fn: str,
+        chunk_size: int = 256
+) -> np.ndarray:
+    """Score the frames of a RMF file with an AV network screener
+
+    The leaves of the hierarchy in the RMF file must match the leaves
+    of the topology of the screener (same atoms in the same order).
+
+    :param screener: the AV network screener
+    :param rmf_fn: filename of the RMF file
+    :param chunk_size: number of frames passed to the screener at once
+    :return: the scores of the frames
+    """
+    import RMF
+    import IMP.rmf
+    m = IMP.Model()
+    fh = RMF.open_rmf_file_read_only(rmf_fn)
+    hier = IMP.rmf.create_hierarchies(fh, m)[0]
+    leaves = [IMP.core.XYZ(h) for h in IMP.atom.get_leaves(hier)]
+    n_coordinates = screener.get_number_of_coordinates()
+    if 3 * len(leaves) != n_coordinates:
+        raise ValueError("RMF hierarchy does not match the screener topology")
+    scores = list()
+    frames = list()
+    for frame in range(fh.get_number_of_frames()):
+        IMP.rmf.load_frame(fh, RMF.FrameID(frame))
+        frames.append(np.array([x.get_coordinates() for x in leaves]).flatten())
+        if len(frames) == chunk_size:
+            scores += screener.score_frames(np.array(frames))
+            frames = list()
+    if len(frames) > 0:
+        scores += screener.score_frames(np.array(frames))
+    return np.array(scores)
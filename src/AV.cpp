@@ -7,6 +7,10 @@
  *
  */
 #include <IMP/bff/AV.h>
+#include <IMP/bff/AVCache.h>
+#include <IMP/bff/internal/PairHistogram.h>
+#include <IMP/algebra/constants.h>
+
 
 IMPBFF_BEGIN_NAMESPACE
 
@@ -26,10 +30,51 @@ std::string AVPairDistanceMeasurement::get_json(){
     j["error_pos"] = error_pos;
     j["Forster_radius"] = forster_radius;
     j["distance_type"] = distance_type;
+    if(!distribution.empty()){
+        j["distribution_axis"] = distribution_axis;
+        j["distribution"] = distribution;
+        j["distribution_weight"] = distribution_weight;
+        if(!distribution_error.empty()){
+            j["distribution_error"] = distribution_error;
+        }
+    }
     return j.dump();
 }
 
 
+double AVPairDistanceMeasurement::score_distribution(const std::vector<double> &model){
+    size_t n = distribution.size();
+    IMP_USAGE_CHECK(model.size() == n, "Model and experimental distribution differ in size.");
+    double sum_e = 0.0, sum_m = 0.0;
+    for(size_t i = 0; i < n; i++){
+        sum_e += distribution[i];
+        sum_m += model[i];
+    }
+    if(sum_m <= 0.0 || sum_e <= 0.0){
+        return std::numeric_limits<double>::infinity();
+    }
+    double score = 0.0;
+    if(distribution_error.size() == n){
+        for(size_t i = 0; i < n; i++){
+            double e = distribution_error[i];
+            if(e <= 0.0) continue;
+            double dev = (model[i] / sum_m - distribution[i] / sum_e) / e;
+            score += dev * dev;
+        }
+        return distribution_weight * 0.5 * score;
+    }
+    // Kullback-Leibler divergence; empty model bins are regularized
+    const double eps = 1e-12;
+    for(size_t i = 0; i < n; i++){
+        double pe = distribution[i] / sum_e;
+        if(pe <= 0.0) continue;
+        double pm = std::max(model[i] / sum_m, eps);
+        score += pe * std::log(pe / pm);
+    }
+    return distribution_weight * score;
+}
+
+
 double AVPairDistanceMeasurement::score_model(double model){
     auto ev = [](double f, double m, double en, double ep){
         double dev = m - f;
@@ -43,73 +88,344 @@ double AVPairDistanceMeasurement::score_model(double model){
 }
 
 
-double av_distance(
-        const IMP::bff::AV& av1,
-        const IMP::bff::AV& av2,
+double AVPairDistanceMeasurement::score_model_derivative(double model){
+    if(std::isnan(model)){
+        return 0.0;
+    }
+    // same sign convention and errors as score_model
+    double dev = distance - model;
+    double w = (dev < 0) ? 1. / error_neg : 1. / error_pos;
+    return -0.5 * dev * w * w;
+}
+
+
+/// Distance between two accessible densities by inverse transform sampling
+static double get_sampled_distance(
+        const std::vector<IMP::algebra::Vector4D> &p1,
+        const std::vector<IMP::algebra::Vector4D> &p2,
         double forster_radius,
         int distance_type,
         int n_samples
 ){
+    if(p1.empty() || p2.empty()){
+        return std::numeric_limits<double>::quiet_NaN();
+    }
     // Draw points using Inverse transform sampling
     auto el3getter = [](const IMP::algebra::Vector4D &p) { return p[3]; };
     using points_type = std::vector<IMP::algebra::Vector4D>;
-    auto m1 = av1.get_map();
-    auto m2 = av2.get_map();
-    auto p1 = m1->get_xyz_density();
-    auto p2 = m2->get_xyz_density();
-    if(!p1.empty() && !p2.empty()){
-        InverseSampler<points_type> sampler1(p1, el3getter);
-        InverseSampler<points_type> sampler2(p2, el3getter);
-        double val = 0.;
-        switch(distance_type){
-            case DYE_PAIR_EFFICIENCY: {
-                for (int s = 0; s < n_samples; s++) {
-                    auto tmp = sampler1.get_random() - sampler2.get_random();
-                    tmp[3] = 0.0;
-                    val += fret_efficiency<double>(tmp.get_magnitude(), forster_radius);
-                }
-                return val / n_samples;
+    InverseSampler<points_type> sampler1(p1, el3getter);
+    InverseSampler<points_type> sampler2(p2, el3getter);
+    double val = 0.;
+    switch(distance_type){
+        case DYE_PAIR_EFFICIENCY: {
+            for (int s = 0; s < n_samples; s++) {
+                auto tmp = sampler1.get_random() - sampler2.get_random();
+                tmp[3] = 0.0;
+                val += fret_efficiency<double>(tmp.get_magnitude(), forster_radius);
             }
-            case DYE_PAIR_DISTANCE_E: {
-                double fret_eff = av_distance(av1, av2, forster_radius, DYE_PAIR_EFFICIENCY, n_samples);
-                return distance_fret<double>(fret_eff, forster_radius);
+            return val / n_samples;
+        }
+        case DYE_PAIR_DISTANCE_E: {
+            double fret_eff = get_sampled_distance(
+                    p1, p2, forster_radius, DYE_PAIR_EFFICIENCY, n_samples);
+            return distance_fret<double>(fret_eff, forster_radius);
+        }
+        case DYE_PAIR_DISTANCE_MEAN:
+        default: {
+            for (int s = 0; s < n_samples; s++) {
+                auto tmp = sampler1.get_random() - sampler2.get_random();
+                tmp[3] = 0.0;
+                val += tmp.get_magnitude();
             }
-            case DYE_PAIR_DISTANCE_MP: {
-                IMP::algebra::Vector3D mp1 = av1.get_mean_position();
-                IMP::algebra::Vector3D mp2 = av2.get_mean_position();
-                return get_l2_norm((mp1 - mp2));
+            return val / n_samples;
+        }
+    }
+}
+
+
+double av_distance(
+        const IMP::bff::AV& av1,
+        const IMP::bff::AV& av2,
+        double forster_radius,
+        int distance_type,
+        int n_samples
+){
+    // Distances that do not need samples
+    switch(distance_type){
+        case DYE_PAIR_DISTANCE_MP: {
+            IMP::algebra::Vector3D mp1 = av1.get_mean_position();
+            IMP::algebra::Vector3D mp2 = av2.get_mean_position();
+            return get_l2_norm((mp1 - mp2));
+        }
+        case DYE_PAIR_XYZ_DISTANCE: {
+            IMP::Particle* p1 = av1.get_particle();
+            IMP::Particle* p2 = av2.get_particle();
+            IMP::algebra::Vector3D mp1 = IMP::core::XYZ(p1).get_coordinates();
+            IMP::algebra::Vector3D mp2 = IMP::core::XYZ(p2).get_coordinates();
+            return get_l2_norm((mp1 - mp2));
+        }
+        default:
+            break;
+    }
+    return get_sampled_distance(
+            av1.get_xyz_density(), av2.get_xyz_density(),
+            forster_radius, distance_type, n_samples);
+}
+
+/// True if the distance type depends on the accessible densities
+static bool get_is_sampled_distance(int distance_type){
+    return (distance_type != DYE_PAIR_DISTANCE_MP) &&
+           (distance_type != DYE_PAIR_XYZ_DISTANCE);
+}
+
+std::vector<double> av_variant_distances(
+        const AV& av1,
+        const AV& av2,
+        double forster_radius,
+        int distance_type,
+        int n_samples
+){
+    int n1 = av1.get_number_of_parameter_variants();
+    int n2 = av2.get_number_of_parameter_variants();
+    if(!get_is_sampled_distance(distance_type) || (n1 + n2 == 0)){
+        return {av_distance(av1, av2, forster_radius, distance_type, n_samples)};
+    }
+    std::vector<std::vector<IMP::algebra::Vector4D>> p1, p2;
+    if(n1 > 0){
+        for(int i = 0; i < n1; i++) p1.emplace_back(av1.get_xyz_density(i));
+    } else{
+        p1.emplace_back(av1.get_xyz_density());
+    }
+    if(n2 > 0){
+        for(int j = 0; j < n2; j++) p2.emplace_back(av2.get_xyz_density(j));
+    } else{
+        p2.emplace_back(av2.get_xyz_density());
+    }
+    std::vector<double> d;
+    d.reserve(p1.size() * p2.size());
+    for(auto &a : p1){
+        for(auto &b : p2){
+            d.emplace_back(get_sampled_distance(a, b, forster_radius, distance_type, n_samples));
+        }
+    }
+    return d;
+}
+
+std::vector<double> av_variant_weights(
+        const AV& av1,
+        const AV& av2,
+        int distance_type
+){
+    int n1 = av1.get_number_of_parameter_variants();
+    int n2 = av2.get_number_of_parameter_variants();
+    if(!get_is_sampled_distance(distance_type) || (n1 + n2 == 0)){
+        return {1.0};
+    }
+    std::vector<double> w;
+    for(int i = 0; i < std::max(n1, 1); i++){
+        double w1 = (n1 > 0) ? av1.get_parameter_variant_weight(i) : 1.0;
+        for(int j = 0; j < std::max(n2, 1); j++){
+            double w2 = (n2 > 0) ? av2.get_parameter_variant_weight(j) : 1.0;
+            w.emplace_back(w1 * w2);
+        }
+    }
+    return w;
+}
+
+/// Nodes and weights of a Gauss-Hermite quadrature for a standard normal
+/// distribution (Golub-Welsch). The weights sum to one.
+static void get_gauss_hermite_quadrature(
+        int n,
+        std::vector<double> &nodes,
+        std::vector<double> &weights
+){
+    Eigen::MatrixXd J = Eigen::MatrixXd::Zero(n, n);
+    for(int k = 1; k < n; k++){
+        J(k, k - 1) = J(k - 1, k) = std::sqrt((double) k);
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(J);
+    nodes.resize(n); weights.resize(n);
+    for(int i = 0; i < n; i++){
+        nodes[i] = es.eigenvalues()[i];
+        weights[i] = algebra::get_squared(es.eigenvectors()(0, i));
+    }
+}
+
+
+/// Expectation of the distance (or the FRET efficiency) and its gradient
+/// with respect to the mean of the first AV for Gaussian AVs
+static double get_gaussian_expectation(
+        const IMP::bff::AV& av1,
+        const IMP::bff::AV& av2,
+        double forster_radius,
+        bool efficiency,
+        int n_quadrature,
+        IMP::algebra::Vector3D *gradient = nullptr
+){
+    if(gradient != nullptr) *gradient = IMP::algebra::Vector3D(0.0, 0.0, 0.0);
+    if((av1.get_density_sum() <= 0.0) || (av2.get_density_sum() <= 0.0)){
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    IMP_USAGE_CHECK(n_quadrature > 0, "Number of quadrature nodes must be positive.");
+
+    // difference vector is normal with mean mu and covariance cov
+    IMP::algebra::Vector3D dm = av1.get_density_mean() - av2.get_density_mean();
+    Eigen::Vector3d mu(dm[0], dm[1], dm[2]);
+    Eigen::Matrix3d cov = av1.get_covariance() + av2.get_covariance();
+
+    // principal axes scaled by standard deviations
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es(cov);
+    Eigen::Matrix3d a = es.eigenvectors();
+    for(int i = 0; i < 3; i++){
+        a.col(i) *= std::sqrt(std::max(0.0, es.eigenvalues()[i]));
+    }
+
+    std::vector<double> z, w;
+    get_gauss_hermite_quadrature(n_quadrature, z, w);
+    double val = 0.0;
+    Eigen::Vector3d grad = Eigen::Vector3d::Zero();
+    for(int i = 0; i < n_quadrature; i++){
+        for(int j = 0; j < n_quadrature; j++){
+            for(int k = 0; k < n_quadrature; k++){
+                Eigen::Vector3d d = mu + a * Eigen::Vector3d(z[i], z[j], z[k]);
+                double r = d.norm();
+                double wijk = w[i] * w[j] * w[k];
+                double f, df;
+                if(efficiency){
+                    f = fret_efficiency<double>(r, forster_radius);
+                    df = -6.0 * std::pow(r / forster_radius, 5.0) / forster_radius * f * f;
+                } else{
+                    f = r;
+                    df = 1.0;
+                }
+                val += wijk * f;
+                if(r > 0.0) grad += wijk * df / r * d;
             }
-            case DYE_PAIR_XYZ_DISTANCE: {
-                IMP::Particle* p1 = av1.get_particle();
-                IMP::Particle* p2 = av2.get_particle();
-                IMP::algebra::Vector3D mp1 = IMP::core::XYZ(p1).get_coordinates();
-                IMP::algebra::Vector3D mp2 = IMP::core::XYZ(p2).get_coordinates();
-                return get_l2_norm((mp1 - mp2));
+        }
+    }
+    if(gradient != nullptr) *gradient = IMP::algebra::Vector3D(grad[0], grad[1], grad[2]);
+    return val;
+}
+
+
+double av_gaussian_distance(
+        const IMP::bff::AV& av1,
+        const IMP::bff::AV& av2,
+        double forster_radius,
+        int distance_type,
+        int n_quadrature
+){
+    switch(distance_type){
+        case DYE_PAIR_DISTANCE_MP:
+        case DYE_PAIR_XYZ_DISTANCE:
+            return av_distance(av1, av2, forster_radius, distance_type);
+        case DYE_PAIR_DISTANCE_E: {
+            double fret_eff = get_gaussian_expectation(
+                    av1, av2, forster_radius, true, n_quadrature);
+            return distance_fret<double>(fret_eff, forster_radius);
+        }
+        case DYE_PAIR_EFFICIENCY:
+            return get_gaussian_expectation(
+                    av1, av2, forster_radius, true, n_quadrature);
+        default:
+            return get_gaussian_expectation(
+                    av1, av2, forster_radius, false, n_quadrature);
+    }
+}
+
+
+IMP::algebra::Vector3D av_distance_gradient(
+        const IMP::bff::AV& av1,
+        const IMP::bff::AV& av2,
+        double forster_radius,
+        int distance_type,
+        int n_quadrature
+){
+    IMP::algebra::Vector3D g(0.0, 0.0, 0.0);
+    switch(distance_type){
+        case DYE_PAIR_DISTANCE_MP:
+        case DYE_PAIR_XYZ_DISTANCE: {
+            IMP::algebra::Vector3D d;
+            if(distance_type == DYE_PAIR_DISTANCE_MP){
+                d = av1.get_mean_position() - av2.get_mean_position();
+            } else{
+                d = IMP::core::XYZ(av1.get_particle()).get_coordinates() -
+                    IMP::core::XYZ(av2.get_particle()).get_coordinates();
             }
-            case DYE_PAIR_DISTANCE_MEAN:
-            default: {
-                for (int s = 0; s < n_samples; s++) {
-                    auto tmp = sampler1.get_random() - sampler2.get_random();
-                    tmp[3] = 0.0;
-                    val += tmp.get_magnitude();
-                }
-                return val / n_samples;
+            double r = d.get_magnitude();
+            if(r > 0.0) g = d / r;
+            return g;
+        }
+        case DYE_PAIR_DISTANCE_E: {
+            double e = get_gaussian_expectation(
+                    av1, av2, forster_radius, true, n_quadrature, &g);
+            if(std::isnan(e) || (e <= 0.0) || (e >= 1.0)){
+                return IMP::algebra::Vector3D(0.0, 0.0, 0.0);
             }
+            // R_E = R0 (1/E - 1)^(1/6)
+            double drde = -forster_radius / 6.0 *
+                    std::pow(1.0 / e - 1.0, -5.0 / 6.0) / (e * e);
+            return g * drde;
         }
-    } else {
-        return std::numeric_limits<double>::quiet_NaN();
+        case DYE_PAIR_EFFICIENCY:
+            get_gaussian_expectation(av1, av2, forster_radius, true, n_quadrature, &g);
+            return g;
+        default:
+            get_gaussian_expectation(av1, av2, forster_radius, false, n_quadrature, &g);
+            return g;
     }
 }
 
+
+std::vector<double> av_gaussian_distance_error(
+        const IMP::bff::AV& av1,
+        const IMP::bff::AV& av2,
+        double forster_radius,
+        int distance_type,
+        int n_samples,
+        int n_quadrature
+){
+    double approx = av_gaussian_distance(
+            av1, av2, forster_radius, distance_type, n_quadrature);
+    double exact = av_distance(
+            av1, av2, forster_radius, distance_type, n_samples);
+    double rel_error = (approx - exact) / exact;
+#if IMPBFF_VERBOSE
+    std::clog << "av_gaussian_distance_error" << std::endl;
+    std::clog << "-- distance_type: " << distance_type << std::endl;
+    std::clog << "-- approximation: " << approx << std::endl;
+    std::clog << "-- exact: " << exact << std::endl;
+    std::clog << "-- relative error: " << rel_error << std::endl;
+#endif
+    return {approx, exact, rel_error};
+}
+
+
+IMP::ObjectKey AV::get_state_key(){
+    static const IMP::ObjectKey key("bff AV state");
+    return key;
+}
+
+AVState* AV::get_state() const{
+    IMP::Model* m = get_model();
+    IMP::ParticleIndex pi = get_particle_index();
+    // AVs that were not set up by do_setup_particle (e.g. read from a file)
+    if(!m->get_has_attribute(get_state_key(), pi)){
+        m->add_attribute(get_state_key(), pi, new AVState());
+    }
+    return static_cast<AVState*>(m->get_attribute(get_state_key(), pi));
+}
+
 IMP::bff::PathMap* AV::get_map() const{
+    AVState* state = get_state();
     // get_map needs to be const
-    if(av_map_ == nullptr){
+    if(!state->av_map){
         // cast away const to init map ¯\_(ツ)_/¯
         AV* ptr = (AV*)(this);
         ptr->init_path_map();
         ptr->resample();
     }
-    return av_map_;
+    return state->av_map;
 }
 
 IMP::algebra::Vector3D AV::get_mean_position(bool include_source) const{
@@ -119,17 +435,162 @@ IMP::algebra::Vector3D AV::get_mean_position(bool include_source) const{
         r += get_source_coordinates();
         sum += 1.0;
     }
-    auto xyzd = get_map()->get_xyz_density();
-    for(auto &a: xyzd){
-        if(a[3] <= 0.0f) continue;
-        sum += a[3];
-        r[0] += a[0] * a[3];
-        r[1] += a[1] * a[3];
-        r[2] += a[2] * a[3];
-    }
+    // moments of the accessible density are computed in the path search
+    double w = get_density_sum();
+    r += get_density_mean() * w;
+    sum += w;
     return r /= sum;
 }
 
+double AV::get_density_sum() const{
+    AVState* state = get_state();
+    if(state->rigid_body_av_valid){
+        return state->rigid_body_density_sum;
+    }
+    return get_map()->get_accessible_density_sum();
+}
+
+IMP::algebra::Vector3D AV::get_density_mean() const{
+    AVState* state = get_state();
+    if(state->rigid_body_av_valid){
+        return state->rigid_body_transformation.get_transformed(state->rigid_body_mean);
+    }
+    return get_map()->get_accessible_density_mean();
+}
+
+Eigen::Matrix3d AV::get_covariance() const{
+    AVState* state = get_state();
+    if(state->rigid_body_av_valid){
+        Eigen::Matrix3d rm = get_rotation_matrix(state->rigid_body_transformation);
+        return rm * state->rigid_body_covariance * rm.transpose();
+    }
+    return get_map()->get_accessible_density_covariance();
+}
+
+std::vector<IMP::algebra::Vector4D> AV::get_xyz_density() const{
+    AVState* state = get_state();
+    if(state->rigid_body_av_valid){
+        std::vector<IMP::algebra::Vector4D> v;
+        v.reserve(state->rigid_body_points.size());
+        for(auto &p : state->rigid_body_points){
+            IMP::algebra::Vector3D x = state->rigid_body_transformation.get_transformed(
+                    IMP::algebra::Vector3D(p[0], p[1], p[2]));
+            v.emplace_back(x[0], x[1], x[2], p[3]);
+        }
+        return v;
+    }
+    return get_map()->get_xyz_density();
+}
+
+double AV::get_obstacle_reach() const{
+    AVState* state = get_state();
+    // obstacles are sampled with the dye radius (plus contact volume
+    // thickness) and half the linker width
+    double ll = get_linker_length();
+    double r = get_radius1();
+    for(auto &v : state->variant_linker_lengths) ll = std::max(ll, v);
+    for(auto &v : state->variant_radii) r = std::max(r, v);
+    return ll + 0.5 * get_linker_width() +
+           r + std::max(0.0, (double) get_contact_volume_thickness()) +
+           get_simulation_grid_resolution();
+}
+
+void AV::set_parameter_variants(
+        const std::vector<double> &linker_lengths,
+        const std::vector<double> &radii,
+        std::vector<double> weights
+){
+    AVState* state = get_state();
+    IMP_USAGE_CHECK(linker_lengths.size() == radii.size(),
+                    "Number of linker lengths and radii of variants differ.");
+    if(weights.empty()){
+        weights.resize(linker_lengths.size(), 1.0);
+    }
+    IMP_USAGE_CHECK(weights.size() == linker_lengths.size(),
+                    "Number of weights and variants differ.");
+    double sum = 0.0;
+    for(auto &w : weights) sum += w;
+    for(auto &w : weights) w /= sum;
+    state->variant_linker_lengths = linker_lengths;
+    state->variant_radii = radii;
+    state->variant_weights = weights;
+    state->variant_points.clear();
+    state->rigid_body_av_valid = false;
+    // Restore the grid of the AV parameters
+    if(linker_lengths.empty() && state->av_map){
+        auto path_map_header = create_path_map_header();
+        state->av_map->set_path_map_header(path_map_header);
+    }
+}
+
+std::vector<IMP::algebra::Vector4D> AV::get_xyz_density(int variant) const{
+    AVState* state = get_state();
+    IMP_USAGE_CHECK(variant >= 0 && variant < get_number_of_parameter_variants(),
+                    "Invalid parameter variant.");
+    IMP_USAGE_CHECK(state->variant_points.size() == state->variant_linker_lengths.size(),
+                    "Parameter variants are not sampled. Call resample first.");
+    return state->variant_points[variant];
+}
+
+void AV::set_rigid_body_mode(bool tf){
+    AVState* state = get_state();
+    state->rigid_body_av_valid = false;
+    state->rigid_body_points.clear();
+    if(tf){
+        IMP::Particle* p = get_source();
+        IMP_USAGE_CHECK(IMP::core::RigidMember::get_is_setup(p),
+                        "Source of AV is not a rigid body member.");
+        state->rigid_body_pi = IMP::core::RigidMember(p).get_rigid_body().get_particle_index();
+    }
+    state->rigid_body_mode = tf;
+}
+
+void AV::set_cache(AVCache* cache){
+    get_state()->cache = cache;
+}
+
+AVCache* AV::get_cache() const{
+    return static_cast<AVCache*>(get_state()->cache.get());
+}
+
+bool AV::get_has_foreign_obstacles() const{
+    AVState* state = get_state();
+    IMP::algebra::Vector3D source = get_source_coordinates();
+    double reach = get_obstacle_reach();
+    for(auto &xyzr : get_map()->get_xyzr_particles()){
+        IMP::Particle* p = xyzr.get_particle();
+        if(IMP::core::RigidMember::get_is_setup(p) &&
+           (IMP::core::RigidMember(p).get_rigid_body().get_particle_index() == state->rigid_body_pi)){
+            continue;
+        }
+        double d = IMP::algebra::get_distance(xyzr.get_coordinates(), source);
+        if(d <= reach + xyzr.get_radius()){
+            return true;
+        }
+    }
+    return false;
+}
+
+void AV::store_rigid_body_av(){
+    AVState* state = get_state();
+    auto map = get_map();
+    IMP::algebra::Transformation3D inverse = state->rigid_body_transformation.get_inverse();
+    auto v = map->get_xyz_density();
+    state->rigid_body_points.clear();
+    state->rigid_body_points.reserve(v.size());
+    for(auto &p : v){
+        IMP::algebra::Vector3D x = inverse.get_transformed(
+                IMP::algebra::Vector3D(p[0], p[1], p[2]));
+        state->rigid_body_points.emplace_back(x[0], x[1], x[2], p[3]);
+    }
+    Eigen::Matrix3d rm = get_rotation_matrix(state->rigid_body_transformation);
+    state->rigid_body_mean = inverse.get_transformed(map->get_accessible_density_mean());
+    state->rigid_body_covariance = rm.transpose() * map->get_accessible_density_covariance() * rm;
+    state->rigid_body_density_sum = map->get_accessible_density_sum();
+    state->rigid_body_av_parameter = get_parameter();
+    state->rigid_body_av_valid = true;
+}
+
 IMP::Particle* AV::get_source() const{
     return get_model()->get_particle(get_particle_index(0));
 }
@@ -140,17 +601,68 @@ IMP::algebra::Vector3D AV::get_source_coordinates() const{
 }
 
 void AV::init_path_map(){
+    AVState* state = get_state();
     auto path_map_header = create_path_map_header();
-    av_map_ = new IMP::bff::PathMap(path_map_header);
+    state->av_map = PathMapPool::get_default_pool()->acquire(path_map_header);
     IMP::Particle* parent = get_model()->get_particle(get_particle_index(0));
 
     auto h = IMP::atom::Hierarchy(get_model(), parent->get_index());
     auto root = IMP::atom::get_root(h);
-    av_map_->set_particles(get_leaves(root));
+    state->av_map->set_particles(get_leaves(root));
+}
+
+void AV::release_map(){
+    AVState* state = get_state();
+    if(!state->av_map) return;
+    if(!state->rigid_body_av_valid){
+        // keep the density in the frame of the model
+        state->rigid_body_transformation = IMP::algebra::get_identity_transformation_3d();
+        store_rigid_body_av();
+        state->released_density = true;
+    }
+    PathMapPool::get_default_pool()->release(state->av_map);
 }
 
 void AV::resample(bool shift_xyz){
+    AVState* state = get_state();
+    state->update_count++;
+    // A released map is reacquired without resampling it twice
+    if(!state->av_map) init_path_map();
     auto map = get_map();
+    if(!state->rigid_body_mode) state->rigid_body_av_valid = false;
+    // a density stored on release is not in the frame of a rigid body
+    bool released = state->released_density;
+    state->released_density = false;
+
+    // Parameter variants share one path search
+    if(!state->variant_linker_lengths.empty()){
+        state->rigid_body_av_valid = false;
+        resample_variants();
+        if(shift_xyz) set_gaussian_from_density();
+        return;
+    }
+
+    // Rigid body mode: only apply the reference frame of the body
+    bool foreign_obstacles = false;
+    if(state->rigid_body_mode){
+        IMP::core::RigidBody rb(get_model(), state->rigid_body_pi);
+        state->rigid_body_transformation = rb.get_reference_frame().get_transformation_to();
+        foreign_obstacles = get_has_foreign_obstacles();
+        bool same_parameter =
+                (get_parameter() - state->rigid_body_av_parameter).get_squared_magnitude() == 0.0;
+        if(state->rigid_body_av_valid && !released && same_parameter && !foreign_obstacles){
+            if(shift_xyz) set_gaussian_from_density();
+            return;
+        }
+        state->rigid_body_av_valid = false;
+    }
+
+    // AVs with the same local environment are taken from the cache
+    AVCache* cache = state->rigid_body_mode ? nullptr : get_cache();
+    if(cache && cache->load(*this)){
+        if(shift_xyz) set_gaussian_from_density();
+        return;
+    }
 
     // Update parameters of path map
     if(get_parameters_are_optimized()){
@@ -162,10 +674,19 @@ void AV::resample(bool shift_xyz){
     IMP::algebra::Vector3D source = get_source_coordinates();
     auto header = get_map()->get_path_map_header_writable();
     header->set_path_origin(source);
-    av_map_->set_origin(source);
+    state->av_map->set_origin(source);
 
-    // 1.1 Sample obstacles
-    map->sample_obstacles(get_linker_width() * 0.5);
+    // 1. Sample the distance of the tiles to the obstacles once. The
+    // obstacles of the linker, the dye, and the contact volume are
+    // thresholds of the distance.
+    double r = get_radius1();
+    bool contact_volume = get_contact_volume_is_enabled();
+    double r_max = std::max(get_linker_width() * 0.5, r);
+    if(contact_volume) r_max = std::max(r_max, r + get_contact_volume_thickness());
+    map->sample_obstacle_clearance(r_max + get_simulation_grid_resolution());
+
+    // 1.1 Obstacles of the linker
+    map->set_obstacles_from_clearance(get_linker_width() * 0.5);
 
     // 2. Block voxels further away from source than linker length
     double critical_radius;
@@ -176,43 +697,176 @@ void AV::resample(bool shift_xyz){
     critical_radius = get_allowed_sphere_radius();
     map->fill_sphere(source, critical_radius, 0, false);
 
-    // 4. Find a path from source to other tiles
-    map->update_tiles(); // Update tiles to assure that the nodes are updated
-    long source_idx = map->get_voxel_by_location(source);
-    map->find_path_dijkstra(source_idx, -1);
+    // 4. Update tiles to assure that the nodes are updated
+    map->update_tiles();
 
-    // 5. Remove tiles closer to obstacles than dye radius
-    double r = get_radius1();
-    map->sample_obstacles(r);
+    // 5. Remove tiles closer to obstacles than dye radius. The path
+    // search only uses the tile penalties, thus the densities are
+    // updated before the search to have the accessible density in
+    // the moments that are accumulated in the path search.
+    map->set_obstacles_from_clearance(r);
     auto obstacle = map->get_data();
     long nvox = map->get_number_of_voxels();
     for(long i=0; i<nvox; i++){
-        if(obstacle[i] > TILE_OBSTACLE_THRESHOLD){
-            // Tile density is by default 1 (or another user specified number)
-            // Setting the tile density to zeros effectively removes the tile.
-            map->tiles[i].density *= 0.0;
-        }
+        // Setting the tile density to zeros effectively removes the tile.
+        // Densities are reset as the contact volume rescales the densities.
+        map->tiles[i].density = (obstacle[i] > TILE_OBSTACLE_THRESHOLD) ?
+                0.0f : TILE_DENSITY_DEFAULT;
     }
 
-    // Shift XYZ to mean AV position
+    // 6. Find a path from source to other tiles
+    long source_idx = map->get_voxel_by_location(source);
+    map->find_path_dijkstra(source_idx, -1);
+
+    // 7. Weight the density in the contact volume (tiles closer to
+    // the surface than the dye radius plus the contact volume thickness).
+    // The obstacles of the dye radius are restored afterwards.
+    if(contact_volume){
+        map->set_obstacles_from_clearance(r + get_contact_volume_thickness());
+        map->weight_contact_volume(get_contact_volume_trapped_fraction());
+        map->set_obstacles_from_clearance(r);
+    }
+
+    if(state->rigid_body_mode && !foreign_obstacles){
+        store_rigid_body_av();
+    }
+    if(cache) cache->store(*this);
+
+    // Shift XYZ to mean AV position and approximate AV by a Gaussian
     if(shift_xyz){
-        set_coordinates(get_mean_position());
+        set_gaussian_from_density();
     }
 }
 
-void AV::set_av_parameter(const nlohmann::json &j){
-    set_linker_length(j.value("linker_length", 20.0));
+void AV::resample_variants(){
+    AVState* state = get_state();
+    auto map = get_map();
+    const double dg = get_simulation_grid_resolution();
+    const int n_variants = get_number_of_parameter_variants();
+    double ll_max = 0.0;
+    for(int k = 0; k < n_variants; k++){
+        ll_max = std::max(ll_max, state->variant_linker_lengths[k]);
+    }
+
+    // The grid of the longest linker is shared by all variants. The
+    // map is only reallocated if the grid changes.
+    const PathMapHeader* pmh = map->get_path_map_header();
+    if((pmh->get_max_path_length() != ll_max) ||
+       (pmh->get_simulation_grid_resolution() != dg)){
+        IMP::bff::PathMapHeader path_map_header(ll_max, dg);
+        map->set_path_map_header(path_map_header);
+    }
+
+    // Update path_map origin
+    IMP::algebra::Vector3D source = get_source_coordinates();
+    map->get_path_map_header_writable()->set_path_origin(source);
+    map->set_origin(source);
+
+    // One sampling of the obstacle clearance serves the linker and the
+    // dye radii (and contact volumes) of all variants. The obstacles are
+    // thresholds of the clearance as in resample.
+    double cv_thickness = get_contact_volume_thickness();
+    double cv_fraction = get_contact_volume_trapped_fraction();
+    bool contact_volume = get_contact_volume_is_enabled();
+    double r_max = get_linker_width() * 0.5;
+    for(int k = 0; k < n_variants; k++){
+        double r = state->variant_radii[k];
+        r_max = std::max(r_max, contact_volume ? r + cv_thickness : r);
+    }
+    map->sample_obstacle_clearance(r_max + dg);
+
+    // Obstacles for the linker, blocked and unblocked spheres as in resample
+    map->set_obstacles_from_clearance(get_linker_width() * 0.5);
+    map->fill_sphere(source, ll_max, TILE_PENALTY_THRESHOLD, true);
+    map->fill_sphere(source, get_allowed_sphere_radius(), 0, false);
+    map->update_tiles();
+    long nvox = map->get_number_of_voxels();
+    const std::vector<float> &clearance = map->get_obstacle_clearance();
+
+    // One path search for all (nested) linker lengths. A path shorter
+    // than a linker length does not leave the sphere of that length.
+    for(long i = 0; i < nvox; i++){
+        map->tiles[i].density = TILE_DENSITY_DEFAULT;
+    }
+    long source_idx = map->get_voxel_by_location(source);
+    map->find_path_dijkstra(source_idx, -1);
+
+    // Accessible densities of the variants and the mixture of the
+    // normalized densities (stored in the map)
+    std::vector<float> mixture(nvox, 0.0f);
+    double n_mean = 0.0;
+    state->variant_points.resize(n_variants);
+    for(int k = 0; k < n_variants; k++){
+        const float ll = (float) state->variant_linker_lengths[k];
+        const double r = state->variant_radii[k];
+        const double r_cv = r + cv_thickness;
+        std::vector<long> idxs;
+        std::vector<bool> in_cv;
+        double m0 = 0.0, cv_m0 = 0.0;
+        for(long i = 0; i < nvox; i++){
+            float c = map->tiles[i].cost * dg;
+            if((c >= 0.0f) && (c < ll) && (clearance[i] > r)){
+                bool cv = contact_volume && (clearance[i] <= r_cv);
+                idxs.emplace_back(i);
+                in_cv.emplace_back(cv);
+                m0 += TILE_DENSITY_DEFAULT;
+                if(cv) cv_m0 += TILE_DENSITY_DEFAULT;
+            }
+        }
+        // Weight the density in the contact volume (see weight_contact_volume)
+        double s_cv = 1.0, s_free = 1.0;
+        double free_m0 = m0 - cv_m0;
+        if(contact_volume && (cv_m0 > 0.0) && (free_m0 > 0.0)){
+            s_cv = cv_fraction * m0 / cv_m0;
+            s_free = (1.0 - cv_fraction) * m0 / free_m0;
+        }
+        n_mean += state->variant_weights[k] * m0;
+        auto &points = state->variant_points[k];
+        points.clear();
+        points.reserve(idxs.size());
+        for(size_t j = 0; j < idxs.size(); j++){
+            double w = TILE_DENSITY_DEFAULT * (in_cv[j] ? s_cv : s_free);
+            if(w <= 0.0) continue;
+            IMP::algebra::Vector3D x = map->get_location_by_voxel(idxs[j]);
+            points.emplace_back(x[0], x[1], x[2], w);
+            mixture[idxs[j]] += (float) (state->variant_weights[k] * w / m0);
+        }
+    }
+    // The mixture is scaled to the mean number of accessible tiles
+    for(long i = 0; i < nvox; i++){
+        map->tiles[i].density = (float) (mixture[i] * n_mean);
+    }
+    map->update_density_moments();
+}
+
+void AV::set_gaussian_from_density(){
+    IMP::algebra::Vector3D mp = get_mean_position();
+    if(get_density_sum() > 0.0){
+        set_gaussian(IMP::algebra::get_gaussian_from_covariance(get_covariance(), mp));
+    } else{
+        set_coordinates(mp);
+    }
+}
+
+IMP::algebra::VectorD<9> AV::get_parameter(const nlohmann::json &j){
+    IMP::algebra::VectorD<9> v;
+    v[0] = j.value("linker_length", 20.0);
     algebra::Vector3D r = {j.value("radius1", 3.0),
                            j.value("radius2", 0.0),
                            j.value("radius3", 0.0)};
-    set_radius1(r[0]);
-    set_radius2(r[0]);
-    set_radius3(r[0]);
-    set_linker_width(j.value("linker_width", 0.5));
-    set_allowed_sphere_radius(j.value("allowed_sphere_radius", 1.5));
-    set_contact_volume_thickness(j.value("contact_volume_thickness", 0.0));
-    set_contact_volume_trapped_fraction(j.value("contact_volume_trapped_fraction", -1));
-    set_simulation_grid_resolution(j.value("simulation_grid_resolution", 1.5));
+    v[1] = r[0];
+    v[2] = r[0];
+    v[3] = r[0];
+    v[4] = j.value("linker_width", 0.5);
+    v[5] = j.value("allowed_sphere_radius", 1.5);
+    v[6] = j.value("contact_volume_thickness", 0.0);
+    v[7] = j.value("contact_volume_trapped_fraction", AV_CONTACT_VOLUME_DISABLED);
+    v[8] = j.value("simulation_grid_resolution", 1.5);
+    return v;
+}
+
+void AV::set_av_parameter(const nlohmann::json &j){
+    set_parameter(get_parameter(j));
 }
 
 IMP::bff::PathMapHeader AV::create_path_map_header(){
@@ -268,12 +922,20 @@ IMP::ParticleIndex search_labeling_site(
     return p->get_index();
 }
 
-//! Random sampling over AV
-    void get_xyz_density();
+std::vector<double> av_distance_histogram(
+        const AV& av1,
+        const AV& av2,
+        const std::vector<double> &axis,
+        int n_points
+){
+    WeightedPoints p1 = get_weighted_points(av1.get_xyz_density(), n_points);
+    WeightedPoints p2 = get_weighted_points(av2.get_xyz_density(), n_points);
+    return get_pair_distance_histogram(p1, p2, axis);
+}
 
+//! Random sampling over AV
 std::vector<double> av_random_points(const AV& av, int n_samples){
-    auto m = av.get_map();
-    auto d = m->get_xyz_density();
+    auto d = av.get_xyz_density();
     std::vector<double> data; 
     if(!d.empty()){
         // Draw points using Inverse transform sampling
@@ -344,4 +1006,179 @@ std::vector<double> av_distance_distribution(
 }
 
 
+namespace{
+
+/// Angles of the kappa2 grid (0.001, 0.001 + step, ... < stop)
+std::vector<double> get_kappasq_angles(double stop, double step){
+    int n = (int) std::ceil((stop - 0.001) / step);
+    std::vector<double> r(std::max(n, 0));
+    for(size_t i = 0; i < r.size(); i++) r[i] = 0.001 + i * step;
+    return r;
+}
+
+/// kappa2 of all acceptor orientations on the cone around a donor axis
+void kappasq_cone(
+        double cos_delta, double sin_delta,
+        double sD2, double sA2,
+        double beta1,
+        const std::vector<double> &cos_phi,
+        double *k2
+){
+    const double cb1 = std::cos(beta1);
+    const double sb1 = std::sin(beta1);
+    const double *cp = cos_phi.data();
+    const size_t n = cos_phi.size();
+    // RDA is the x-axis: cos(beta2) is the x-component of the acceptor axis
+    for(size_t j = 0; j < n; j++){
+        double cb2 = std::abs(cb1 * cos_delta - sb1 * sin_delta * cp[j]);
+        k2[j] = kappasq_cos<double>(cos_delta, sD2, sA2, cb1, cb2);
+    }
+}
+
+}
+
+std::vector<double> kappasq_all_delta(
+        double delta,
+        double sD2,
+        double sA2,
+        double step,
+        int n_bins,
+        double k2_min,
+        double k2_max
+){
+    IMP_USAGE_CHECK(step > 0.0, "The angular step needs to be positive.");
+    IMP_USAGE_CHECK(n_bins > 1, "The kappa2 axis needs at least two bin edges.");
+    double step_rad = step * IMP::algebra::PI / 180.0;
+    auto beta1 = get_kappasq_angles(IMP::algebra::PI / 2.0, step_rad);
+    auto phi = get_kappasq_angles(2.0 * IMP::algebra::PI, step_rad);
+    std::vector<double> cos_phi(phi.size());
+    for(size_t j = 0; j < phi.size(); j++) cos_phi[j] = std::cos(phi[j]);
+
+    std::vector<double> bin_edges(n_bins);
+    double k2_step = (k2_max - k2_min) / (n_bins - 1);
+    linspace(k2_min, k2_max + k2_step, bin_edges.data(), n_bins);
+    bin_edges[n_bins - 1] = k2_max;
+    const double k2_width = (k2_max - k2_min) / (n_bins - 1);
+
+    std::vector<double> k2(phi.size());
+    std::vector<double> row_hist(n_bins);
+    std::vector<double> hist(n_bins - 1, 0.0);
+    double cos_delta = std::cos(delta), sin_delta = std::sin(delta);
+    for(auto &b : beta1){
+        kappasq_cone(cos_delta, sin_delta, sD2, sA2, b, cos_phi, k2.data());
+        std::fill(row_hist.begin(), row_hist.end(), 0.0);
+        histogram1D<double>(
+                k2.data(), k2.size(),
+                nullptr, 0,
+                bin_edges.data(), n_bins,
+                row_hist.data(), row_hist.size(),
+                AXIS_LIN, false
+        );
+        // As in np.histogram the last bin is closed: kappa2 values at
+        // k2_max are counted in the last bin, not beyond the last edge
+        for(auto &v : k2){
+            if(v != k2_max) continue;
+            int idx = calc_bin_idx<double>(k2_min, k2_width, v);
+            if((idx >= 0) && (idx < n_bins) && (idx != n_bins - 2)){
+                row_hist[idx] -= 1.0;
+                row_hist[n_bins - 2] += 1.0;
+            }
+        }
+        double w = std::sin(b);
+        for(int i = 0; i < n_bins - 1; i++) hist[i] += w * row_hist[i];
+    }
+    return hist;
+}
+
+void kappasq_all_delta_values(
+        double** output, int* n_output1, int* n_output2,
+        double delta,
+        double sD2,
+        double sA2,
+        double step
+){
+    IMP_USAGE_CHECK(step > 0.0, "The angular step needs to be positive.");
+    double step_rad = step * IMP::algebra::PI / 180.0;
+    auto beta1 = get_kappasq_angles(IMP::algebra::PI / 2.0, step_rad);
+    auto phi = get_kappasq_angles(2.0 * IMP::algebra::PI, step_rad);
+    std::vector<double> cos_phi(phi.size());
+    for(size_t j = 0; j < phi.size(); j++) cos_phi[j] = std::cos(phi[j]);
+
+    size_t n = beta1.size(), m = phi.size();
+    *n_output1 = (int) n;
+    *n_output2 = (int) m;
+    *output = (double*) malloc(std::max<size_t>(n * m, 1) * sizeof(double));
+    double cos_delta = std::cos(delta), sin_delta = std::sin(delta);
+    for(size_t i = 0; i < n; i++){
+        kappasq_cone(cos_delta, sin_delta, sD2, sA2, beta1[i], cos_phi, *output + i * m);
+    }
+}
+
+void kappasq_all_delta_histograms(
+        double *input, int n_input1, int n_input2,
+        double** output, int* n_output1, int* n_output2,
+        double step,
+        int n_bins,
+        double k2_min,
+        double k2_max
+){
+    IMP_USAGE_CHECK(n_input2 == 3, "Dye parameters need the columns delta, sD2, and sA2.");
+    IMP_USAGE_CHECK(n_bins > 1, "The kappa2 axis needs at least two bin edges.");
+    int n_hist = n_bins - 1;
+    *n_output1 = n_input1;
+    *n_output2 = n_hist;
+    *output = (double*) malloc(std::max(n_input1 * n_hist, 1) * sizeof(double));
+    double *out = *output;
+    IMP_OMP_PRAGMA(parallel for schedule(dynamic))
+    for(int i = 0; i < n_input1; i++){
+        const double *p = input + 3 * i;
+        auto hist = kappasq_all_delta(p[0], p[1], p[2], step, n_bins, k2_min, k2_max);
+        std::copy(hist.begin(), hist.end(), out + (size_t) i * n_hist);
+    }
+}
+
+std::vector<double> kappa_distance(
+        const IMP::algebra::Vector3D &d1,
+        const IMP::algebra::Vector3D &d2,
+        const IMP::algebra::Vector3D &a1,
+        const IMP::algebra::Vector3D &a2
+){
+    IMP::algebra::Vector3D mu_d = (d2 - d1).get_unit_vector();
+    IMP::algebra::Vector3D mu_a = (a2 - a1).get_unit_vector();
+    IMP::algebra::Vector3D rda = (d1 + d2) * 0.5 - (a1 + a2) * 0.5;
+    double distance = rda.get_magnitude();
+    IMP::algebra::Vector3D n_rda = rda / distance;
+    double kappa = mu_a * mu_d - 3.0 * (mu_d * n_rda) * (mu_a * n_rda);
+    return {distance, kappa};
+}
+
+void kappa_distances(
+        double *input, int n_input1, int n_input2,
+        double** output, int* n_output1, int* n_output2,
+        int aid1, int aid2, int aia1, int aia2
+){
+    int n_atoms = n_input2 / 3;
+    IMP_USAGE_CHECK(
+            (aid1 >= 0) && (aid1 < n_atoms) && (aid2 >= 0) && (aid2 < n_atoms) &&
+            (aia1 >= 0) && (aia1 < n_atoms) && (aia2 >= 0) && (aia2 < n_atoms),
+            "Dipole atom indices out of range."
+    );
+    *n_output1 = n_input1;
+    *n_output2 = 2;
+    *output = (double*) malloc(std::max(2 * n_input1, 1) * sizeof(double));
+    auto get_xyz = [](const double *frame, int i){
+        return IMP::algebra::Vector3D(frame[3 * i], frame[3 * i + 1], frame[3 * i + 2]);
+    };
+    for(int i = 0; i < n_input1; i++){
+        const double *frame = input + (size_t) i * n_input2;
+        auto r = kappa_distance(
+                get_xyz(frame, aid1), get_xyz(frame, aid2),
+                get_xyz(frame, aia1), get_xyz(frame, aia2)
+        );
+        (*output)[2 * i] = r[0];
+        (*output)[2 * i + 1] = r[1];
+    }
+}
+
+
 IMPBFF_END_NAMESPACE
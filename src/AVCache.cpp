@@ -0,0 +1,255 @@
+/**
+ *  \file IMP/bff/AVCache.h
+ *  \brief Cache of accessible volumes keyed by the local environment.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+#include <IMP/bff/AVCache.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+/// FNV-1a hash of a descriptor
+static std::uint64_t get_descriptor_hash(const std::vector<std::int64_t> &d){
+    std::uint64_t h = 14695981039346656037ULL;
+    for(auto &v : d){
+        h ^= static_cast<std::uint64_t>(v);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+
+AVCache::AVCache(
+        size_t memory_budget,
+        double tolerance,
+        std::string name
+) : IMP::Object(name), memory_budget_(memory_budget), tolerance_(tolerance){
+    IMP_USAGE_CHECK(tolerance > 0.0, "Tolerance must be positive.");
+}
+
+IMP::algebra::Transformation3D AVCache::get_local_frame(const AV &av){
+    IMP::algebra::Vector3D source = av.get_source_coordinates();
+    IMP::algebra::Rotation3D rot = IMP::algebra::get_identity_rotation_3d();
+
+    IMP::Particle* p = av.get_source();
+    if(IMP::atom::Atom::get_is_setup(p)){
+        IMP::atom::Residue res = IMP::atom::get_residue(IMP::atom::Atom(p), true);
+        if(res.get_particle() != nullptr){
+            IMP::atom::Atom a_n = IMP::atom::get_atom(res, IMP::atom::AT_N);
+            IMP::atom::Atom a_ca = IMP::atom::get_atom(res, IMP::atom::AT_CA);
+            IMP::atom::Atom a_c = IMP::atom::get_atom(res, IMP::atom::AT_C);
+            if((a_n.get_particle() != nullptr) &&
+               (a_ca.get_particle() != nullptr) &&
+               (a_c.get_particle() != nullptr)){
+                auto n = IMP::core::XYZ(a_n).get_coordinates();
+                auto ca = IMP::core::XYZ(a_ca).get_coordinates();
+                auto c = IMP::core::XYZ(a_c).get_coordinates();
+                Eigen::Vector3d e1(n[0] - ca[0], n[1] - ca[1], n[2] - ca[2]);
+                Eigen::Vector3d u(c[0] - ca[0], c[1] - ca[1], c[2] - ca[2]);
+                Eigen::Vector3d e2 = u - u.dot(e1) / e1.squaredNorm() * e1;
+                if((e1.norm() > 1e-6) && (e2.norm() > 1e-6)){
+                    e1.normalize();
+                    e2.normalize();
+                    Eigen::Matrix3d m;
+                    m.col(0) = e1;
+                    m.col(1) = e2;
+                    m.col(2) = e1.cross(e2);
+                    rot = IMP::algebra::get_rotation_from_matrix(m);
+                }
+            }
+        }
+    }
+    return IMP::algebra::Transformation3D(rot, source);
+}
+
+std::vector<std::int64_t> AVCache::get_descriptor(
+        const AV &av,
+        const IMP::algebra::Transformation3D &frame
+) const{
+    std::vector<std::int64_t> d;
+
+    // AV parameters
+    IMP::algebra::VectorD<9> parameter = av.get_parameter();
+    for(int i = 0; i < 9; i++){
+        d.emplace_back(std::llround(parameter[i] * 1e6));
+    }
+
+    // Obstacles within reach of the source
+    double reach = av.get_obstacle_reach();
+    IMP::algebra::Vector3D source = av.get_source_coordinates();
+    IMP::algebra::Transformation3D inverse = frame.get_inverse();
+
+    auto h = IMP::atom::Hierarchy(av.get_model(), av.get_particle_index(0));
+    std::vector<std::array<std::int64_t, 4>> obstacles;
+    for(auto &leaf : IMP::atom::get_leaves(IMP::atom::get_root(h))){
+        IMP::core::XYZR xyzr(leaf.get_particle());
+        double r = xyzr.get_radius();
+        IMP::algebra::Vector3D x = xyzr.get_coordinates();
+        if(IMP::algebra::get_distance(x, source) > reach + r) continue;
+        IMP::algebra::Vector3D l = inverse.get_transformed(x);
+        obstacles.push_back({
+            std::llround(l[0] / tolerance_),
+            std::llround(l[1] / tolerance_),
+            std::llround(l[2] / tolerance_),
+            std::llround(r / tolerance_)
+        });
+    }
+    std::sort(obstacles.begin(), obstacles.end());
+    d.reserve(d.size() + 4 * obstacles.size());
+    for(auto &o : obstacles){
+        d.insert(d.end(), o.begin(), o.end());
+    }
+    return d;
+}
+
+AVCache::Entry* AVCache::find(
+        std::uint64_t key,
+        const std::vector<std::int64_t> &descriptor
+){
+    auto it = entries_.find(key);
+    if(it == entries_.end()) return nullptr;
+    // hash collisions
+    if(it->second.first.descriptor != descriptor) return nullptr;
+    // move to front of LRU list
+    lru_.splice(lru_.begin(), lru_, it->second.second);
+    return &it->second.first;
+}
+
+void AVCache::evict(){
+    while((memory_usage_ > memory_budget_) && !lru_.empty()){
+        std::uint64_t key = lru_.back();
+        auto it = entries_.find(key);
+        memory_usage_ -= it->second.first.memory;
+        entries_.erase(it);
+        lru_.pop_back();
+    }
+}
+
+void AVCache::clear(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    lru_.clear();
+    memory_usage_ = 0;
+}
+
+size_t AVCache::get_number_of_entries() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+size_t AVCache::get_number_of_hits() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return n_hits_;
+}
+
+size_t AVCache::get_number_of_misses() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return n_misses_;
+}
+
+size_t AVCache::get_memory_usage() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return memory_usage_;
+}
+
+size_t AVCache::get_memory_budget() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return memory_budget_;
+}
+
+void AVCache::set_memory_budget(size_t v){
+    std::lock_guard<std::mutex> lock(mutex_);
+    memory_budget_ = v;
+    evict();
+}
+
+bool AVCache::get_is_cached(const AV &av){
+    IMP::algebra::Transformation3D frame = get_local_frame(av);
+    std::vector<std::int64_t> descriptor = get_descriptor(av, frame);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(get_descriptor_hash(descriptor));
+    return (it != entries_.end()) && (it->second.first.descriptor == descriptor);
+}
+
+bool AVCache::load(AV &av){
+    IMP::algebra::Transformation3D frame = get_local_frame(av);
+    std::vector<std::int64_t> descriptor = get_descriptor(av, frame);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* e = find(get_descriptor_hash(descriptor), descriptor);
+    if(e == nullptr){
+        n_misses_++;
+        return false;
+    }
+    n_hits_++;
+    // the density accessors of the AV transform the stored AV
+    AVState* state = av.get_state();
+    state->rigid_body_transformation = frame;
+    state->rigid_body_points = e->points;
+    state->rigid_body_mean = e->mean;
+    state->rigid_body_covariance = e->covariance;
+    state->rigid_body_density_sum = e->density_sum;
+    state->rigid_body_av_parameter = av.get_parameter();
+    state->rigid_body_av_valid = true;
+    return true;
+}
+
+void AVCache::store(const AV &av){
+    IMP::algebra::Transformation3D frame = get_local_frame(av);
+    std::vector<std::int64_t> descriptor = get_descriptor(av, frame);
+    std::uint64_t key = get_descriptor_hash(descriptor);
+
+    // Store the AV in the local frame
+    Entry n;
+    IMP::algebra::Transformation3D inverse = frame.get_inverse();
+    n.descriptor = descriptor;
+    auto v = av.get_xyz_density();
+    n.points.reserve(v.size());
+    for(auto &p : v){
+        IMP::algebra::Vector3D x = inverse.get_transformed(
+                IMP::algebra::Vector3D(p[0], p[1], p[2]));
+        n.points.emplace_back(x[0], x[1], x[2], p[3]);
+    }
+    n.mean = inverse.get_transformed(av.get_density_mean());
+    Eigen::Matrix3d rm = get_rotation_matrix(frame);
+    n.covariance = rm.transpose() * av.get_covariance() * rm;
+    n.density_sum = av.get_density_sum();
+    n.memory = sizeof(Entry) +
+            n.points.size() * sizeof(IMP::algebra::Vector4D) +
+            n.descriptor.size() * sizeof(std::int64_t);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(n.memory > memory_budget_){
+        return;
+    }
+
+    // Replace entries with colliding keys
+    auto it = entries_.find(key);
+    if(it != entries_.end()){
+        memory_usage_ -= it->second.first.memory;
+        lru_.erase(it->second.second);
+        entries_.erase(it);
+    }
+    memory_usage_ += n.memory;
+    lru_.push_front(key);
+    entries_.emplace(key, std::make_pair(std::move(n), lru_.begin()));
+    evict();
+
+#if IMPBFF_VERBOSE
+    std::clog << "AVCache::store" << std::endl;
+    std::clog << "-- number of entries: " << entries_.size() << std::endl;
+    std::clog << "-- memory usage: " << memory_usage_ << std::endl;
+#endif
+}
+
+std::vector<IMP::algebra::Vector4D> AVCache::get_xyz_density(
+        AV &av, bool shift_xyz
+){
+    av.set_cache(this);
+    av.resample(shift_xyz);
+    return av.get_xyz_density();
+}
+
+
+IMPBFF_END_NAMESPACE
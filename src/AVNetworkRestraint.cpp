@@ -7,6 +7,7 @@
  *
  */
  #include <IMP/bff/AVNetworkRestraint.h>
+ #include <IMP/bff/internal/PairHistogram.h>
 
 IMPBFF_BEGIN_NAMESPACE
 
@@ -45,6 +46,12 @@ IMP::ModelObjectsTemp AVNetworkRestraint::do_get_inputs() const {
     for (size_t i = 0; i < model_ps_.size(); i++) {
         ret.push_back(get_model()->get_particle(model_ps_[i]));
     }
+    // AV particles are outputs of the AV updater
+    if(av_updater_){
+        for(auto &av: avs_){
+            ret.push_back(av.second->get_particle());
+        }
+    }
     return ret;
 }
 
@@ -52,31 +59,21 @@ std::map<std::string, IMP::bff::AV*> AVNetworkRestraint::create_av_decorated_par
         nlohmann::json used_positions,
         const IMP::core::Hierarchy &hier
 ){
-    IMP::Model* model = get_model();
     std::map<std::string, IMP::bff::AV*> avs{};
+    av_registry_ = AVRegistry::get_registry(get_model());
 
     for(nlohmann::json::iterator it = used_positions.begin();
             it != used_positions.end(); ++it){
         nlohmann::json position = it.value();
         std::string position_name = it.key();
 
-        // Create new Particle for AV
-        IMP_NEW(IMP::Particle, av_particle, (model));
-        av_particle->set_name(position_name);
-
         // Search for labeling site
         IMP::ParticleIndex parent_particle_idx =
                 IMP::bff::search_labeling_site(hier, "", position);
 
-        // Store AV particle index
-        IMP::ParticleIndex av_index = av_particle->get_index();
-
-        // Decorate AV particle
-        IMP::bff::AV::do_setup_particle(model, av_index, parent_particle_idx);
-        auto av = new IMP::bff::AV(av_particle);
-        av->set_av_parameter(position);
-
-        avs[position_name] = av;
+        // AV particles are shared with other restraints of the model
+        avs[position_name] = av_registry_->get_av(
+                parent_particle_idx, position, position_name);
     }
     return avs;
 }
@@ -90,22 +87,196 @@ IMP::bff::AV* AVNetworkRestraint::get_av(std::string name) const{
     return nullptr;
 }
 
+void AVNetworkRestraint::set_rigid_body_mode(bool tf){
+    for(auto &av: avs_){
+        if(!tf || IMP::core::RigidMember::get_is_setup(av.second->get_source())){
+            av.second->set_rigid_body_mode(tf);
+        }
+    }
+    cache_valid_ = false;
+}
+
+void AVNetworkRestraint::set_av_updater(AVUpdater* updater){
+    av_updater_ = updater;
+    av_pi_.clear();
+    for(auto &av: avs_){
+        av.second = updater->add_av(av.second->get_particle_index());
+        av_pi_.emplace_back(av.second->get_particle_index());
+    }
+    av_update_counts_.clear();
+    cache_valid_ = false;
+}
+
+void AVNetworkRestraint::set_parameter_variants(
+        std::string position_name,
+        const std::vector<double> &linker_lengths,
+        const std::vector<double> &radii,
+        const std::vector<double> &weights
+){
+    auto it = avs_.find(position_name);
+    IMP_USAGE_CHECK(it != avs_.end(), "AV " << position_name << " not used in restraint.");
+    it->second->set_parameter_variants(linker_lengths, radii, weights);
+    it->second->resample();
+    cache_valid_ = false;
+}
+
+/// Score (and derivative) of a distance marginalized over the variants
+static double get_marginal_score(
+        AVPairDistanceMeasurement &distance,
+        const std::vector<double> &models,
+        const std::vector<double> &weights,
+        double &model,
+        double &derivative
+){
+    size_t n = models.size();
+    std::vector<double> scores(n);
+    double s_min = std::numeric_limits<double>::infinity();
+    double w_sum = 0.0;
+    model = 0.0;
+    for(size_t i = 0; i < n; i++){
+        scores[i] = distance.score_model(models[i]);
+        s_min = std::min(s_min, scores[i]);
+        if(!std::isnan(models[i])){
+            model += weights[i] * models[i];
+            w_sum += weights[i];
+        }
+    }
+    model = (w_sum > 0.0) ? model / w_sum : std::numeric_limits<double>::quiet_NaN();
+    derivative = 0.0;
+    if(std::isinf(s_min)){
+        return s_min;
+    }
+    // log-sum-exp relative to the smallest score
+    double z = 0.0;
+    std::vector<double> p(n);
+    for(size_t i = 0; i < n; i++){
+        p[i] = weights[i] * std::exp(s_min - scores[i]);
+        z += p[i];
+    }
+    for(size_t i = 0; i < n; i++){
+        derivative += p[i] / z * distance.score_model_derivative(models[i]);
+    }
+    return s_min - std::log(z);
+}
+
+std::set<std::string> AVNetworkRestraint::get_changed_avs() const{
+    // AVs are resampled by the updater or by the registry. AVs shared
+    // with other restraints are resampled once per change of their inputs.
+    if(!av_updater_){
+        std::vector<AV*> avs;
+        for(auto &av: avs_) avs.emplace_back(av.second);
+        std::vector<bool> resampled = av_registry_->update_avs(avs);
+        if(release_path_maps_){
+            for(size_t i = 0; i < avs.size(); i++){
+                if(resampled[i]) avs[i]->release_map();
+            }
+        }
+    }
+    std::set<std::string> changed;
+    for(auto &av: avs_){
+        unsigned c = av.second->get_update_count();
+        auto it = av_update_counts_.find(av.first);
+        if(!cache_valid_ || (it == av_update_counts_.end()) || (it->second != c)){
+            changed.insert(av.first);
+        }
+        av_update_counts_[av.first] = c;
+    }
+    return changed;
+}
+
 double AVNetworkRestraint::unprotected_evaluate(
         IMP::DerivativeAccumulator *accum) const {
     double score = 0.0;
-    for(auto &av: avs_){
-        av.second->resample();
+
+    std::set<std::string> changed;
+    if(lazy_evaluation_ || av_updater_){
+        changed = get_changed_avs();
+    } else{
+        for(auto &av: avs_){
+            av.second->resample();
+            if(release_path_maps_) av.second->release_map();
+            changed.insert(av.first);
+        }
+        cache_valid_ = false;
     }
+    n_updated_avs_ = (int) changed.size();
+
+    // Points of the AVs in distance distributions are shared by the pairs
+    std::map<std::string, WeightedPoints> points;
+    auto get_points = [&](const std::string &name) -> const WeightedPoints& {
+        auto p = points.find(name);
+        if(p == points.end()){
+            p = points.emplace(name, get_weighted_points(
+                    get_av(name)->get_xyz_density(), n_distribution_points_)).first;
+        }
+        return p->second;
+    };
+
     for(const auto & it : distances_){
         auto distance = it.second;
-        double model = get_model_distance(
-                distance.position_1,
-                distance.position_2,
-                distance.forster_radius,
-                distance.distance_type
-        );
-        score += distance.score_model(model);
+        bool update = !cache_valid_ ||
+                (changed.count(distance.position_1) > 0) ||
+                (changed.count(distance.position_2) > 0) ||
+                (model_distances_.count(it.first) == 0);
+        if(update){
+            auto av1 = get_av(distance.position_1);
+            auto av2 = get_av(distance.position_2);
+            if((distance.distance_type == DYE_PAIR_DISTANCE_DISTRIBUTION) &&
+               !distance.distribution.empty()){
+                // Distance distribution: the mean distance is reported
+                // and the term has no derivatives
+                std::vector<double> hist = get_pair_distance_histogram(
+                        get_points(distance.position_1),
+                        get_points(distance.position_2),
+                        distance.distribution_axis);
+                double mean = 0.0;
+                for(size_t i = 0; i < hist.size(); i++){
+                    mean += hist[i] * distance.distribution_axis[i];
+                }
+                model_distances_[it.first] = mean;
+                model_scores_[it.first] = distance.score_distribution(hist);
+                model_score_derivatives_[it.first] = 0.0;
+                model_gradients_.erase(it.first);
+                score += model_scores_[it.first];
+                continue;
+            }
+            std::vector<double> models = av_variant_distances(
+                    *av1, *av2, distance.forster_radius,
+                    distance.distance_type, n_samples);
+            double model, derivative, s;
+            if(models.size() == 1){
+                model = models[0];
+                s = distance.score_model(model);
+                derivative = distance.score_model_derivative(model);
+            } else{
+                std::vector<double> weights = av_variant_weights(
+                        *av1, *av2, distance.distance_type);
+                s = get_marginal_score(distance, models, weights, model, derivative);
+            }
+            model_distances_[it.first] = model;
+            model_scores_[it.first] = s;
+            model_score_derivatives_[it.first] = derivative;
+            model_gradients_.erase(it.first);
+        }
+        score += model_scores_[it.first];
+
+        // Derivatives: AVs translate with their source particles. The
+        // derivatives of rigid body members are accumulated by the
+        // rigid bodies.
+        if(accum && (model_score_derivatives_[it.first] != 0.0)){
+            auto av1 = get_av(distance.position_1);
+            auto av2 = get_av(distance.position_2);
+            if(model_gradients_.count(it.first) == 0){
+                model_gradients_[it.first] = av_distance_gradient(
+                        *av1, *av2, distance.forster_radius, distance.distance_type);
+            }
+            IMP::algebra::Vector3D g = model_gradients_[it.first];
+            g *= model_score_derivatives_[it.first];
+            IMP::core::XYZ(av1->get_source()).add_to_derivatives(g, *accum);
+            IMP::core::XYZ(av2->get_source()).add_to_derivatives(-g, *accum);
+        }
     }
+    cache_valid_ = lazy_evaluation_;
     return score;
 }
 
@@ -120,4 +291,29 @@ double AVNetworkRestraint::get_model_distance(
     return av_distance(*av1, *av2, forster_radius,distance_type, n_samples);
 }
 
+std::vector<double> get_av_network_scores(
+        const AVNetworkRestraints &restraints
+){
+    int n = (int) restraints.size();
+    std::set<IMP::Model*> models;
+    for(int i = 0; i < n; i++){
+        IMP_USAGE_CHECK(restraints[i]->get_av_updater() == nullptr,
+                        "Batched scoring of restraints with AV updater.");
+        IMP_USAGE_CHECK(models.insert(restraints[i]->get_model()).second,
+                        "Batched scoring of restraints of the same model.");
+    }
+    // The score states (e.g. of rigid bodies) update the coordinates of
+    // the sources and obstacles. Model::update is not thread-safe, thus
+    // the models are updated before the restraints are scored in parallel.
+    for(auto m : models){
+        m->update();
+    }
+    std::vector<double> scores(n, 0.0);
+    IMP_OMP_PRAGMA(parallel for schedule(dynamic))
+    for(int i = 0; i < n; i++){
+        scores[i] = restraints[i]->unprotected_evaluate(nullptr);
+    }
+    return scores;
+}
+
 IMPBFF_END_NAMESPACE
@@ -0,0 +1,171 @@
+/**
+ *  \file IMP/bff/AVNetworkScreener.h
+ *  \brief Screening of structures against a network of accessible volumes.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+#include <IMP/bff/AVNetworkScreener.h>
+
+#include <IMP/core/XYZ.h>
+#include <IMP/atom/pdb.h>
+#include <IMP/threads.h>
+
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+AVNetworkScreener::AVNetworkScreener(
+        std::string pdb_fn,
+        std::string fps_json_fn,
+        std::string score_set,
+        int n_samples,
+        int n_workers,
+        std::string name
+) : IMP::Object(name){
+    if(n_workers < 1){
+        n_workers = std::max(1, (int) IMP::get_number_of_threads());
+    }
+    // The PDB file is read once. The models of the workers are parsed
+    // from copies of its content.
+    std::ifstream pdb_file(pdb_fn);
+    IMP_USAGE_CHECK(pdb_file.good(), "Could not open file " << pdb_fn);
+    std::stringstream pdb_content;
+    pdb_content << pdb_file.rdbuf();
+    const std::string pdb = pdb_content.str();
+    for(int i = 0; i < n_workers; i++){
+        IMP_NEW(IMP::Model, m, ());
+        std::istringstream pdb_stream(pdb);
+        IMP::atom::Hierarchy hier = IMP::atom::read_pdb(pdb_stream, m);
+        IMP::ParticleIndexes leaves;
+        for(auto &h : IMP::atom::get_leaves(hier)){
+            leaves.emplace_back(h.get_particle_index());
+        }
+        IMP_NEW(AVNetworkRestraint, r, (hier, fps_json_fn,
+                "AVNetworkRestraint%1%", score_set, n_samples));
+        models_.emplace_back(m);
+        leaves_.emplace_back(leaves);
+        restraints_.emplace_back(r);
+    }
+    for(auto &d : restraints_[0]->get_used_distances()){
+        distance_names_.emplace_back(d.first);
+    }
+}
+
+void AVNetworkScreener::score_frame(int worker, const double *xyz, int frame){
+    IMP::Model* m = models_[worker];
+    const IMP::ParticleIndexes &leaves = leaves_[worker];
+    for(size_t i = 0; i < leaves.size(); i++){
+        IMP::core::XYZ(m, leaves[i]).set_coordinates(
+                IMP::algebra::Vector3D(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]));
+    }
+    scores_[frame] = restraints_[worker]->unprotected_evaluate(nullptr);
+    auto model_distances = restraints_[worker]->get_model_distances();
+    size_t n_distances = distance_names_.size();
+    for(size_t j = 0; j < n_distances; j++){
+        model_values_[frame * n_distances + j] = model_distances[distance_names_[j]];
+    }
+}
+
+std::vector<double> AVNetworkScreener::score_frames(
+        double *input, int n_input1, int n_input2
+){
+    IMP_USAGE_CHECK(n_input2 == get_number_of_coordinates(),
+                    "Number of coordinates of frames does not match the topology.");
+    int n_frames = n_input1;
+    int offset = get_number_of_frames();
+    int n_workers = get_number_of_workers();
+    size_t n_distances = distance_names_.size();
+    scores_.resize(offset + n_frames, 0.0);
+    model_values_.resize((offset + n_frames) * n_distances, 0.0);
+
+    // Frames are interleaved over the workers, so that each worker keeps
+    // its AVs and path maps.
+    IMP_OMP_PRAGMA(parallel for schedule(static, 1))
+    for(int w = 0; w < n_workers; w++){
+        for(int i = w; i < n_frames; i += n_workers){
+            score_frame(w, input + (size_t) i * n_input2, offset + i);
+        }
+    }
+    return std::vector<double>(scores_.begin() + offset, scores_.end());
+}
+
+void AVNetworkScreener::get_model_values(
+        double** output, int* n_output1, int* n_output2
+) const{
+    *n_output1 = get_number_of_frames();
+    *n_output2 = (int) distance_names_.size();
+    *output = (double*) malloc(model_values_.size() * sizeof(double));
+    std::copy(model_values_.begin(), model_values_.end(), *output);
+}
+
+void AVNetworkScreener::write(std::string filename) const{
+    size_t n_frames = scores_.size();
+    size_t n_distances = distance_names_.size();
+
+    // NumPy header of a structured array. The names are Python string
+    // literals. Headers with UTF-8 names are written in version 3.0.
+    bool utf8 = false;
+    auto get_literal = [&utf8](const std::string &n){
+        std::ostringstream l;
+        l << "'";
+        for(unsigned char c : n){
+            if((c == '\\') || (c == '\'')){
+                l << '\\' << c;
+            } else if((c < 0x20) || (c == 0x7f)){
+                const char *hex = "0123456789abcdef";
+                l << "\\x" << hex[c >> 4] << hex[c & 0xf];
+            } else{
+                if(c >= 0x80) utf8 = true;
+                l << c;
+            }
+        }
+        l << "'";
+        return l.str();
+    };
+    std::ostringstream descr;
+    descr << "{'descr': [('score', '<f8')";
+    for(auto &n : distance_names_){
+        descr << ", (" << get_literal(n) << ", '<f8')";
+    }
+    descr << "], 'fortran_order': False, 'shape': (" << n_frames << ",), }";
+    std::string header = descr.str();
+    // Magic (6), version (2), header length (2 in version 1.0, 4 in
+    // version 2.0); total aligned to 64 bytes
+    auto get_header_length = [&header](size_t prefix){
+        size_t total = prefix + header.size() + 1;
+        return header.size() + (64 - total % 64) % 64 + 1;
+    };
+    size_t prefix = 10;
+    if(utf8 || (get_header_length(prefix) > UINT16_MAX)){
+        // UTF-8 names (version 3.0) or too many distances for version 1.0
+        prefix = 12;
+    }
+    size_t header_len = get_header_length(prefix);
+    IMP_USAGE_CHECK(header_len <= UINT32_MAX, "Header of .npy file too long.");
+    header.append(header_len - header.size() - 1, ' ');
+    header.push_back('\n');
+
+    std::ofstream f(filename, std::ios::binary);
+    IMP_USAGE_CHECK(f.good(), "Could not open file " << filename);
+    f.write("\x93NUMPY", 6);
+    f.put((char) (utf8 ? 3 : (prefix == 10) ? 1 : 2));
+    f.put(0);
+    for(size_t i = 0; i < prefix - 8; i++){
+        f.put((char) ((header_len >> (8 * i)) & 0xff));
+    }
+    f.write(header.data(), header.size());
+    for(size_t i = 0; i < n_frames; i++){
+        f.write(reinterpret_cast<const char*>(&scores_[i]), sizeof(double));
+        f.write(reinterpret_cast<const char*>(&model_values_[i * n_distances]),
+                n_distances * sizeof(double));
+    }
+}
+
+
+IMPBFF_END_NAMESPACE
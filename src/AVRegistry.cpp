@@ -0,0 +1,102 @@
+/**
+ *  \file IMP/bff/AVRegistry.h
+ *  \brief Registry of accessible volumes shared in a model.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+#include <IMP/bff/AVRegistry.h>
+
+#include <IMP/atom/Hierarchy.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+AVRegistry::AVRegistry(
+        IMP::Model* m,
+        std::string name
+) : IMP::Object(name), model_(m){}
+
+AVRegistry* AVRegistry::get_registry(IMP::Model* m){
+    static const IMP::ModelKey key("bff AV registry");
+    if(m->get_has_data(key)){
+        return dynamic_cast<AVRegistry*>(m->get_data(key));
+    }
+    IMP_NEW(AVRegistry, registry, (m));
+    m->add_data(key, registry);
+    return registry;
+}
+
+AV* AVRegistry::get_av(
+        IMP::ParticleIndex source,
+        const IMP::algebra::VectorD<9> &parameter,
+        std::string name
+){
+    for(auto &av : avs_){
+        if((av->get_particle_index(0) == source) &&
+           ((av->get_parameter() - parameter).get_squared_magnitude() == 0.0)){
+            return av.get();
+        }
+    }
+
+    // Create new Particle for AV
+    IMP_NEW(IMP::Particle, av_particle, (model_));
+    av_particle->set_name(name);
+    IMP::ParticleIndex av_index = av_particle->get_index();
+    AV::do_setup_particle(model_, av_index, source);
+    avs_.emplace_back(new AV(model_, av_index));
+    avs_.back()->set_parameter(parameter);
+    outdated_.emplace_back(true);
+    // Particles that can be obstacles of the AV
+    auto h = IMP::atom::Hierarchy(model_, source);
+    for(auto &leaf : IMP::atom::get_leaves(IMP::atom::get_root(h))){
+        IMP::ParticleIndex pi = leaf.get_particle_index();
+        if(model_ps_set_.insert(pi).second){
+            model_ps_.emplace_back(pi);
+        }
+    }
+    return avs_.back().get();
+}
+
+AV* AVRegistry::get_registered_av(IMP::ParticleIndex av_pi) const{
+    for(auto &av : avs_){
+        if(av->get_particle_index() == av_pi){
+            return av.get();
+        }
+    }
+    return nullptr;
+}
+
+std::vector<bool> AVRegistry::update_avs(const std::vector<AV*> &avs){
+    std::vector<AV*> registered;
+    for(auto &av : avs_) registered.emplace_back(av.get());
+    std::vector<bool> changed = tracker_.update(model_, model_ps_, registered);
+    for(size_t i = 0; i < changed.size(); i++){
+        if(changed[i]) outdated_[i] = true;
+    }
+    std::vector<bool> resampled(avs.size(), false);
+    for(size_t j = 0; j < avs.size(); j++){
+        for(size_t i = 0; i < avs_.size(); i++){
+            if(avs_[i]->get_particle_index() != avs[j]->get_particle_index()) continue;
+            if(outdated_[i]){
+                avs_[i]->resample();
+                outdated_[i] = false;
+                resampled[j] = true;
+            }
+            break;
+        }
+    }
+    return resampled;
+}
+
+AVs AVRegistry::get_avs() const{
+    AVs out;
+    for(auto &av : avs_){
+        out.emplace_back(model_, av->get_particle_index());
+    }
+    return out;
+}
+
+
+IMPBFF_END_NAMESPACE
@@ -0,0 +1,86 @@
+/**
+ *  \file IMP/bff/AVUpdater.h
+ *  \brief Score state that resamples accessible volumes.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+#include <IMP/bff/AVUpdater.h>
+
+#include <algorithm>
+#include <set>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+AVUpdater::AVUpdater(
+        IMP::Model* m,
+        std::string name
+) : IMP::ScoreState(m, name), registry_(AVRegistry::get_registry(m)){}
+
+AV* AVUpdater::add_av(IMP::ParticleIndex av_pi){
+    AV* av = registry_->get_registered_av(av_pi);
+    IMP_USAGE_CHECK(av != nullptr, "AV is not registered in the AVRegistry of the model.");
+    if(std::find(avs_.begin(), avs_.end(), av) == avs_.end()){
+        avs_.emplace_back(av);
+    }
+    return av;
+}
+
+AVs AVUpdater::get_avs() const{
+    AVs out;
+    for(auto &a : avs_){
+        out.emplace_back(get_model(), a->get_particle_index());
+    }
+    return out;
+}
+
+unsigned AVUpdater::get_update_count(IMP::ParticleIndex av_pi) const{
+    for(auto &a : avs_){
+        if(a->get_particle_index() == av_pi){
+            return a->get_update_count();
+        }
+    }
+    return 0;
+}
+
+void AVUpdater::do_before_evaluate(){
+    if(lazy_evaluation_){
+        registry_->update_avs(avs_);
+    } else{
+        for(auto &a : avs_) a->resample();
+    }
+}
+
+void AVUpdater::do_after_evaluate(IMP::DerivativeAccumulator *){}
+
+IMP::ModelObjectsTemp AVUpdater::do_get_inputs() const{
+    // The AV particles are outputs. Listing them as inputs as well
+    // would make the updater depend on itself.
+    // Only the hierarchies of the labeling sites of the AVs of the
+    // updater are inputs (not of all AVs of the registry).
+    IMP::ModelObjectsTemp ret;
+    std::set<IMP::ParticleIndex> known;
+    IMP::Model* m = get_model();
+    for(auto &a : avs_){
+        auto h = IMP::atom::Hierarchy(m, a->get_particle_index(0));
+        for(auto &leaf : IMP::atom::get_leaves(IMP::atom::get_root(h))){
+            if(known.insert(leaf.get_particle_index()).second){
+                ret.push_back(leaf.get_particle());
+            }
+        }
+    }
+    return ret;
+}
+
+IMP::ModelObjectsTemp AVUpdater::do_get_outputs() const{
+    IMP::ModelObjectsTemp ret;
+    for(auto &a : avs_){
+        ret.push_back(a->get_particle());
+    }
+    return ret;
+}
+
+
+IMPBFF_END_NAMESPACE
@@ -0,0 +1,253 @@
+#include <IMP/bff/DecayBatchFit.h>
+
+#include <IMP/thread_macros.h>
+#include <IMP/threads.h>
+#include <IMP/bff/DecayLifetimeHandler.h>
+#include <IMP/bff/DecayPattern.h>
+#include <IMP/bff/DecayScale.h>
+#include <IMP/bff/DecayScore.h>
+#include <IMP/bff/DecayModel.h>
+#include <IMP/bff/DecayFit.h>
+
+#include <atomic>
+#include <cmath>
+#include <numeric>
+#include <cstdlib> /* malloc */
+
+IMPBFF_BEGIN_NAMESPACE
+
+namespace {
+// decays a worker takes at once from the queue of decays
+const int batch_block_size = 16;
+}
+
+/// Pipeline of a worker. Modifiers refer to the members of the worker,
+/// to the IRF, and to the linearization of the batch fit.
+struct DecayBatchFit::Worker {
+    DecayCurve data;
+    DecayCurve model;
+    DecayLifetimeHandler lifetime_handler;
+    DecayConvolution convolution;
+    DecayPattern scatter;
+    DecayPattern background;
+    DecayScale scale;
+    DecayScore score;
+    DecayModel decay_model;
+    DecayFit fit;
+
+    explicit Worker(DecayBatchFit &b) :
+            data(b.irf_.get_x(), std::vector<double>(b.irf_.size(), 0.0)),
+            model(b.irf_.get_x()),
+            lifetime_handler(b.lifetime_spectrum_),
+            convolution(&lifetime_handler, &b.irf_,
+                        b.convolution_method_, b.excitation_period_,
+                        b.irf_shift_channels_, b.irf_background_counts_,
+                        b.start_, b.stop_),
+            scatter(0.0, &b.irf_, b.scatter_fraction_, b.start_, b.stop_,
+                    b.scatter_fraction_ > 0.0),
+            background(b.constant_background_, nullptr, 0.0, b.start_, b.stop_),
+            scale(&data, b.constant_background_, b.start_, b.stop_),
+            score(&model, &data, b.score_type_, b.start_, b.stop_),
+            decay_model(&score, &lifetime_handler),
+            fit(&decay_model, b.max_iterations_, b.tolerance_)
+    {
+        // same order of modifiers as spectroscopy.decay.Decay
+        decay_model.add_modifier(&convolution);
+        decay_model.add_modifier(&scatter);
+        if(b.linearization_) decay_model.add_modifier(b.linearization_.get());
+        decay_model.add_modifier(&scale);
+        decay_model.add_modifier(&background);
+        fit.set_bounds(b.lower_bounds_, b.upper_bounds_);
+        fit.set_fixed(b.fixed_);
+    }
+};
+
+void DecayBatchFit::build_workers(){
+    // the shared tables are sized to the decays before the workers run,
+    // so that the modifiers only read them
+    if(linearization_) linearization_->get_linearization_table()->resize(irf_.size(), 1.0);
+    workers_.clear();
+    for(int w = 0; w < n_workers_; w++){
+        workers_.emplace_back(new Worker(*this));
+    }
+}
+
+void DecayBatchFit::fit_decay(int w, const double *input, int n_channels, int i){
+    Worker &wk = *workers_[w];
+    const double *y = input + (size_t) i * n_channels;
+    int n_parameters = get_number_of_parameters();
+    double *p = parameters_.data() + (size_t) i * n_parameters;
+    double n_photons = std::accumulate(y, y + n_channels, 0.0);
+    if(n_photons < min_number_of_photons_){
+        std::copy(lifetime_spectrum_.begin(), lifetime_spectrum_.end(), p);
+        return;
+    }
+    wk.data.set_y(const_cast<double*>(y), n_channels);
+    wk.lifetime_handler.set_lifetime_spectrum(lifetime_spectrum_);
+    scores_[i] = wk.fit.fit();
+    auto v = wk.fit.get_parameters();
+    std::copy(v.begin(), v.end(), p);
+    int n_iterations = wk.fit.get_number_of_iterations();
+    iterations_[i] = wk.fit.is_converged() ? n_iterations : -n_iterations;
+}
+
+int DecayBatchFit::get_number_of_channels() const{
+    return (int) irf_.size();
+}
+
+int DecayBatchFit::get_number_of_workers() const{
+    return n_workers_;
+}
+
+void DecayBatchFit::set_lifetime_spectrum(std::vector<double> v){
+    lifetime_spectrum_ = v;
+}
+
+std::vector<double> DecayBatchFit::get_lifetime_spectrum() const{
+    return lifetime_spectrum_;
+}
+
+int DecayBatchFit::get_number_of_parameters() const{
+    return (int) lifetime_spectrum_.size();
+}
+
+void DecayBatchFit::set_bounds(std::vector<double> lower, std::vector<double> upper){
+    lower_bounds_ = lower;
+    upper_bounds_ = upper;
+}
+
+void DecayBatchFit::set_fixed(std::vector<int> v){
+    fixed_ = v;
+}
+
+void DecayBatchFit::set_max_iterations(int v){
+    max_iterations_ = v;
+}
+
+int DecayBatchFit::get_max_iterations() const{
+    return max_iterations_;
+}
+
+void DecayBatchFit::set_tolerance(double v){
+    tolerance_ = v;
+}
+
+double DecayBatchFit::get_tolerance() const{
+    return tolerance_;
+}
+
+void DecayBatchFit::set_score_type(std::string v){
+    score_type_ = v;
+}
+
+std::string DecayBatchFit::get_score_type() const{
+    return score_type_;
+}
+
+void DecayBatchFit::set_scatter_fraction(double v){
+    scatter_fraction_ = v;
+}
+
+double DecayBatchFit::get_scatter_fraction() const{
+    return scatter_fraction_;
+}
+
+void DecayBatchFit::set_constant_background(double v){
+    constant_background_ = v;
+}
+
+double DecayBatchFit::get_constant_background() const{
+    return constant_background_;
+}
+
+void DecayBatchFit::set_min_number_of_photons(double v){
+    min_number_of_photons_ = v;
+}
+
+double DecayBatchFit::get_min_number_of_photons() const{
+    return min_number_of_photons_;
+}
+
+void DecayBatchFit::set_linearization_table(DecayCurve* linearization_table, int n_window){
+    if(linearization_table == nullptr){
+        linearization_.reset();
+    } else{
+        linearization_.reset(new DecayLinearization(
+                linearization_table, start_, stop_, true, n_window));
+    }
+}
+
+std::vector<double> DecayBatchFit::fit(double *input, int n_input1, int n_input2){
+    IMP_USAGE_CHECK(n_input2 == get_number_of_channels(),
+                    "Number of channels of the decays does not match the IRF.");
+    IMP_USAGE_CHECK(get_number_of_parameters() > 0, "Lifetime spectrum is empty.");
+    int n_decays = n_input1;
+    int n_parameters = get_number_of_parameters();
+    parameters_.assign((size_t) n_decays * n_parameters, 0.0);
+    scores_.assign(n_decays, NAN);
+    iterations_.assign(n_decays, 0);
+    build_workers();
+
+    // Workers take blocks of decays from a shared counter. The number of
+    // iterations differs between decays, so that static blocks would
+    // leave workers idle.
+    std::atomic<int> next(0);
+    IMP_OMP_PRAGMA(parallel for schedule(static, 1) num_threads(n_workers_))
+    for(int w = 0; w < n_workers_; w++){
+        for(int b = next.fetch_add(batch_block_size); b < n_decays;
+            b = next.fetch_add(batch_block_size)){
+            int e = std::min(b + batch_block_size, n_decays);
+            for(int i = b; i < e; i++){
+                fit_decay(w, input, n_input2, i);
+            }
+        }
+    }
+    return scores_;
+}
+
+void DecayBatchFit::get_parameters(double** output, int* n_output1, int* n_output2) const{
+    double *o = (double*) malloc(parameters_.size() * sizeof(double));
+    std::copy(parameters_.begin(), parameters_.end(), o);
+    *output = o;
+    *n_output1 = (int) scores_.size();
+    *n_output2 = get_number_of_parameters();
+}
+
+std::vector<double> DecayBatchFit::get_scores() const{
+    return scores_;
+}
+
+std::vector<int> DecayBatchFit::get_number_of_iterations() const{
+    return iterations_;
+}
+
+DecayBatchFit::DecayBatchFit(
+        DecayCurve* irf,
+        std::vector<double> lifetime_spectrum,
+        int convolution_method,
+        double excitation_period,
+        double irf_shift_channels,
+        double irf_background_counts,
+        int start, int stop,
+        std::string score_type,
+        int n_workers
+){
+    IMP_USAGE_CHECK(irf != nullptr, "IRF is not defined.");
+    irf_ = *irf;
+    set_lifetime_spectrum(lifetime_spectrum);
+    convolution_method_ = convolution_method;
+    excitation_period_ = excitation_period;
+    irf_shift_channels_ = irf_shift_channels;
+    irf_background_counts_ = irf_background_counts;
+    start_ = start;
+    stop_ = stop;
+    set_score_type(score_type);
+    if(n_workers < 1){
+        n_workers = std::max(1, (int) IMP::get_number_of_threads());
+    }
+    n_workers_ = n_workers;
+}
+
+DecayBatchFit::~DecayBatchFit() = default;
+
+IMPBFF_END_NAMESPACE
@@ -0,0 +1,230 @@
+#include <IMP/bff/DecayFit.h>
+
+#include <cmath>
+#include <Eigen/Dense>
+#include <IMP/bff/internal/Functions.h>
+#include <IMP/bff/internal/PhotonStatistics.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+namespace {
+// limits of the damping (Levenberg-Marquardt parameter)
+const double min_damping = 1e-12;
+const double max_damping = 1e12;
+}
+
+bool DecayFit::is_bounded(int i) const{
+    return (i < (int) lower_bounds_.size()) && (i < (int) upper_bounds_.size()) &&
+           (lower_bounds_[i] < upper_bounds_[i]);
+}
+
+void DecayFit::to_parameters(const std::vector<double>& internal, const std::vector<int>& free,
+                             std::vector<double>& parameters) const{
+    for(size_t k = 0; k < free.size(); k++){
+        int i = free[k];
+        double v = internal[k];
+        if(is_bounded(i)){
+            Functions::value2internal(&v, 1, lower_bounds_[i], upper_bounds_[i]);
+        }
+        parameters[i] = v;
+    }
+}
+
+double DecayFit::evaluate(std::vector<double>& parameters){
+    model_->get_lifetime_handler()->set_lifetime_spectrum(parameters);
+    return model_->score();
+}
+
+void DecayFit::set_model(DecayModel* v){
+    model_ = v;
+}
+
+DecayModel* DecayFit::get_model(){
+    return model_;
+}
+
+void DecayFit::set_bounds(std::vector<double> lower, std::vector<double> upper){
+    lower_bounds_ = lower;
+    upper_bounds_ = upper;
+}
+
+std::vector<double> DecayFit::get_lower_bounds() const{
+    return lower_bounds_;
+}
+
+std::vector<double> DecayFit::get_upper_bounds() const{
+    return upper_bounds_;
+}
+
+void DecayFit::set_fixed(std::vector<int> v){
+    fixed_ = v;
+}
+
+std::vector<int> DecayFit::get_fixed() const{
+    return fixed_;
+}
+
+void DecayFit::set_max_iterations(int v){
+    max_iterations_ = v;
+}
+
+int DecayFit::get_max_iterations() const{
+    return max_iterations_;
+}
+
+void DecayFit::set_tolerance(double v){
+    tolerance_ = v;
+}
+
+double DecayFit::get_tolerance() const{
+    return tolerance_;
+}
+
+double DecayFit::fit(){
+    IMP_USAGE_CHECK(model_ != nullptr, "Model is not defined.");
+    IMP_USAGE_CHECK(model_->get_score() != nullptr, "Score of the model is not defined.");
+    IMP_USAGE_CHECK(model_->get_lifetime_handler() != nullptr,
+                    "Lifetime handler of the model is not defined.");
+    auto lh = model_->get_lifetime_handler();
+    auto score = model_->get_score();
+    std::vector<double> p = lh->get_lifetime_spectrum();
+    int n = (int) p.size();
+
+    // free parameters in the internal representation
+    std::vector<int> free;
+    for(int i = 0; i < n; i++){
+        if((i < (int) fixed_.size()) && fixed_[i]) continue;
+        free.push_back(i);
+    }
+    int nf = (int) free.size();
+    std::vector<double> u(nf);
+    for(int k = 0; k < nf; k++){
+        int i = free[k];
+        double v = p[i];
+        if(is_bounded(i)){
+            double lb = lower_bounds_[i], ub = upper_bounds_[i];
+            double eps = 1e-9 * (ub - lb);
+            v = std::min(std::max(v, lb + eps), ub - eps);
+            p[i] = v;
+            Functions::internal2value(&v, 1, lb, ub);
+        }
+        u[k] = v;
+    }
+
+    double s = evaluate(p);
+    n_iterations_ = 0;
+    converged_ = false;
+    double damping = 1e-3;
+    std::vector<double> ut(nf), pt(p), scale(nf);
+    Eigen::MatrixXd H(nf, nf);
+    Eigen::VectorXd g(nf);
+    while((nf > 0) && (n_iterations_ < max_iterations_)){
+        n_iterations_++;
+        // derivatives of the model and of the score by the model counts
+        auto m = model_->get_model();
+        auto d = score->get_data();
+        int nc = (int) m->size();
+        jacobian_.assign((size_t) n * nc, 0.0);
+        model_->update_jacobian(jacobian_.data(), n, nc);
+        int start = (int) std::min(score->get_start(d), score->get_start(m));
+        int stop = (int) std::min(score->get_stop(d), score->get_stop(m));
+        gradient_.resize(nc);
+        curvature_.resize(nc);
+        std::string score_type = score->get_score_type();
+        statistics::chi2_counting_derivatives(
+                d->get_y(), m->get_y(), d->get_ey(), start, stop,
+                score_type.c_str(), gradient_.data(), curvature_.data()
+        );
+
+        // gradient and approximate Hessian of the score by the internal parameters
+        bool abs_spectrum = lh->get_abs_lifetime_spectrum();
+        for(int k = 0; k < nf; k++){
+            int i = free[k];
+            double sc = (abs_spectrum && (p[i] < 0)) ? -1.0 : 1.0;
+            if(is_bounded(i)){
+                double lb = lower_bounds_[i], ub = upper_bounds_[i];
+                sc *= (p[i] - lb) * (ub - p[i]) / ((ub - lb) * (ub - lb));
+            }
+            scale[k] = sc;
+        }
+        for(int k = 0; k < nf; k++){
+            double *jk = jacobian_.data() + (size_t) free[k] * nc;
+            double gk = 0.0;
+            for(int c = start; c < stop; c++) gk += jk[c] * gradient_[c];
+            g(k) = scale[k] * gk;
+            for(int l = 0; l <= k; l++){
+                double *jl = jacobian_.data() + (size_t) free[l] * nc;
+                double hkl = 0.0;
+                for(int c = start; c < stop; c++) hkl += jk[c] * curvature_[c] * jl[c];
+                H(k, l) = H(l, k) = scale[k] * scale[l] * hkl;
+            }
+        }
+        double max_diagonal = H.diagonal().maxCoeff();
+
+        // increase the damping until the score decreases
+        bool decreased = false;
+        while(damping < max_damping){
+            Eigen::MatrixXd A = H;
+            for(int k = 0; k < nf; k++){
+                double dk = (max_diagonal > 0) ? std::max(H(k, k), 1e-12 * max_diagonal) : 1.0;
+                A(k, k) += damping * dk;
+            }
+            Eigen::VectorXd delta = A.ldlt().solve(-g);
+            for(int k = 0; k < nf; k++) ut[k] = u[k] + delta(k);
+            to_parameters(ut, free, pt);
+            double st = evaluate(pt);
+            if(std::isfinite(st) && (st < s)){
+                converged_ = (s - st) <= tolerance_ * (std::abs(s) + tolerance_);
+                u = ut;
+                p = pt;
+                s = st;
+                damping = std::max(damping * 0.1, min_damping);
+                decreased = true;
+                break;
+            }
+            damping *= 10.0;
+        }
+        // no decrease within the smallest trust region: at a minimum
+        if(!decreased) converged_ = true;
+        if(converged_) break;
+    }
+
+    // model and lifetime spectrum at the optimum
+    score_ = evaluate(p);
+    parameters_ = p;
+    return score_;
+}
+
+double DecayFit::fit(double *input, int n_input){
+    IMP_USAGE_CHECK(model_ != nullptr, "Model is not defined.");
+    IMP_USAGE_CHECK(model_->get_lifetime_handler() != nullptr,
+                    "Lifetime handler of the model is not defined.");
+    model_->get_lifetime_handler()->set_lifetime_spectrum(
+            std::vector<double>(input, input + n_input)
+    );
+    return fit();
+}
+
+std::vector<double> DecayFit::get_parameters() const{
+    return parameters_;
+}
+
+double DecayFit::get_score() const{
+    return score_;
+}
+
+int DecayFit::get_number_of_iterations() const{
+    return n_iterations_;
+}
+
+bool DecayFit::is_converged() const{
+    return converged_;
+}
+
+DecayFit::DecayFit(DecayModel* model, int max_iterations, double tolerance){
+    set_model(model);
+    set_max_iterations(max_iterations);
+    set_tolerance(tolerance);
+}
+
+IMPBFF_END_NAMESPACE
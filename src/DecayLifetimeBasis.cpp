@@ -0,0 +1,120 @@
+#include <IMP/bff/DecayLifetimeBasis.h>
+
+#include <cstdlib> /* malloc */
+
+IMPBFF_BEGIN_NAMESPACE
+
+namespace {
+// channels per block of the matrix-vector product (the block of the fit
+// stays in the L1 cache)
+const int basis_block_size = 256;
+}
+
+void DecayLifetimeBasis::set_lifetimes(std::vector<double> v){
+    lifetimes_ = v;
+    basis_.clear();
+    n_channels_ = 0;
+    valid_ = false;
+}
+
+std::vector<double> DecayLifetimeBasis::get_lifetimes() const{
+    return lifetimes_;
+}
+
+int DecayLifetimeBasis::get_number_of_lifetimes() const{
+    return (int) lifetimes_.size();
+}
+
+int DecayLifetimeBasis::get_number_of_channels() const{
+    return n_channels_;
+}
+
+bool DecayLifetimeBasis::is_valid() const{
+    return valid_;
+}
+
+void DecayLifetimeBasis::compute(
+        double *irf, int n_irf,
+        double dt, double period,
+        int start, int stop
+){
+    int n_lifetimes = get_number_of_lifetimes();
+    n_channels_ = n_irf;
+    basis_.assign((size_t) n_lifetimes * n_irf, 0.0);
+    // unit amplitude decay per lifetime
+    std::vector<double> x(2 * n_lifetimes);
+    for(int k = 0; k < n_lifetimes; k++){
+        x[2 * k] = 1.0;
+        x[2 * k + 1] = lifetimes_[k];
+    }
+    // the irf values may have changed
+    workspace_.invalidate();
+    if((n_lifetimes > 0) && (n_irf > 0)){
+        if(period > 0.0){
+            decay_fconv_per_batch(basis_.data(), x.data(), irf, n_lifetimes, 1,
+                                  start, stop, n_irf, period, dt, &workspace_);
+        } else{
+            decay_fconv_batch(basis_.data(), x.data(), irf, n_lifetimes, 1,
+                              start, stop, n_irf, dt, &workspace_);
+        }
+    }
+    valid_ = true;
+}
+
+void DecayLifetimeBasis::evaluate(const double *amplitudes, double *fit) const{
+    int n_lifetimes = get_number_of_lifetimes();
+    int n = n_channels_;
+    std::fill(fit, fit + n, 0.0);
+    // lifetimes with non-zero amplitude
+    std::vector<int> nz;
+    nz.reserve(n_lifetimes);
+    for(int k = 0; k < n_lifetimes; k++)
+        if(amplitudes[k] != 0.0) nz.push_back(k);
+    int n_nz = (int) nz.size();
+    const double *basis = basis_.data();
+    for(int b0 = 0; b0 < n; b0 += basis_block_size){
+        int nb = std::min(basis_block_size, n - b0);
+        double *f = fit + b0;
+        // four rows per pass over the block (fewer loads and stores of fit)
+        int j = 0;
+        for(; j + 4 <= n_nz; j += 4){
+            double a0 = amplitudes[nz[j]], a1 = amplitudes[nz[j + 1]];
+            double a2 = amplitudes[nz[j + 2]], a3 = amplitudes[nz[j + 3]];
+            const double *r0 = basis + (size_t) nz[j] * n + b0;
+            const double *r1 = basis + (size_t) nz[j + 1] * n + b0;
+            const double *r2 = basis + (size_t) nz[j + 2] * n + b0;
+            const double *r3 = basis + (size_t) nz[j + 3] * n + b0;
+            for(int i = 0; i < nb; i++)
+                f[i] += (a0 * r0[i] + a1 * r1[i]) + (a2 * r2[i] + a3 * r3[i]);
+        }
+        for(; j < n_nz; j++){
+            double a = amplitudes[nz[j]];
+            const double *r = basis + (size_t) nz[j] * n + b0;
+            for(int i = 0; i < nb; i++) f[i] += a * r[i];
+        }
+    }
+}
+
+void DecayLifetimeBasis::evaluate(double *input, int n_input, double **output, int *n_output) const{
+    int n = n_channels_;
+    double *o = (double*) calloc(n, sizeof(double));
+    std::vector<double> a(get_number_of_lifetimes(), 0.0);
+    std::copy(input, input + std::min(n_input, (int) a.size()), a.begin());
+    evaluate(a.data(), o);
+    *output = o;
+    *n_output = n;
+}
+
+void DecayLifetimeBasis::get_basis(double **output, int *n_output1, int *n_output2) const{
+    double *o = (double*) malloc(basis_.size() * sizeof(double));
+    std::copy(basis_.begin(), basis_.end(), o);
+    *output = o;
+    *n_output1 = get_number_of_lifetimes();
+    *n_output2 = n_channels_;
+}
+
+DecayLifetimeBasis::DecayLifetimeBasis(std::vector<double> lifetimes){
+    set_lifetimes(lifetimes);
+}
+
+IMPBFF_END_NAMESPACE
@@ -23,6 +23,23 @@ void DecayLinearization::add(DecayCurve *out) {
     }
 }
 
+void DecayLinearization::add_jacobian(DecayCurve *out, double* jacobian, int n_parameters, int n_channels) {
+    if ((out != nullptr) && is_active()) {
+        DecayCurve *lt = get_linearization_table();
+        lt->resize(out->size(), 1.0);
+        size_t start, stop;
+        start = std::min(get_start(out), out->size());
+        stop = std::min(get_stop(out), std::min(out->size(), (size_t) n_channels));
+        for (int p = 0; p < n_parameters; p++) {
+            double *j = jacobian + (size_t) p * n_channels;
+            for (size_t i = start; i < stop; i++) {
+                j[i] *= lt->y[i];
+            }
+        }
+    }
+    add(out);
+}
+
 DecayLinearization::DecayLinearization(
         DecayCurve* linearization_table,
         int start, int stop,
@@ -0,0 +1,91 @@
+#include <IMP/bff/DecayModel.h>
+
+#include <cstdlib> /* malloc */
+
+IMPBFF_BEGIN_NAMESPACE
+
+void DecayModel::add_modifier(DecayModifier* v){
+    IMP_USAGE_CHECK(v != nullptr, "Modifier is not defined.");
+    modifiers_.push_back(v);
+}
+
+void DecayModel::clear_modifiers(){
+    modifiers_.clear();
+}
+
+int DecayModel::get_number_of_modifiers() const{
+    return (int) modifiers_.size();
+}
+
+DecayModifier* DecayModel::get_modifier(int i){
+    IMP_USAGE_CHECK((i >= 0) && (i < (int) modifiers_.size()),
+                    "Modifier index out of range.");
+    return modifiers_[i];
+}
+
+void DecayModel::set_score(DecayScore* v){
+    score_ = v;
+}
+
+DecayScore* DecayModel::get_score(){
+    return score_;
+}
+
+void DecayModel::set_lifetime_handler(DecayLifetimeHandler* v){
+    lifetime_handler_ = v;
+}
+
+DecayLifetimeHandler* DecayModel::get_lifetime_handler(){
+    return lifetime_handler_;
+}
+
+DecayCurve* DecayModel::get_model(){
+    if(score_ != nullptr) return score_->get_model();
+    return &default_model_;
+}
+
+int DecayModel::get_number_of_parameters(){
+    if(lifetime_handler_ == nullptr) return 0;
+    return (int) lifetime_handler_->get_lifetime_spectrum().size();
+}
+
+void DecayModel::update(){
+    auto m = get_model();
+    for(auto dm : modifiers_) dm->add(m);
+}
+
+double DecayModel::score(){
+    IMP_USAGE_CHECK(score_ != nullptr, "Score is not defined.");
+    update();
+    return score_->get_score();
+}
+
+double DecayModel::evaluate(double* input, int n_input){
+    IMP_USAGE_CHECK(lifetime_handler_ != nullptr, "Lifetime handler is not defined.");
+    lifetime_handler_->set_lifetime_spectrum(std::vector<double>(input, input + n_input));
+    return score();
+}
+
+void DecayModel::update_jacobian(double* jacobian, int n_parameters, int n_channels){
+    auto m = get_model();
+    for(auto dm : modifiers_) dm->add_jacobian(m, jacobian, n_parameters, n_channels);
+}
+
+void DecayModel::get_jacobian(double** output, int* n_output1, int* n_output2){
+    int n_parameters = get_number_of_parameters();
+    // the first modifier sets the number of channels of the model
+    update();
+    int n_channels = (int) get_model()->size();
+    double *o = (double*) calloc((size_t) n_parameters * n_channels, sizeof(double));
+    update_jacobian(o, n_parameters, n_channels);
+    *output = o;
+    *n_output1 = n_parameters;
+    *n_output2 = n_channels;
+}
+
+DecayModel::DecayModel(DecayScore* score, DecayLifetimeHandler* lifetime_handler){
+    set_score(score);
+    set_lifetime_handler(lifetime_handler);
+}
+
+IMPBFF_END_NAMESPACE
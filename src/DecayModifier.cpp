@@ -31,6 +31,27 @@ void DecayModifier::set(DecayCurve* data, int start, int stop, bool active){
     set_active(active);
 }
 
+void DecayModifier::add_jacobian(DecayCurve* out, double* jacobian, int n_parameters, int n_channels){
+    if((out == nullptr) || !is_active()) return;
+    DecayCurve y0(*out);
+    add(out);
+    int n = std::min(n_channels, (int) std::min(y0.size(), out->size()));
+    double y_max = 0.0;
+    for(int i = 0; i < n; i++) y_max = std::max(y_max, std::abs(y0.get_y()[i]));
+    for(int p = 0; p < n_parameters; p++){
+        double *j = jacobian + (size_t) p * n_channels;
+        double j_max = 0.0;
+        for(int i = 0; i < n; i++) j_max = std::max(j_max, std::abs(j[i]));
+        if(j_max == 0.0) continue;
+        // step along the row relative to the decay
+        double h = 1e-7 * ((y_max > 0.0) ? y_max : 1.0) / j_max;
+        DecayCurve yp(y0);
+        for(int i = 0; i < n; i++) yp.get_y()[i] += h * j[i];
+        add(&yp);
+        for(int i = 0; i < n; i++) j[i] = (yp.get_y()[i] - out->get_y()[i]) / h;
+    }
+}
+
 void DecayModifier::resize(size_t n, double v) {
     default_data->resize(n, v);
     if(data != nullptr){
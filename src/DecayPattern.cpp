@@ -58,6 +58,30 @@ void DecayPattern::add(DecayCurve* out) {
     }
 }
 
+void DecayPattern::add_jacobian(DecayCurve* out, double* jacobian, int n_parameters, int n_channels) {
+    if(out != nullptr && is_active()) {
+        resize(out->size());
+        int start = get_start(out);
+        int stop = std::min((int) get_stop(out), n_channels);
+        double f = get_pattern_fraction();
+        auto bg = get_pattern();
+        double fd = (1. - f);
+        double bs = 1.0;
+        if (f > 0.0) {
+            bs = std::accumulate(bg->y.begin() + start, bg->y.begin() + get_stop(out), 0.0);
+        }
+        for (int p = 0; p < n_parameters; p++) {
+            double *j = jacobian + (size_t) p * n_channels;
+            double fb = 0.0;
+            if (f > 0.0) fb = f * std::accumulate(j + start, j + stop, 0.0) / bs;
+            for (int i = start; i < stop; i++) {
+                j[i] = j[i] * fd + bg->y[i] * fb;
+            }
+        }
+    }
+    add(out);
+}
+
 DecayPattern::DecayPattern(
         double constant_offset,
         DecayCurve*pattern,
@@ -1,5 +1,27 @@
 #include <IMP/bff/DecayRoutines.h>
 
+#include <unsupported/Eigen/FFT>
+
+#include <atomic>
+
+#if defined(IMPBFF_SIMD_DISPATCH)
+ #if defined(_MSC_VER)
+   #include <intrin.h>
+ #endif
+ #include <immintrin.h>
+#endif
+
+// SIMD kernels are compiled for their instruction set only. The module
+// itself is compiled for the baseline and the kernels are selected at
+// runtime (see get_supported_simd_level).
+#if defined(IMPBFF_SIMD_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+ #define IMPBFF_TARGET_AVX2 __attribute__((target("avx2,fma")))
+ #define IMPBFF_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+ #define IMPBFF_TARGET_AVX2
+ #define IMPBFF_TARGET_AVX512
+#endif
+
 IMPBFF_BEGIN_NAMESPACE
 
 
@@ -61,11 +83,90 @@ void decay_rescale_w_bg(double *fit, double *decay, double *e_sq, double bg, dou
 }
 
 
+namespace{
+
+/* Kernels accumulate the convolved lifetimes in fit (fit is not zeroed). l2
+ * is the half-step irf (dt * 0.5 * lamp) for the channels [0, max(stop, stop1)).
+ * The periodic kernels convolve the first period up to stop1 and add the tail
+ * of the previous period to [start, stop). Scratch memory is taken from the
+ * workspace. */
+typedef void (*fconv_kernel)(
+        double *fit, const double *x, const double *l2, int numexp,
+        int start, int stop, double dt, DecayConvolutionWorkspace &ws);
+typedef void (*fconv_per_kernel)(
+        double *fit, const double *x, const double *l2, int numexp,
+        int start, int stop, int stop1, double period, double dt,
+        DecayConvolutionWorkspace &ws);
+/* Batch kernels: decays in the rows of fit (n_points columns) and lifetime
+ * spectra in the rows of x (2 * numexp columns). For period > 0 the tail of
+ * the previous period is added. */
+typedef void (*fconv_batch_kernel)(
+        double *fit, const double *x, const double *l2, int n_decays, int numexp,
+        int start, int stop, int stop1, int n_points, double period, double dt,
+        DecayConvolutionWorkspace &ws);
+
+
+/// Convolution stop of the first period. The period starts at the
+/// excitation pulse (first non-zero channel of the irf).
+int get_period_stop(const double *lamp, int n_points, double period, double dt){
+    int period_n = (int)ceil(period/dt-0.5);
+    int lamp_start = 0;
+    while((lamp_start < n_points) && (lamp[lamp_start++] == 0));
+    return std::min(period_n + lamp_start, n_points);
+}
+
+
+/// The workspace of a call (calls without workspace use a buffer per thread)
+DecayConvolutionWorkspace& get_workspace(DecayConvolutionWorkspace *workspace){
+    if (workspace != nullptr) return *workspace;
+    static thread_local DecayConvolutionWorkspace ws;
+    // the irf of the previous call may have changed
+    ws.invalidate();
+    return ws;
+}
+
+
+/// Smallest FFT length >= n that is a multiple of 4 and factors into 2, 3, and 5
+int get_fft_size(int n){
+    for (int m = std::max(1, (n + 3) / 4);; m++) {
+        int r = m;
+        while (r % 2 == 0) r /= 2;
+        while (r % 3 == 0) r /= 3;
+        while (r % 5 == 0) r /= 5;
+        if (r == 1) return 4 * m;
+    }
+}
+
+
+/// FFT of the thread (the plans are cached per FFT length)
+Eigen::FFT<double>& get_fft(){
+    static thread_local Eigen::FFT<double> fft;
+    fft.SetFlag(Eigen::FFT<double>::HalfSpectrum);
+    return fft;
+}
+
+
+/// Linear convolution of the first n channels of p with the irf (in the buffer of ws)
+double* fft_convolve(const double *p, int n, const double *lamp, int n_lamp, int n_period,
+                     int n_fft, DecayConvolutionWorkspace &ws){
+    auto &fft = get_fft();
+    int n_spectrum = n_fft / 2 + 1;
+    const std::complex<double> *irf_spectrum = ws.get_irf_spectrum(lamp, n_lamp, n_period, n_fft);
+    std::complex<double> *spectrum = ws.get_spectrum_buffer(n_spectrum);
+    double *b = ws.get_buffer(n_fft);
+    std::copy(p, p + n, b);
+    std::fill(b + n, b + n_fft, 0.0);
+    fft.fwd(spectrum, b, n_fft);
+    for (int k = 0; k < n_spectrum; k++) spectrum[k] *= irf_spectrum[k];
+    fft.inv(b, spectrum, n_fft);
+    return b;
+}
+
+
 // fast convolution - OK
-void decay_fconv(double *fit, double *x, double *lamp, int numexp, int start, int stop, double dt) {
-    std::vector<double> l2(stop);
+void fconv_scalar(double *fit, const double *x, const double *l2, int numexp, int start, int stop, double dt,
+                  DecayConvolutionWorkspace &) {
     start = std::max(1, start);
-    for (int i = 0; i < stop; i++) l2[i] = dt * 0.5 * lamp[i];
     /* convolution */
     for (int ne = 0; ne < numexp; ne++) {
         double expcurr = exp(-dt / x[2 * ne + 1]);
@@ -80,113 +181,29 @@ void decay_fconv(double *fit, double *x, double *lamp, int numexp, int start, in
 }
 
 
-// fast convolution AVX
-void decay_fconv_avx(double *fit, double *x, double *lamp, int numexp, int start, int stop, double dt) {
-#ifdef WITH_AVX
-    int start1 = std::max(1, start);
-
-    // make sure that there are always multiple of 4 in the lifetimes
-    const int chunk_size = 4; // the number of lifetimes per AVX register
-    int n_chunks = (int) std::ceil((double) numexp / chunk_size);
-    int n_ele = n_chunks * chunk_size;
-
-    // copy the interleaved lifetime spectrum to vectors
-    auto *p = (double *) _mm_malloc(n_ele * sizeof(double), 32);
-    std::fill(p, p + n_ele, 0.0);
-    for (int i = 0; i < numexp; i++) p[i] = x[2 * i + 0];
-
-    auto *ex = (double *) _mm_malloc(n_ele * sizeof(double), 32);
-    std::fill(ex, ex + n_ele, 0.0);
-    for (int i = 0; i < numexp; i++) ex[i] = exp(-dt / x[2 * i + 1]);
-
-    // precompute have lamp steps in units of dt
-    auto l2 = (double *) malloc(stop * sizeof(double));
-    for (int i = 0; i < stop; i++) l2[i] = dt * 0.5 * lamp[i];
-
-    std::fill(fit, fit + stop, 0.0);
-    __m256d e, a, fitcurr, l2p, l2c, tmp;
-    for (int ne = 0; ne < numexp; ne += chunk_size) {
-        // expcurr = exp(-dt / x[2 * ne + 1]);
-        e = _mm256_load_pd(&ex[ne]);
-        // amplitudes
-        a = _mm256_load_pd(&p[ne]);
-        // take care of first channel
-        // fit[0] += l2[0] * a;
-        l2c = _mm256_set1_pd(l2[0]);
-        tmp = _mm256_mul_pd(l2c, a);
-#ifdef _WIN32
-        fit[0] += double(tmp.m256d_f64[0]);
-        fit[0] += double(tmp.m256d_f64[1]);
-        fit[0] += double(tmp.m256d_f64[2]);
-        fit[0] += double(tmp.m256d_f64[3]);
-#else
-        fit[0] += tmp[0] + tmp[1] + tmp[2] + tmp[3];
-#endif
-        fitcurr = _mm256_set1_pd(0.0);
-        // convolution
-        for (int i = start1; i < stop; i++) {
-            l2p = _mm256_set1_pd(l2[i - 1]);
-            l2c = _mm256_set1_pd(l2[i]);
-            //fitcurr = (fitcurr + l2[i - 1]) * expcurr + l2[i];
-            fitcurr = _mm256_add_pd(fitcurr, l2p);
-#ifdef __FMA__
-            fitcurr = _mm256_fmadd_pd(fitcurr, e, l2c);
-#else
-            fitcurr = _mm256_mul_pd(fitcurr, e);
-    fitcurr = _mm256_add_pd(fitcurr, l2c);
-#endif
-            // fit[i] += fitcurr * a;
-            tmp = _mm256_mul_pd(fitcurr, a);
-#ifdef _WIN32
-            fit[i] += double(tmp.m256d_f64[0]);
-            fit[i] += double(tmp.m256d_f64[1]);
-            fit[i] += double(tmp.m256d_f64[2]);
-            fit[i] += double(tmp.m256d_f64[3]);
-#else
-            fit[i] += tmp[0] + tmp[1] + tmp[2] + tmp[3];
-#endif
-        }
-    }
-    _mm_free(ex); _mm_free(p); free(l2);
-#endif //WITH_AVX
-}
-
-
-
 /* fast convolution, high repetition rate */
-void decay_fconv_per(double *fit, double *x, double *lamp, int numexp, int start, int stop,
-               int n_points, double period, double dt)
+void fconv_per_scalar(double *fit, const double *x, const double *l2, int numexp, int start, int stop,
+               int stop1, double period, double dt, DecayConvolutionWorkspace &)
 {
-    stop = (stop < 0) ? n_points: stop;
     int period_n = (int)ceil(period/dt-0.5);
-
-    int lamp_start = 0;
-    while(lamp[lamp_start++]==0);
-
     int start1 = std::max(1, start);
-    int stop1 = std::min(period_n+lamp_start, n_points);
 
 #if IMPBFF_VERBOSE
     std::clog << "FCONV_PER" << std::endl;
     std::clog << "-- numexp:" << numexp << std::endl;
     std::clog << "-- start:" << start << std::endl;
     std::clog << "-- stop:" << stop << std::endl;
-    std::clog << "-- n_points:" << n_points << std::endl;
+    std::clog << "-- stop1:" << stop1 << std::endl;
     std::clog << "-- period:" << period << std::endl;
     std::clog << "-- dt:" << dt << std::endl;
 #endif
 
-    // Precompute everything needed for the convolution
-    // lamp * dt * 0.5
-    auto l2 = (double *) malloc(stop * sizeof(double));
-    for (int i = 0; i < stop; i++) l2[i] = dt * 0.5 * lamp[i];
-
     /* convolution */
     for (int ne=0; ne<numexp; ne++) {
         double expcurr = exp(-dt/x[2*ne+1]);
         double tail_a = 1./(1.-exp(-period/x[2*ne+1]));
         double fitcurr = 0;
-        fit[0] += (fitcurr + l2[0]);
+        fit[0] += l2[0] * x[2*ne];
         for (int i=start1; i<stop1; i++){
             fitcurr=(fitcurr + l2[i - 1])*expcurr + l2[i];
             fit[i] += fitcurr*x[2*ne];
@@ -197,136 +214,748 @@ void decay_fconv_per(double *fit, double *x, double *lamp, int numexp, int start
             fit[i] += fitcurr*x[2*ne]*tail_a;
         }
     }
-    free(l2);
 }
 
 
-// fast convolution, high repetition rate, AVX
-void decay_fconv_per_avx(double *fit, double *x, double *lamp, int numexp, int start, int stop,
-                   int n_points, double period, double dt) {
-#ifdef WITH_AVX
-#if IMPBFF_VERBOSE
-    std::clog << "FCONV_PER_AVX" << std::endl;
-    std::clog << "-- numexp: " << numexp << std::endl;
-    std::clog << "-- start: " << start << std::endl;
-    std::clog << "-- stop: " << stop << std::endl;
-    std::clog << "-- n_points: " << n_points << std::endl;
-    std::clog << "-- period: " << period << std::endl;
-    std::clog << "-- dt: " << dt << std::endl;
-#endif
+/* derivatives of fconv (period <= 0) and fconv_per by the lifetime spectrum */
+void fconv_jacobian(double *jacobian, const double *x, const double *l2, int numexp,
+                    int start, int stop, int stop1, int n_points, double period, double dt)
+{
+    int period_n = (int)ceil(period/dt-0.5);
+    int start1 = std::max(1, start);
+    for (int ne = 0; ne < numexp; ne++) {
+        double a = x[2 * ne];
+        double tau = x[2 * ne + 1];
+        double *ja = jacobian + (size_t) (2 * ne) * n_points;
+        double *jt = jacobian + (size_t) (2 * ne + 1) * n_points;
+        double expcurr = exp(-dt / tau);
+        double dexpcurr = expcurr * dt / (tau * tau);
+        // fitcurr and its derivative by tau
+        double fitcurr = 0.0, dfitcurr = 0.0;
+        ja[0] += l2[0];
+        for (int i = start1; i < stop1; i++) {
+            dfitcurr = dfitcurr * expcurr + (fitcurr + l2[i - 1]) * dexpcurr;
+            fitcurr = (fitcurr + l2[i - 1]) * expcurr + l2[i];
+            ja[i] += fitcurr;
+            jt[i] += dfitcurr * a;
+        }
+        if (period > 0.0) {
+            double m = (period_n - stop1 + start) * dt;
+            double s = exp(-m / tau);
+            double ds = s * m / (tau * tau);
+            double ep = exp(-period / tau);
+            double tail_a = 1. / (1. - ep);
+            double dtail_a = tail_a * tail_a * ep * period / (tau * tau);
+            dfitcurr = dfitcurr * s + fitcurr * ds;
+            fitcurr *= s;
+            for (int i = start; i < stop; i++) {
+                dfitcurr = dfitcurr * expcurr + fitcurr * dexpcurr;
+                fitcurr *= expcurr;
+                ja[i] += fitcurr * tail_a;
+                jt[i] += (dfitcurr * tail_a + fitcurr * dtail_a) * a;
+            }
+        }
+    }
+}
 
+
+/* batch convolution of decays sharing an irf (one decay after another) */
+void fconv_batch_scalar(double *fit, const double *x, const double *l2, int n_decays, int numexp,
+                        int start, int stop, int stop1, int n_points, double period, double dt,
+                        DecayConvolutionWorkspace &)
+{
+    int start1 = std::max(1, start);
+    int period_n = (int)ceil(period/dt-0.5);
+    for (int d = 0; d < n_decays; d++) {
+        double *f = fit + (size_t) d * n_points;
+        const double *xd = x + (size_t) d * 2 * numexp;
+        for (int ne = 0; ne < numexp; ne++) {
+            double a = xd[2 * ne];
+            double tau = xd[2 * ne + 1];
+            // padding of spectra with fewer lifetimes
+            if (a == 0.0) continue;
+            double expcurr = exp(-dt / tau);
+            double fitcurr = 0.0;
+            f[0] += l2[0] * a;
+            for (int i = start1; i < stop1; i++) {
+                fitcurr = (fitcurr + l2[i - 1]) * expcurr + l2[i];
+                f[i] += fitcurr * a;
+            }
+            if (period > 0.0) {
+                double tail_a = 1. / (1. - exp(-period / tau));
+                fitcurr *= exp(-(period_n - stop1 + start) * dt / tau);
+                for (int i = start; i < stop; i++) {
+                    fitcurr *= expcurr;
+                    f[i] += fitcurr * a * tail_a;
+                }
+            }
+        }
+    }
+}
+
+
+#if defined(IMPBFF_SIMD_DISPATCH)
+
+/// Lifetime spectrum split in zero padded arrays for SIMD registers
+/// (in the lifetime buffer of a workspace)
+struct PaddedLifetimes{
+    double *a, *ex, *scale, *tails;
+
+    PaddedLifetimes(const double *x, int numexp, int width, double dt, DecayConvolutionWorkspace &ws){
+        int n_ele = (numexp + width - 1) / width * width;
+        a = ws.get_lifetime_buffer(4 * n_ele);
+        ex = a + n_ele;
+        scale = ex + n_ele;
+        tails = scale + n_ele;
+        std::fill(a, a + 4 * n_ele, 0.0);
+        for (int i = 0; i < numexp; i++){
+            a[i] = x[2 * i];
+            ex[i] = exp(-dt / x[2 * i + 1]);
+        }
+    }
+
+    /// Scales and tails of periodic excitation (see fconv_per_scalar)
+    void set_periodic(const double *x, int numexp, int period_n, int stop1,
+                      int start, double period, double dt){
+        for (int i = 0; i < numexp; i++){
+            scale[i] = exp(-(period_n - stop1 + start) * dt / x[2 * i + 1]);
+            tails[i] = 1. / (1. - exp(-period / x[2 * i + 1]));
+        }
+    }
+};
+
+
+IMPBFF_TARGET_AVX2 inline double hsum_avx2(__m256d v){
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+
+// fast convolution AVX2
+IMPBFF_TARGET_AVX2
+void fconv_avx2(double *fit, const double *x, const double *l2, int numexp, int start, int stop, double dt,
+                DecayConvolutionWorkspace &ws) {
+    int start1 = std::max(1, start);
+    const int chunk_size = 4; // the number of lifetimes per AVX register
+    PaddedLifetimes lt(x, numexp, chunk_size, dt, ws);
+
+    __m256d e, a, fitcurr, l2p, l2c;
+    for (int ne = 0; ne < numexp; ne += chunk_size) {
+        e = _mm256_loadu_pd(&lt.ex[ne]);
+        a = _mm256_loadu_pd(&lt.a[ne]);
+        // take care of first channel
+        fit[0] += hsum_avx2(_mm256_mul_pd(_mm256_set1_pd(l2[0]), a));
+        fitcurr = _mm256_setzero_pd();
+        for (int i = start1; i < stop; i++) {
+            l2p = _mm256_set1_pd(l2[i - 1]);
+            l2c = _mm256_set1_pd(l2[i]);
+            //fitcurr = (fitcurr + l2[i - 1]) * expcurr + l2[i];
+            fitcurr = _mm256_fmadd_pd(_mm256_add_pd(fitcurr, l2p), e, l2c);
+            // fit[i] += fitcurr * a;
+            fit[i] += hsum_avx2(_mm256_mul_pd(fitcurr, a));
+        }
+    }
+}
+
+
+// fast convolution, high repetition rate, AVX2
+IMPBFF_TARGET_AVX2
+void fconv_per_avx2(double *fit, const double *x, const double *l2, int numexp, int start, int stop,
+                   int stop1, double period, double dt, DecayConvolutionWorkspace &ws) {
     int start1 = std::max(1, start);
-    stop = (stop < 0) ? n_points: stop;
-    // make sure that there are always multiple of the AVX register size
     const int chunk_size = 4; // the number of lifetimes per AVX register
-    int n_chunks = (int) std::ceil((double) numexp / chunk_size);
-    int n_ele = n_chunks * chunk_size;
 
     // Number of time channels in period
     int period_n = (int)ceil(period/dt-0.5);
 
-    // Check if the window is larger than the decay histogram.
-    // If it is larger only convolve till the end of the decay. Otherwise,
-    // convolve till end of period. The period starts at the excitation pulse.
-    // Find the position where the IRF starts
-    int lamp_start = 0;
-    while(lamp[lamp_start++] == 0);
-    int stop1 = std::min(period_n + lamp_start, n_points);
-
-    // Precompute everything needed for the convolution
-    // lamp * dt * 0.5
-    auto l2 = (double *) malloc(stop * sizeof(double));
-    for (int i = 0; i < stop; i++) l2[i] = dt * 0.5 * lamp[i];
-
-    // exponential
-    auto ex = (double *) _mm_malloc(n_ele * sizeof(double), 32);
-    std::fill(ex, ex + n_ele, 0.0);
-    for (int i = 0; i < numexp; i++) ex[i] = exp(-dt / x[2 * i + 1]);
-
-    // amplitudes
-    auto p = (double *) _mm_malloc(n_ele * sizeof(double), 32);
-    std::fill(p, p + n_ele, 0.0);
-    for (int i = 0; i < numexp; i++) p[i] = x[2 * i];
-
-    // scale of decay relative to tail
-    auto scale = (double *) _mm_malloc(n_ele * sizeof(double), 32);
-    std::fill(scale, scale + n_ele, 0.0);
-    for (int i = 0; i < numexp; i++) scale[i] = 
-        exp(-(period_n - stop1 + start) * dt / x[2 * i + 1]);
-
-    // // tails wrapping to next period
-    auto tails = (double *) _mm_malloc(n_ele * sizeof(double), 32);
-    std::fill(tails, tails + n_ele, 0.0);
-    for (int i = 0; i < numexp; i++) 
-        tails[i] = 1. / (1. - exp(-period / x[2 * i + 1]));
-
-    // CONVOLUTION
-    std::fill(fit, fit + n_points, 0.0);
-    __m256d fitcurr, l2p, l2c, a, e, s, t, tmp;
-    for (int ne = 0; ne < numexp; ne += chunk_size) {
-        e = _mm256_load_pd(&ex[ne]);     // expcurr = exp(-dt / x[2 * ne + 1]);
-        a = _mm256_load_pd(&p[ne]);      // amplitudes
-        s = _mm256_load_pd(&scale[ne]);  // scales
-        t = _mm256_load_pd(&tails[ne]);  // tails
+    PaddedLifetimes lt(x, numexp, chunk_size, dt, ws);
+    lt.set_periodic(x, numexp, period_n, stop1, start, period, dt);
 
-        // take care of first channel
-        // double fitcurr = 0;
-        fitcurr = _mm256_set1_pd(0.0);
-        // fit[0] += l2[0] * a;
-        l2c = _mm256_set1_pd(l2[0]);
-        tmp = _mm256_mul_pd(l2c, a);
-#ifdef _WIN32
-        fit[0] += double(tmp.m256d_f64[0]);
-        fit[0] += double(tmp.m256d_f64[1]);
-        fit[0] += double(tmp.m256d_f64[2]);
-        fit[0] += double(tmp.m256d_f64[3]);
-#else
-        fit[0] += tmp[0] + tmp[1] + tmp[2] + tmp[3];
-#endif
+    __m256d fitcurr, l2p, l2c, a, e, at;
+    for (int ne = 0; ne < numexp; ne += chunk_size) {
+        e = _mm256_loadu_pd(&lt.ex[ne]);
+        a = _mm256_loadu_pd(&lt.a[ne]);
+        at = _mm256_mul_pd(_mm256_loadu_pd(&lt.tails[ne]), a);
+        fit[0] += hsum_avx2(_mm256_mul_pd(_mm256_set1_pd(l2[0]), a));
+        fitcurr = _mm256_setzero_pd();
         for (int i = start1; i < stop1; i++) {
-            //fitcurr = (fitcurr + l2[i - 1]) * expcurr + l2[i];
             l2p = _mm256_set1_pd(l2[i - 1]);
             l2c = _mm256_set1_pd(l2[i]);
-            fitcurr = _mm256_add_pd(fitcurr, l2p);
-#ifdef __FMA__
-            fitcurr = _mm256_fmadd_pd(fitcurr, e, l2c);
-#else
-            fitcurr = _mm256_mul_pd(fitcurr, e);
-            fitcurr = _mm256_add_pd(fitcurr, l2c);
-#endif
-            // fit[i] += fitcurr * a;
-            tmp = _mm256_mul_pd(fitcurr, a);
-#ifdef _WIN32
-            fit[i] += double(tmp.m256d_f64[0]);
-            fit[i] += double(tmp.m256d_f64[1]);
-            fit[i] += double(tmp.m256d_f64[2]);
-            fit[i] += double(tmp.m256d_f64[3]);
-#else
-            fit[i] += tmp[0] + tmp[1] + tmp[2] + tmp[3];
-#endif
+            fitcurr = _mm256_fmadd_pd(_mm256_add_pd(fitcurr, l2p), e, l2c);
+            fit[i] += hsum_avx2(_mm256_mul_pd(fitcurr, a));
         }
-        // fitcurr *= scale[ne];
-        fitcurr = _mm256_mul_pd(fitcurr, s);
-        // tail
+        // tail wrapping to the next period
+        fitcurr = _mm256_mul_pd(fitcurr, _mm256_loadu_pd(&lt.scale[ne]));
         for (int i = start; i < stop; i++) {
-            //fitcurr *= e[ne];
             fitcurr = _mm256_mul_pd(fitcurr, e);
-            //fit[i] += fitcurr * a[ne] * tails[ne];
-            tmp = _mm256_mul_pd(t, a);
-            tmp = _mm256_mul_pd(fitcurr, tmp);
-#ifdef _WIN32
-            fit[i] += double(tmp.m256d_f64[0]);
-            fit[i] += double(tmp.m256d_f64[1]);
-            fit[i] += double(tmp.m256d_f64[2]);
-            fit[i] += double(tmp.m256d_f64[3]);
+            fit[i] += hsum_avx2(_mm256_mul_pd(fitcurr, at));
+        }
+    }
+}
+
+
+// fast convolution AVX-512
+IMPBFF_TARGET_AVX512
+void fconv_avx512(double *fit, const double *x, const double *l2, int numexp, int start, int stop, double dt,
+                  DecayConvolutionWorkspace &ws) {
+    int start1 = std::max(1, start);
+    const int chunk_size = 8; // the number of lifetimes per AVX-512 register
+    PaddedLifetimes lt(x, numexp, chunk_size, dt, ws);
+
+    __m512d e, a, fitcurr, l2p, l2c;
+    for (int ne = 0; ne < numexp; ne += chunk_size) {
+        e = _mm512_loadu_pd(&lt.ex[ne]);
+        a = _mm512_loadu_pd(&lt.a[ne]);
+        fit[0] += _mm512_reduce_add_pd(_mm512_mul_pd(_mm512_set1_pd(l2[0]), a));
+        fitcurr = _mm512_setzero_pd();
+        for (int i = start1; i < stop; i++) {
+            l2p = _mm512_set1_pd(l2[i - 1]);
+            l2c = _mm512_set1_pd(l2[i]);
+            fitcurr = _mm512_fmadd_pd(_mm512_add_pd(fitcurr, l2p), e, l2c);
+            fit[i] += _mm512_reduce_add_pd(_mm512_mul_pd(fitcurr, a));
+        }
+    }
+}
+
+
+// fast convolution, high repetition rate, AVX-512
+IMPBFF_TARGET_AVX512
+void fconv_per_avx512(double *fit, const double *x, const double *l2, int numexp, int start, int stop,
+                   int stop1, double period, double dt, DecayConvolutionWorkspace &ws) {
+    int start1 = std::max(1, start);
+    const int chunk_size = 8; // the number of lifetimes per AVX-512 register
+    int period_n = (int)ceil(period/dt-0.5);
+
+    PaddedLifetimes lt(x, numexp, chunk_size, dt, ws);
+    lt.set_periodic(x, numexp, period_n, stop1, start, period, dt);
+
+    __m512d fitcurr, l2p, l2c, a, e, at;
+    for (int ne = 0; ne < numexp; ne += chunk_size) {
+        e = _mm512_loadu_pd(&lt.ex[ne]);
+        a = _mm512_loadu_pd(&lt.a[ne]);
+        at = _mm512_mul_pd(_mm512_loadu_pd(&lt.tails[ne]), a);
+        fit[0] += _mm512_reduce_add_pd(_mm512_mul_pd(_mm512_set1_pd(l2[0]), a));
+        fitcurr = _mm512_setzero_pd();
+        for (int i = start1; i < stop1; i++) {
+            l2p = _mm512_set1_pd(l2[i - 1]);
+            l2c = _mm512_set1_pd(l2[i]);
+            fitcurr = _mm512_fmadd_pd(_mm512_add_pd(fitcurr, l2p), e, l2c);
+            fit[i] += _mm512_reduce_add_pd(_mm512_mul_pd(fitcurr, a));
+        }
+        fitcurr = _mm512_mul_pd(fitcurr, _mm512_loadu_pd(&lt.scale[ne]));
+        for (int i = start; i < stop; i++) {
+            fitcurr = _mm512_mul_pd(fitcurr, e);
+            fit[i] += _mm512_reduce_add_pd(_mm512_mul_pd(fitcurr, at));
+        }
+    }
+}
+
+/* Channel kernels (vertical): each lifetime is convolved separately and
+ * the lanes hold consecutive time channels. The recursion
+ * y[i] = e * y[i - 1] + b[i] with b[i] = e * l2[i - 1] + l2[i] is solved
+ * in a register by a prefix scan and a carry of the last channel. Thus,
+ * fit is updated with vector stores and no horizontal sums are needed.
+ * This is the faster kernel for few lifetimes (typical fits).
+ */
+
+/// Adds a * y[i] to fit[start1:stop] and returns y[stop - 1] (y[start1 - 1] = 0)
+IMPBFF_TARGET_AVX2
+double fconv_channels_avx2(double *fit, double a, double e, const double *l2, int start1, int stop){
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d e1 = _mm256_set1_pd(e);
+    const __m256d e2 = _mm256_set1_pd(e * e);
+    const __m256d ep = _mm256_setr_pd(e, e * e, e * e * e, e * e * e * e);
+    const __m256d av = _mm256_set1_pd(a);
+    __m256d carry = zero, b, s;
+    int i = start1;
+    for (; i + 4 <= stop; i += 4) {
+        b = _mm256_fmadd_pd(e1, _mm256_loadu_pd(l2 + i - 1), _mm256_loadu_pd(l2 + i));
+        // prefix scan: shift by one and by two channels
+        s = _mm256_blend_pd(_mm256_permute4x64_pd(b, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x1);
+        b = _mm256_fmadd_pd(e1, s, b);
+        s = _mm256_permute2f128_pd(b, b, 0x08);
+        b = _mm256_fmadd_pd(e2, s, b);
+        b = _mm256_fmadd_pd(ep, carry, b);
+        _mm256_storeu_pd(fit + i, _mm256_fmadd_pd(av, b, _mm256_loadu_pd(fit + i)));
+        carry = _mm256_permute4x64_pd(b, 0xFF);
+    }
+    double y = _mm_cvtsd_f64(_mm256_castpd256_pd128(carry));
+    for (; i < stop; i++) {
+        y = (y + l2[i - 1]) * e + l2[i];
+        fit[i] += y * a;
+    }
+    return y;
+}
+
+/// Adds c * e^(i - start + 1) to fit[start:stop]
+IMPBFF_TARGET_AVX2
+void fconv_decay_avx2(double *fit, double c, double e, int start, int stop){
+    __m256d p = _mm256_mul_pd(_mm256_set1_pd(c), _mm256_setr_pd(e, e * e, e * e * e, e * e * e * e));
+    const __m256d e4 = _mm256_set1_pd(e * e * e * e);
+    int i = start;
+    for (; i + 4 <= stop; i += 4) {
+        _mm256_storeu_pd(fit + i, _mm256_add_pd(_mm256_loadu_pd(fit + i), p));
+        p = _mm256_mul_pd(p, e4);
+    }
+    double v = _mm_cvtsd_f64(_mm256_castpd256_pd128(p));
+    for (; i < stop; i++) {
+        fit[i] += v;
+        v *= e;
+    }
+}
+
+/// Adds a * y[i] to fit[start1:stop] and returns y[stop - 1] (y[start1 - 1] = 0)
+IMPBFF_TARGET_AVX512
+double fconv_channels_avx512(double *fit, double a, double e, const double *l2, int start1, int stop){
+    const double e2 = e * e, e4 = e2 * e2;
+    const __m512d e1v = _mm512_set1_pd(e);
+    const __m512d e2v = _mm512_set1_pd(e2);
+    const __m512d e4v = _mm512_set1_pd(e4);
+    const __m512d ep = _mm512_set_pd(e4 * e4, e4 * e2 * e, e4 * e2, e4 * e, e4, e2 * e, e2, e);
+    const __m512d av = _mm512_set1_pd(a);
+    // lane indices of the shifts (lanes below the shift are zeroed)
+    const __m512i s1 = _mm512_set_epi64(6, 5, 4, 3, 2, 1, 0, 0);
+    const __m512i s2 = _mm512_set_epi64(5, 4, 3, 2, 1, 0, 0, 0);
+    const __m512i s4 = _mm512_set_epi64(3, 2, 1, 0, 0, 0, 0, 0);
+    const __m512i last = _mm512_set1_epi64(7);
+    __m512d carry = _mm512_setzero_pd(), b;
+    int i = start1;
+    for (; i + 8 <= stop; i += 8) {
+        b = _mm512_fmadd_pd(e1v, _mm512_loadu_pd(l2 + i - 1), _mm512_loadu_pd(l2 + i));
+        b = _mm512_fmadd_pd(e1v, _mm512_maskz_permutexvar_pd(0xFE, s1, b), b);
+        b = _mm512_fmadd_pd(e2v, _mm512_maskz_permutexvar_pd(0xFC, s2, b), b);
+        b = _mm512_fmadd_pd(e4v, _mm512_maskz_permutexvar_pd(0xF0, s4, b), b);
+        b = _mm512_fmadd_pd(ep, carry, b);
+        _mm512_storeu_pd(fit + i, _mm512_fmadd_pd(av, b, _mm512_loadu_pd(fit + i)));
+        carry = _mm512_permutexvar_pd(last, b);
+    }
+    double y = _mm_cvtsd_f64(_mm512_castpd512_pd128(carry));
+    for (; i < stop; i++) {
+        y = (y + l2[i - 1]) * e + l2[i];
+        fit[i] += y * a;
+    }
+    return y;
+}
+
+/// Adds c * e^(i - start + 1) to fit[start:stop]
+IMPBFF_TARGET_AVX512
+void fconv_decay_avx512(double *fit, double c, double e, int start, int stop){
+    const double e2 = e * e, e4 = e2 * e2;
+    __m512d p = _mm512_mul_pd(
+            _mm512_set1_pd(c),
+            _mm512_set_pd(e4 * e4, e4 * e2 * e, e4 * e2, e4 * e, e4, e2 * e, e2, e));
+    const __m512d e8 = _mm512_set1_pd(e4 * e4);
+    int i = start;
+    for (; i + 8 <= stop; i += 8) {
+        _mm512_storeu_pd(fit + i, _mm512_add_pd(_mm512_loadu_pd(fit + i), p));
+        p = _mm512_mul_pd(p, e8);
+    }
+    double v = _mm_cvtsd_f64(_mm512_castpd512_pd128(p));
+    for (; i < stop; i++) {
+        fit[i] += v;
+        v *= e;
+    }
+}
+
+/// Fast convolution with a channel kernel
+template <double (*channels)(double*, double, double, const double*, int, int)>
+void fconv_vertical(double *fit, const double *x, const double *l2, int numexp, int start, int stop, double dt,
+                    DecayConvolutionWorkspace &) {
+    int start1 = std::max(1, start);
+    for (int ne = 0; ne < numexp; ne++) {
+        double a = x[2 * ne];
+        double e = exp(-dt / x[2 * ne + 1]);
+        fit[0] += l2[0] * a;
+        channels(fit, a, e, l2, start1, stop);
+    }
+}
+
+/// Fast convolution, high repetition rate, with channel kernels
+template <double (*channels)(double*, double, double, const double*, int, int),
+          void (*decay)(double*, double, double, int, int)>
+void fconv_per_vertical(double *fit, const double *x, const double *l2, int numexp, int start, int stop,
+                        int stop1, double period, double dt, DecayConvolutionWorkspace &) {
+    int start1 = std::max(1, start);
+    int period_n = (int)ceil(period/dt-0.5);
+    for (int ne = 0; ne < numexp; ne++) {
+        double a = x[2 * ne];
+        double tau = x[2 * ne + 1];
+        double e = exp(-dt / tau);
+        double tail_a = 1. / (1. - exp(-period / tau));
+        fit[0] += l2[0] * a;
+        double y = channels(fit, a, e, l2, start1, stop1);
+        // tail wrapping to the next period
+        y *= exp(-(period_n - stop1 + start) * dt / tau);
+        decay(fit, y * a * tail_a, e, start, stop);
+    }
+}
+
+/* Batch kernels (lanes over decays): the lanes hold the same lifetime of
+ * consecutive decays. The half-step irf l2 is broadcast and all lanes run
+ * the recursion of the scalar kernel. The convolved decays are accumulated
+ * interleaved (channel major) and added to the rows of fit. Remaining
+ * decays that do not fill a register use the scalar kernel.
+ */
+
+IMPBFF_TARGET_AVX2
+void fconv_batch_avx2(double *fit, const double *x, const double *l2, int n_decays, int numexp,
+                      int start, int stop, int stop1, int n_points, double period, double dt,
+                      DecayConvolutionWorkspace &ws)
+{
+    const int w = 4;
+    const int nx = 2 * numexp;
+    int start1 = std::max(1, start);
+    int period_n = (int)ceil(period/dt-0.5);
+    int n = std::max(stop, stop1);
+    int n_groups = n_decays / w;
+    double *b = ws.get_buffer((size_t) n * w);
+    double a[w], e[w], s[w], c[w];
+    for (int g = 0; g < n_groups; g++) {
+        const double *xg = x + (size_t) g * w * nx;
+        std::fill(b, b + (size_t) n * w, 0.0);
+        for (int ne = 0; ne < numexp; ne++) {
+            for (int k = 0; k < w; k++) {
+                double tau = xg[k * nx + 2 * ne + 1];
+                a[k] = xg[k * nx + 2 * ne];
+                // padding of spectra with fewer lifetimes (tau may be zero)
+                if (a[k] == 0.0) {
+                    e[k] = s[k] = c[k] = 0.0;
+                    continue;
+                }
+                e[k] = exp(-dt / tau);
+                s[k] = (period > 0.0) ? exp(-(period_n - stop1 + start) * dt / tau) : 0.0;
+                c[k] = (period > 0.0) ? a[k] / (1. - exp(-period / tau)) : 0.0;
+            }
+            __m256d va = _mm256_loadu_pd(a);
+            __m256d ve = _mm256_loadu_pd(e);
+            __m256d y = _mm256_setzero_pd();
+            _mm256_storeu_pd(b, _mm256_fmadd_pd(_mm256_set1_pd(l2[0]), va, _mm256_loadu_pd(b)));
+            for (int i = start1; i < stop1; i++) {
+                // (y + l2[i - 1]) * e + l2[i] with the irf term off the dependency chain
+                __m256d t = _mm256_fmadd_pd(_mm256_set1_pd(l2[i - 1]), ve, _mm256_set1_pd(l2[i]));
+                y = _mm256_fmadd_pd(y, ve, t);
+                _mm256_storeu_pd(b + w * i, _mm256_fmadd_pd(y, va, _mm256_loadu_pd(b + w * i)));
+            }
+            if (period > 0.0) {
+                __m256d vc = _mm256_loadu_pd(c);
+                y = _mm256_mul_pd(y, _mm256_loadu_pd(s));
+                for (int i = start; i < stop; i++) {
+                    y = _mm256_mul_pd(y, ve);
+                    _mm256_storeu_pd(b + w * i, _mm256_fmadd_pd(y, vc, _mm256_loadu_pd(b + w * i)));
+                }
+            }
+        }
+        for (int k = 0; k < w; k++) {
+            double *f = fit + (size_t) (g * w + k) * n_points;
+            for (int i = 0; i < n; i++) f[i] += b[w * i + k];
+        }
+    }
+    int done = n_groups * w;
+    fconv_batch_scalar(fit + (size_t) done * n_points, x + (size_t) done * nx, l2, n_decays - done, numexp,
+                       start, stop, stop1, n_points, period, dt, ws);
+}
+
+IMPBFF_TARGET_AVX512
+void fconv_batch_avx512(double *fit, const double *x, const double *l2, int n_decays, int numexp,
+                        int start, int stop, int stop1, int n_points, double period, double dt,
+                        DecayConvolutionWorkspace &ws)
+{
+    const int w = 8;
+    const int nx = 2 * numexp;
+    int start1 = std::max(1, start);
+    int period_n = (int)ceil(period/dt-0.5);
+    int n = std::max(stop, stop1);
+    int n_groups = n_decays / w;
+    double *b = ws.get_buffer((size_t) n * w);
+    double a[w], e[w], s[w], c[w];
+    for (int g = 0; g < n_groups; g++) {
+        const double *xg = x + (size_t) g * w * nx;
+        std::fill(b, b + (size_t) n * w, 0.0);
+        for (int ne = 0; ne < numexp; ne++) {
+            for (int k = 0; k < w; k++) {
+                double tau = xg[k * nx + 2 * ne + 1];
+                a[k] = xg[k * nx + 2 * ne];
+                // padding of spectra with fewer lifetimes (tau may be zero)
+                if (a[k] == 0.0) {
+                    e[k] = s[k] = c[k] = 0.0;
+                    continue;
+                }
+                e[k] = exp(-dt / tau);
+                s[k] = (period > 0.0) ? exp(-(period_n - stop1 + start) * dt / tau) : 0.0;
+                c[k] = (period > 0.0) ? a[k] / (1. - exp(-period / tau)) : 0.0;
+            }
+            __m512d va = _mm512_loadu_pd(a);
+            __m512d ve = _mm512_loadu_pd(e);
+            __m512d y = _mm512_setzero_pd();
+            _mm512_storeu_pd(b, _mm512_fmadd_pd(_mm512_set1_pd(l2[0]), va, _mm512_loadu_pd(b)));
+            for (int i = start1; i < stop1; i++) {
+                __m512d t = _mm512_fmadd_pd(_mm512_set1_pd(l2[i - 1]), ve, _mm512_set1_pd(l2[i]));
+                y = _mm512_fmadd_pd(y, ve, t);
+                _mm512_storeu_pd(b + w * i, _mm512_fmadd_pd(y, va, _mm512_loadu_pd(b + w * i)));
+            }
+            if (period > 0.0) {
+                __m512d vc = _mm512_loadu_pd(c);
+                y = _mm512_mul_pd(y, _mm512_loadu_pd(s));
+                for (int i = start; i < stop; i++) {
+                    y = _mm512_mul_pd(y, ve);
+                    _mm512_storeu_pd(b + w * i, _mm512_fmadd_pd(y, vc, _mm512_loadu_pd(b + w * i)));
+                }
+            }
+        }
+        for (int k = 0; k < w; k++) {
+            double *f = fit + (size_t) (g * w + k) * n_points;
+            for (int i = 0; i < n; i++) f[i] += b[w * i + k];
+        }
+    }
+    int done = n_groups * w;
+    fconv_batch_scalar(fit + (size_t) done * n_points, x + (size_t) done * nx, l2, n_decays - done, numexp,
+                       start, stop, stop1, n_points, period, dt, ws);
+}
+
+#endif //IMPBFF_SIMD_DISPATCH
+
+
+/// Detects the instruction set level of the CPU (cpuid)
+int detect_simd_level(){
+#if defined(IMPBFF_SIMD_DISPATCH)
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return SIMD_SCALAR;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    if (!(osxsave && avx && fma)) return SIMD_SCALAR;
+    // the OS needs to save the YMM (and ZMM) registers
+    unsigned long long xcr0 = _xgetbv(0);
+    if ((xcr0 & 0x6) != 0x6) return SIMD_SCALAR;
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    bool avx512f = (info[1] & (1 << 16)) != 0;
+    if (avx512f && ((xcr0 & 0xe6) == 0xe6)) return SIMD_AVX512;
+    if (avx2) return SIMD_AVX2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+#endif
+#endif //IMPBFF_SIMD_DISPATCH
+    return SIMD_SCALAR;
+}
+
+
+/// Convolution kernels of an instruction set level
+struct FConvKernels{
+    int level;
+    /// Lifetimes per register of the lifetime kernels
+    int width;
+    /// Kernels with lifetimes in lanes (many lifetimes)
+    fconv_kernel fconv;
+    fconv_per_kernel fconv_per;
+    /// Kernels with time channels in lanes (fewer lifetimes than width)
+    fconv_kernel fconv_channels;
+    fconv_per_kernel fconv_per_channels;
+    /// Kernel with decays in lanes
+    fconv_batch_kernel fconv_batch;
+
+    fconv_kernel get_fconv(int numexp) const {
+        return (numexp < width) ? fconv_channels : fconv;
+    }
+
+    fconv_per_kernel get_fconv_per(int numexp) const {
+        return (numexp < width) ? fconv_per_channels : fconv_per;
+    }
+};
+
+#if defined(IMPBFF_SIMD_DISPATCH)
+const FConvKernels fconv_kernels_avx512 = {
+        SIMD_AVX512, 8, fconv_avx512, fconv_per_avx512,
+        fconv_vertical<fconv_channels_avx512>,
+        fconv_per_vertical<fconv_channels_avx512, fconv_decay_avx512>,
+        fconv_batch_avx512
+};
+
+const FConvKernels fconv_kernels_avx2 = {
+        SIMD_AVX2, 4, fconv_avx2, fconv_per_avx2,
+        fconv_vertical<fconv_channels_avx2>,
+        fconv_per_vertical<fconv_channels_avx2, fconv_decay_avx2>,
+        fconv_batch_avx2
+};
+#endif
+
+const FConvKernels fconv_kernels_scalar = {
+        SIMD_SCALAR, 1, fconv_scalar, fconv_per_scalar,
+        fconv_scalar, fconv_per_scalar,
+        fconv_batch_scalar
+};
+
+const FConvKernels& get_fconv_kernels(int level){
+#if defined(IMPBFF_SIMD_DISPATCH)
+    if (level >= SIMD_AVX512) return fconv_kernels_avx512;
+    if (level == SIMD_AVX2) return fconv_kernels_avx2;
 #else
-            fit[i] += tmp[0] + tmp[1] + tmp[2] + tmp[3];
+    (void) level;
 #endif
+    return fconv_kernels_scalar;
+}
+
+// Resolved once when the library is loaded. The level is atomic and the
+// kernel table is selected per call, so that set_simd_level does not
+// race with convolutions in other threads.
+std::atomic<int> simd_level(get_supported_simd_level());
+
+const FConvKernels& get_fconv_kernels(){
+    return get_fconv_kernels(simd_level.load(std::memory_order_relaxed));
+}
+
+}
+
+
+int get_supported_simd_level(){
+    static int level = detect_simd_level();
+    return level;
+}
+
+int get_simd_level(){
+    return get_fconv_kernels().level;
+}
+
+void set_simd_level(int level){
+    level = std::max((int) SIMD_SCALAR, std::min(level, get_supported_simd_level()));
+    simd_level.store(level, std::memory_order_relaxed);
+}
+
+
+const double* DecayConvolutionWorkspace::get_half_step_irf(const double *irf, int n, double dt){
+    if (!valid_ || (irf != irf_) || (dt != dt_) || ((size_t) n > n_half_step_irf_)) {
+        if (half_step_irf_.size() < (size_t) n) half_step_irf_.resize(n);
+        for (int i = 0; i < n; i++) half_step_irf_[i] = dt * 0.5 * irf[i];
+        n_half_step_irf_ = n;
+        irf_ = irf;
+        dt_ = dt;
+        valid_ = true;
+        n_updates_++;
+    }
+    return half_step_irf_.data();
+}
+
+double* DecayConvolutionWorkspace::get_lifetime_buffer(size_t n){
+    if (lifetimes_.size() < n) lifetimes_.resize(n);
+    return lifetimes_.data();
+}
+
+double* DecayConvolutionWorkspace::get_buffer(size_t n){
+    if (buffer_.size() < n) buffer_.resize(n);
+    return buffer_.data();
+}
+
+const std::complex<double>* DecayConvolutionWorkspace::get_irf_spectrum(
+        const double *irf, int n, int n_period, int n_fft){
+    if (!spectrum_valid_ || (irf != spectrum_irf_) || (n != spectrum_n_) ||
+        (n_period != spectrum_n_period_) || (n_fft != spectrum_n_fft_)) {
+        std::vector<double> b(n_fft, 0.0);
+        if (n_period > 0) {
+            for (int i = 0; i < n; i++) b[i % n_period] += irf[i];
+        } else {
+            std::copy(irf, irf + std::min(n, n_fft), b.begin());
         }
+        irf_spectrum_.resize(n_fft / 2 + 1);
+        get_fft().fwd(irf_spectrum_.data(), b.data(), n_fft);
+        spectrum_irf_ = irf;
+        spectrum_n_ = n;
+        spectrum_n_period_ = n_period;
+        spectrum_n_fft_ = n_fft;
+        spectrum_valid_ = true;
+        n_updates_++;
     }
-    free(l2); _mm_free(p); _mm_free(ex); _mm_free(scale); _mm_free(tails);
+    return irf_spectrum_.data();
+}
+
+std::complex<double>* DecayConvolutionWorkspace::get_spectrum_buffer(size_t n){
+    if (spectrum_.size() < n) spectrum_.resize(n);
+    return spectrum_.data();
+}
+
+
+void decay_fconv(double *fit, double *x, double *lamp, int numexp, int start, int stop, double dt,
+                 DecayConvolutionWorkspace *workspace) {
+    auto &ws = get_workspace(workspace);
+    const double *l2 = ws.get_half_step_irf(lamp, stop, dt);
+    get_fconv_kernels().get_fconv(numexp)(fit, x, l2, numexp, start, stop, dt, ws);
+}
+
+
+void decay_fconv_avx(double *fit, double *x, double *lamp, int numexp, int start, int stop, double dt,
+                     DecayConvolutionWorkspace *workspace) {
+    std::fill(fit, fit + stop, 0.0);
+    decay_fconv(fit, x, lamp, numexp, start, stop, dt, workspace);
+}
+
+
+void decay_fconv_per(double *fit, double *x, double *lamp, int numexp, int start, int stop,
+               int n_points, double period, double dt, DecayConvolutionWorkspace *workspace)
+{
+    stop = (stop < 0) ? n_points: stop;
+    int stop1 = get_period_stop(lamp, n_points, period, dt);
+    auto &ws = get_workspace(workspace);
+    const double *l2 = ws.get_half_step_irf(lamp, std::max(stop, stop1), dt);
+    get_fconv_kernels().get_fconv_per(numexp)(fit, x, l2, numexp, start, stop, stop1, period, dt, ws);
+}
 
-#endif //WITH_AVX
+
+void decay_fconv_per_avx(double *fit, double *x, double *lamp, int numexp, int start, int stop,
+                   int n_points, double period, double dt, DecayConvolutionWorkspace *workspace) {
+#if IMPBFF_VERBOSE
+    std::clog << "FCONV_PER_AVX" << std::endl;
+    std::clog << "-- simd_level: " << get_simd_level() << std::endl;
+#endif
+    std::fill(fit, fit + n_points, 0.0);
+    decay_fconv_per(fit, x, lamp, numexp, start, stop, n_points, period, dt, workspace);
+}
+
+
+void decay_fconv_jacobian(double *jacobian, double *x, double *lamp, int numexp,
+                          int start, int stop, int n_points, double dt,
+                          DecayConvolutionWorkspace *workspace) {
+    stop = (stop < 0) ? n_points : std::min(stop, n_points);
+    auto &ws = get_workspace(workspace);
+    const double *l2 = ws.get_half_step_irf(lamp, stop, dt);
+    fconv_jacobian(jacobian, x, l2, numexp, start, stop, stop, n_points, -1.0, dt);
+}
+
+
+void decay_fconv_per_jacobian(double *jacobian, double *x, double *lamp, int numexp,
+                              int start, int stop, int n_points, double period, double dt,
+                              DecayConvolutionWorkspace *workspace) {
+    stop = (stop < 0) ? n_points : std::min(stop, n_points);
+    int stop1 = get_period_stop(lamp, n_points, period, dt);
+    auto &ws = get_workspace(workspace);
+    const double *l2 = ws.get_half_step_irf(lamp, std::max(stop, stop1), dt);
+    fconv_jacobian(jacobian, x, l2, numexp, start, stop, stop1, n_points, period, dt);
+}
+
+
+void decay_fconv_batch(double *fit, double *x, double *lamp, int n_decays, int numexp,
+                       int start, int stop, int n_points, double dt,
+                       DecayConvolutionWorkspace *workspace) {
+    stop = (stop < 0) ? n_points : std::min(stop, n_points);
+    // half-step irf shared by all decays
+    auto &ws = get_workspace(workspace);
+    const double *l2 = ws.get_half_step_irf(lamp, stop, dt);
+    get_fconv_kernels().fconv_batch(fit, x, l2, n_decays, numexp, start, stop, stop, n_points, -1.0, dt, ws);
+}
+
+
+void decay_fconv_per_batch(double *fit, double *x, double *lamp, int n_decays, int numexp,
+                           int start, int stop, int n_points, double period, double dt,
+                           DecayConvolutionWorkspace *workspace) {
+    stop = (stop < 0) ? n_points : std::min(stop, n_points);
+    int stop1 = get_period_stop(lamp, n_points, period, dt);
+    // half-step irf shared by all decays
+    auto &ws = get_workspace(workspace);
+    const double *l2 = ws.get_half_step_irf(lamp, std::max(stop, stop1), dt);
+    get_fconv_kernels().fconv_batch(fit, x, l2, n_decays, numexp, start, stop, stop1, n_points, period, dt, ws);
 }
 
 
@@ -367,19 +996,20 @@ void decay_fconv_per_cs(double *fit, double *x, double *lamp, int numexp, int st
 
 /* fast convolution with reference compound decay */
 void decay_fconv_ref(double *fit, double *x, double *lamp, int numexp, int start, int stop, double tauref, double dt) {
-    double deltathalf = dt * 0.5, sum_a = 0;
-    for (int i = 0; i < stop; i++) fit[i] = 0;
-    /* convolution */
+    double sum_a = 0;
+    // lifetime spectrum with amplitudes corrected by the reference
+    std::vector<double> xr(2 * numexp);
     for (int ne = 0; ne < numexp; ne++) {
-        double expcurr = exp(-dt / x[2 * ne + 1]);
-        double correct_a = x[2 * ne] * (1 / tauref - 1 / x[2 * ne + 1]);
+        xr[2 * ne] = x[2 * ne] * (1 / tauref - 1 / x[2 * ne + 1]);
+        xr[2 * ne + 1] = x[2 * ne + 1];
         sum_a += x[2 * ne];
-        double fitcurr = 0;
-        for (int i = 1; i < stop; i++) {
-            fitcurr = (fitcurr + deltathalf * lamp[i - 1]) * expcurr + deltathalf * lamp[i];
-            fit[i] += fitcurr * correct_a;
-        }
     }
+    for (int i = 0; i < stop; i++) fit[i] = 0;
+    /* convolution */
+    auto &ws = get_workspace(nullptr);
+    const double *l2 = ws.get_half_step_irf(lamp, stop, dt);
+    get_fconv_kernels().get_fconv(numexp)(fit, xr.data(), l2, numexp, 1, stop, dt, ws);
+    fit[0] = 0;
     for (int i = 1; i < stop; i++) fit[i] += lamp[i] * sum_a;
 }
 
@@ -397,6 +1027,35 @@ void decay_sconv(double *fit, double *p, double *lamp, int start, int stop) {
 }
 
 
+void decay_fftconv(double *fit, double *p, double *lamp, int start, int stop,
+                   DecayConvolutionWorkspace *workspace) {
+    if (stop < 1) return;
+    auto &ws = get_workspace(workspace);
+    int n_fft = get_fft_size(2 * stop - 1);
+    const double *c = fft_convolve(p, stop, lamp, stop, 0, n_fft, ws);
+    // trapezoidal rule (see decay_sconv)
+    for (int i = std::max(1, start); i < stop; i++)
+        fit[i] = c[i] - 0.5 * (lamp[0] * p[i] + lamp[i] * p[0]);
+    fit[0] = 0;
+}
+
+
+void decay_fftconv_per(double *fit, double *p, double *lamp, int n_period,
+                       int start, int stop, int n_points,
+                       DecayConvolutionWorkspace *workspace) {
+    stop = (stop < 0) ? n_points : std::min(stop, n_points);
+    if ((n_period < 1) || (stop < 1)) return;
+    auto &ws = get_workspace(workspace);
+    // the linear convolution of one period is folded into the period
+    int n_fft = get_fft_size(2 * n_period - 1);
+    const double *c = fft_convolve(p, n_period, lamp, n_points, n_period, n_fft, ws);
+    for (int i = start; i < stop; i++) {
+        int k = i % n_period;
+        fit[i] = c[k] + c[k + n_period];
+    }
+}
+
+
 /* shifting lamp */
 void decay_shift_lamp(double *lampsh, double *lamp, double ts, int n_points, double out_value) {
     int tsint = (int) (floor(ts));
@@ -510,21 +1169,14 @@ void decay_fconv_per_cs_time_axis(
         double* lifetime_spectrum, int n_lifetime_spectrum,
         int convolution_start,
         int convolution_stop,
-        double period
+        double period,
+        DecayConvolutionWorkspace *workspace
 ){
     double dt = time_axis[1] - time_axis[0];
-#ifdef WITH_AVX
-    decay_fconv_per_avx(
-            model, lifetime_spectrum, irf, (int) n_lifetime_spectrum / 2,
-            convolution_start, convolution_stop, n_model, period, dt
-    );
-#endif //WITH_AVX
-#ifndef WITH_AVX
     decay_fconv_per(
         model, lifetime_spectrum, irf, (int) n_lifetime_spectrum / 2,
-        convolution_start, convolution_stop, n_model, period, dt
+        convolution_start, convolution_stop, n_model, period, dt, workspace
     );
-#endif //WITH_AVX
 }
 
 
@@ -535,27 +1187,17 @@ void decay_fconv_cs_time_axis(
         double *irf, int n_irf,
         double* lifetime_spectrum, int n_lifetime_spectrum,
         int convolution_start,
-        int convolution_stop
+        int convolution_stop,
+        DecayConvolutionWorkspace *workspace
 ){
     double dt = time_axis[1] - time_axis[0];
-#ifdef WITH_AVX
-    decay_fconv_avx(
-            output,
-            lifetime_spectrum,
-            irf,
-            (int) n_lifetime_spectrum / 2,
-            convolution_start, convolution_stop, dt
-    );
-#endif //WITH_AVX
-#ifndef WITH_AVX
     decay_fconv(
         output,
         lifetime_spectrum,
         irf,
         (int) n_lifetime_spectrum / 2,
-        convolution_start, convolution_stop, dt
+        convolution_start, convolution_stop, dt, workspace
     );
-#endif //WITH_AVX
 }
 
 IMPBFF_END_NAMESPACE
@@ -80,4 +80,47 @@ void DecayScale::add(DecayCurve* decay){
     }
 }
 
+void DecayScale::add_jacobian(DecayCurve* decay, double* jacobian, int n_parameters, int n_channels){
+    IMP_USAGE_CHECK(data != nullptr, "Experimental data not set - cannot scale model.");
+    if(is_active()){
+        auto d = get_data();
+        const double* model = decay->y.data();
+        const double* data = d->y.data();
+        const double* squared_data_weights = d->ey.data();
+        int start = (int) get_start(decay);
+        int stop = std::min((int) get_stop(decay), n_channels);
+        double bg = get_constant_background();
+        // scale = sum(w * f * (d - bg)) / sum(w * f * f) as in decay_rescale_w_bg
+        double sumnom = 0.0, sumdenom = 0.0;
+        for(int i = start; i < stop; i++){
+            if(data[i] > 0){
+                double iwsq = (squared_data_weights[i] * squared_data_weights[i] + 1e-12);
+                sumnom += model[i] * (data[i] - bg) * iwsq;
+                sumdenom += model[i] * model[i] * iwsq;
+            }
+        }
+        double scale = (sumdenom != 0.0) ? sumnom / sumdenom : 0.0;
+        for(int p = 0; p < n_parameters; p++){
+            double *j = jacobian + (size_t) p * n_channels;
+            double dnom = 0.0, ddenom = 0.0;
+            for(int i = start; i < stop; i++){
+                if(data[i] > 0){
+                    double iwsq = (squared_data_weights[i] * squared_data_weights[i] + 1e-12);
+                    dnom += j[i] * (data[i] - bg) * iwsq;
+                    ddenom += 2.0 * j[i] * model[i] * iwsq;
+                }
+            }
+            double dscale = (sumdenom != 0.0) ? (dnom - scale * ddenom) / sumdenom : 0.0;
+            for(int i = start; i < stop; i++){
+                j[i] = j[i] * scale + model[i] * dscale;
+            }
+            if(_blank_outside){
+                std::fill(j, j + start, 0.0);
+                std::fill(j + stop, j + n_channels, 0.0);
+            }
+        }
+    }
+    add(decay);
+}
+
 IMPBFF_END_NAMESPACE
\ No newline at end of file
@@ -60,6 +60,13 @@ void FPSReaderWriter::update_distances(){
         d.distance_type = DyePairMeasure_name_to_type[
                 distance.value("distance_type", "RDAMeanE")
         ];
+        // Distance distributions (pRDA)
+        d.distribution_axis = distance.value("distribution_axis", std::vector<double>());
+        d.distribution = distance.value("distribution", std::vector<double>());
+        d.distribution_error = distance.value("distribution_error", std::vector<double>());
+        d.distribution_weight = distance.value("distribution_weight", 1.0);
+        IMP_USAGE_CHECK(d.distribution.size() == d.distribution_axis.size(),
+                        "Distance distribution " << key << " and its axis differ in size.");
         distance_map[key] = d;
     }
 
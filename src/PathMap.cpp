@@ -8,6 +8,10 @@
  */
 #include <IMP/bff/PathMap.h>
 
+#include <map>
+#include <mutex>
+#include <tuple>
+
 IMPBFF_BEGIN_NAMESPACE
 
 PathMap::PathMap(
@@ -23,7 +27,10 @@ PathMap::PathMap(
 
 void PathMap::set_path_map_header(PathMapHeader &av_header, float resolution)
 {
+    pathMapHeader_ = av_header;
     header_ = *av_header.get_density_header();
+    // neighbor offsets depend on the grid dimensions
+    offsets_.reset();
     header_.compute_xyz_top(true);
     if(resolution < 0)
         resolution = av_header.get_simulation_grid_resolution();
@@ -127,10 +134,177 @@ void PathMap::find_path(
         }
     }
 
+    // Write back the path costs and accumulate the moments of the
+    // accessible density (avoids another pass over the grid)
+    reset_density_moments();
+    density_moment_origin_ = IMP::algebra::Vector3D(
+            x_loc_[path_begin_idx], y_loc_[path_begin_idx], z_loc_[path_begin_idx]);
+    const float grid_spacing = pathMapHeader_.get_simulation_grid_resolution();
+    const std::pair<float, float> bounds(0.0f, pathMapHeader_.get_max_path_length());
     for(int &idx : visited_idx){
         tiles[idx].cost = cost[idx];
+        float w = tiles[idx].get_value(
+                PM_TILE_ACCESSIBLE_DENSITY, bounds, "", grid_spacing);
+        if(w > 0){
+            Eigen::Vector3d r(
+                    x_loc_[idx] - density_moment_origin_[0],
+                    y_loc_[idx] - density_moment_origin_[1],
+                    z_loc_[idx] - density_moment_origin_[2]
+            );
+            n_accessible_++;
+            density_m0_ += w;
+            density_m1_ += w * r;
+            density_m2_ += w * r * r.transpose();
+        }
+    }
+
+}
+
+void PathMap::reset_density_moments(){
+    n_accessible_ = 0;
+    density_m0_ = 0.0;
+    density_m1_.setZero();
+    density_m2_.setZero();
+}
+
+void PathMap::weight_contact_volume(
+        double trapped_fraction,
+        float obstacle_threshold
+){
+    IMP_USAGE_CHECK(trapped_fraction >= 0.0 && trapped_fraction <= 1.0,
+                    "Trapped fraction must be in [0, 1].");
+    const long nvox = get_number_of_voxels();
+    const float grid_spacing = pathMapHeader_.get_simulation_grid_resolution();
+    const std::pair<float, float> bounds(0.0f, pathMapHeader_.get_max_path_length());
+
+    // 1. Moments of the accessible density in the contact volume
+    long cv_n = 0;
+    double cv_m0 = 0.0;
+    Eigen::Vector3d cv_m1 = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d cv_m2 = Eigen::Matrix3d::Zero();
+    for(long idx = 0; idx < nvox; idx++){
+        if(data_[idx] <= obstacle_threshold) continue;
+        float w = tiles[idx].get_value(
+                PM_TILE_ACCESSIBLE_DENSITY, bounds, "", grid_spacing);
+        if(w > 0){
+            Eigen::Vector3d r(
+                    x_loc_[idx] - density_moment_origin_[0],
+                    y_loc_[idx] - density_moment_origin_[1],
+                    z_loc_[idx] - density_moment_origin_[2]
+            );
+            cv_n++;
+            cv_m0 += w;
+            cv_m1 += w * r;
+            cv_m2 += w * r * r.transpose();
+        }
+    }
+    double free_m0 = density_m0_ - cv_m0;
+    if((cv_m0 <= 0.0) || (free_m0 <= 0.0)){
+        // no contact volume or no free volume
+        return;
+    }
+
+    // 2. Scale the densities of the contact and the free volume
+    double s_cv = trapped_fraction * density_m0_ / cv_m0;
+    double s_free = (1.0 - trapped_fraction) * density_m0_ / free_m0;
+    for(long idx = 0; idx < nvox; idx++){
+        tiles[idx].density *= (data_[idx] > obstacle_threshold) ? s_cv : s_free;
+    }
+
+    // Moments are linear in the densities
+    if(s_cv <= 0.0) n_accessible_ -= cv_n;
+    if(s_free <= 0.0) n_accessible_ = cv_n;
+    density_m1_ = s_cv * cv_m1 + s_free * (density_m1_ - cv_m1);
+    density_m2_ = s_cv * cv_m2 + s_free * (density_m2_ - cv_m2);
+}
+
+void PathMap::update_density_moments(){
+    const long nvox = get_number_of_voxels();
+    const float grid_spacing = pathMapHeader_.get_simulation_grid_resolution();
+    const std::pair<float, float> bounds(0.0f, pathMapHeader_.get_max_path_length());
+    reset_density_moments();
+    for(long idx = 0; idx < nvox; idx++){
+        float w = tiles[idx].get_value(
+                PM_TILE_ACCESSIBLE_DENSITY, bounds, "", grid_spacing);
+        if(w > 0){
+            Eigen::Vector3d r(
+                    x_loc_[idx] - density_moment_origin_[0],
+                    y_loc_[idx] - density_moment_origin_[1],
+                    z_loc_[idx] - density_moment_origin_[2]
+            );
+            n_accessible_++;
+            density_m0_ += w;
+            density_m1_ += w * r;
+            density_m2_ += w * r * r.transpose();
+        }
+    }
+}
+
+void PathMap::sample_obstacle_clearance(double max_distance){
+    // same grid as sample_obstacles
+    set_origin(pathMapHeader_.get_origin());
+    calc_all_voxel2loc();
+    const long nvox = get_number_of_voxels();
+    const int nx = header_.get_nx();
+    const int ny = header_.get_ny();
+    const int nz = header_.get_nz();
+    const double spacing = header_.get_spacing();
+    const IMP::algebra::Vector3D origin(
+            header_.get_xorigin(), header_.get_yorigin(), header_.get_zorigin());
+    obstacle_clearance_.resize(0);
+    obstacle_clearance_.resize(nvox, (float) max_distance);
+
+    // Only voxels in the bounding box of an obstacle plus the largest
+    // distance of interest are visited
+    auto clip = [](int v, int n){ return std::max(0, std::min(v, n - 1)); };
+    for(auto &p : xyzr_){
+        IMP::algebra::Vector3D c = p.get_coordinates();
+        double r = p.get_radius();
+        double reach = r + max_distance;
+        int lo[3], hi[3];
+        int n[3] = {nx, ny, nz};
+        for(int d = 0; d < 3; d++){
+            lo[d] = clip((int) std::floor((c[d] - reach - origin[d]) / spacing), n[d]);
+            hi[d] = clip((int) std::ceil((c[d] + reach - origin[d]) / spacing), n[d]);
+        }
+        for(int iz = lo[2]; iz <= hi[2]; iz++){
+            for(int iy = lo[1]; iy <= hi[1]; iy++){
+                for(int ix = lo[0]; ix <= hi[0]; ix++){
+                    long idx = ix + (long) nx * (iy + (long) ny * iz);
+                    double dx = x_loc_[idx] - c[0];
+                    double dy = y_loc_[idx] - c[1];
+                    double dz = z_loc_[idx] - c[2];
+                    float d = (float) (std::sqrt(dx * dx + dy * dy + dz * dz) - r);
+                    if(d < obstacle_clearance_[idx]) obstacle_clearance_[idx] = d;
+                }
+            }
+        }
     }
+}
+
+void PathMap::set_obstacles_from_clearance(double radius){
+    const long nvox = get_number_of_voxels();
+    IMP_USAGE_CHECK((long) obstacle_clearance_.size() == nvox,
+                    "Obstacle clearance is not sampled.");
+    for(long i = 0; i < nvox; i++){
+        data_[i] = (obstacle_clearance_[i] <= radius) ? 1.0 : 0.0;
+    }
+}
+
+IMP::algebra::Vector3D PathMap::get_accessible_density_mean() const{
+    if(density_m0_ <= 0.0){
+        return IMP::algebra::Vector3D(0.0, 0.0, 0.0);
+    }
+    Eigen::Vector3d m = density_m1_ / density_m0_;
+    return density_moment_origin_ + IMP::algebra::Vector3D(m[0], m[1], m[2]);
+}
 
+Eigen::Matrix3d PathMap::get_accessible_density_covariance() const{
+    if(density_m0_ <= 0.0){
+        return Eigen::Matrix3d::Zero();
+    }
+    Eigen::Vector3d m = density_m1_ / density_m0_;
+    return density_m2_ / density_m0_ - m * m.transpose();
 }
 
 void PathMap::update_tiles(
@@ -148,8 +322,7 @@ void PathMap::update_tiles(
         obstacle_threshold = pathMapHeader_.get_obstacle_threshold();    
 
     if(reset_tile_edges){
-        edge_computed.resize(0);
-        edge_computed.resize(false, nvox);
+        edge_computed.assign(nvox, false);
     }
 
     normalized_ = false;
@@ -165,18 +338,40 @@ void PathMap::update_tiles(
 
 }
 
+std::shared_ptr<const std::vector<int>> PathMap::get_shared_neighbor_idx_offsets(){
+    // The offsets only depend on the neighbor radius and the grid. Maps
+    // of the same grid (e.g. of AVs of replicas scored in parallel) share
+    // the offsets. Offsets that are not used by any map are freed.
+    using Key = std::tuple<double, int, int>;
+    static std::mutex mutex;
+    static std::map<Key, std::weak_ptr<const std::vector<int>>> shared;
+
+    const IMP::em::DensityHeader* header = get_header();
+    Key key(pathMapHeader_.get_neighbor_radius(), header->get_nx(), header->get_ny());
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const std::vector<int>> offsets = shared[key].lock();
+    if(!offsets){
+        for(auto it = shared.begin(); it != shared.end();){
+            if(it->second.expired()) it = shared.erase(it); else ++it;
+        }
+        offsets = std::make_shared<const std::vector<int>>(get_neighbor_idx_offsets());
+        shared[key] = offsets;
+    }
+    return offsets;
+}
+
 std::vector<PathMapTileEdge>& PathMap::get_edges(int tile_idx){
     auto tile = &tiles[tile_idx];
     if(!edge_computed[tile_idx]){
-        if(offsets_.empty()){
-            offsets_ = get_neighbor_idx_offsets();
+        if(!offsets_){
+            offsets_ = get_shared_neighbor_idx_offsets();
         }
         const float obstacle_threshold = pathMapHeader_.get_obstacle_threshold();
         auto header = get_header();
         int nx = header->get_nx();
         int ny = header->get_ny();
         int nz = header->get_nz();
-        tile->update_edges_2(nx, ny, nz, tiles, offsets_, obstacle_threshold);
+        tile->update_edges_2(nx, ny, nz, tiles, *offsets_, obstacle_threshold);
         edge_computed[tile_idx] = true;
     }
     return tiles[tile_idx].edges;
@@ -387,17 +582,26 @@ void PathMap::get_tile_values(
 }
 
 void PathMap::resize(unsigned int nvox){
-    data_.reset(new double[nvox]);
-
-    edge_computed.resize(0);
-    edge_computed.resize(nvox, false);
-
-    tiles.resize(0);
-    for(int i = 0; i < nvox; i++){
-        auto tile = PathMapTile(i);
-        tiles.emplace_back(tile);
+    edge_computed.assign(nvox, false);
+    // Buffers of grids with the same number of voxels are reused
+    if(!data_ || (tiles.size() != nvox)){
+        data_.reset(new double[nvox]);
+        tiles.clear();
+        tiles.reserve(nvox);
+        for(unsigned int i = 0; i < nvox; i++){
+            tiles.emplace_back(i);
+        }
     }
+}
 
+size_t PathMap::get_memory_usage() const{
+    size_t n = tiles.size();
+    size_t memory = n * (sizeof(double) + sizeof(PathMapTile) + sizeof(float)) +
+            (edge_computed.size() + visited.size()) / 8;
+    for(auto &tile : tiles){
+        memory += tile.edges.capacity() * sizeof(PathMapTileEdge);
+    }
+    return memory;
 }
 
 std::vector<PathMapTile>& PathMap::get_tiles(){
@@ -0,0 +1,94 @@
+/**
+ *  \file IMP/bff/PathMapPool.h
+ *  \brief Pool of path maps recycled between accessible volumes.
+ *
+ * \authors Thomas-Otavio Peulen
+ *  Copyright 2007-2022 IMP Inventors. All rights reserved.
+ *
+ */
+#include <IMP/bff/PathMapPool.h>
+
+IMPBFF_BEGIN_NAMESPACE
+
+
+PathMapPool::PathMapPool(
+        size_t max_idle_memory,
+        std::string name
+) : IMP::Object(name), max_idle_memory_(max_idle_memory){}
+
+PathMapPool* PathMapPool::get_default_pool(){
+    // Initialization of a function-local static is thread-safe
+    static IMP::Pointer<PathMapPool> pool = [](){
+        IMP::Pointer<PathMapPool> p = new PathMapPool();
+        p->set_was_used(true);
+        return p;
+    }();
+    return pool;
+}
+
+PathMap* PathMapPool::acquire(PathMapHeader &header){
+    std::lock_guard<std::mutex> lock(mutex_);
+    const IMP::em::DensityHeader* h = header.get_density_header();
+    for(auto it = idle_.begin(); it != idle_.end(); ++it){
+        PathMap* map = it->first;
+        const IMP::em::DensityHeader* mh = map->get_header();
+        // Maps referenced elsewhere are not reused
+        if((map->get_ref_count() == 1) &&
+           (mh->get_nx() == h->get_nx()) &&
+           (mh->get_ny() == h->get_ny()) &&
+           (mh->get_nz() == h->get_nz())){
+            IMP::Pointer<PathMap> r = it->first;
+            idle_memory_ -= it->second;
+            idle_.erase(it);
+            r->set_path_map_header(header);
+            n_reused_++;
+            return r.release();
+        }
+    }
+    n_allocated_++;
+    return new PathMap(header);
+}
+
+void PathMapPool::release(IMP::Pointer<PathMap> &map){
+    // The reference counts of maps are not atomic. The reference of the
+    // caller is moved under the lock, as acquire reads the counts.
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!map) return;
+    size_t memory = map->get_memory_usage();
+    idle_.emplace_front(map, memory);
+    map = nullptr;
+    idle_memory_ += memory;
+    evict();
+}
+
+size_t PathMapPool::get_number_of_idle_maps() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idle_.size();
+}
+
+size_t PathMapPool::get_idle_memory() const{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idle_memory_;
+}
+
+void PathMapPool::evict(){
+    while((idle_memory_ > max_idle_memory_) && !idle_.empty()){
+        idle_memory_ -= idle_.back().second;
+        idle_.pop_back();
+    }
+}
+
+void PathMapPool::clear(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+    idle_memory_ = 0;
+}
+
+void PathMapPool::set_maximum_idle_memory(size_t v){
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_idle_memory_ = v;
+    evict();
+}
+
+
+IMPBFF_END_NAMESPACE
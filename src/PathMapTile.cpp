@@ -70,7 +70,7 @@ void PathMapTile::update_edges(
 void PathMapTile::update_edges_2(
     int nx, int ny, int nz,
     std::vector<PathMapTile> &tiles,
-    std::vector<int> neighbor_idxs,
+    const std::vector<int> &neighbor_idxs,
     float tile_penalty_threshold
 ){
 
@@ -92,7 +92,7 @@ void PathMapTile::update_edges_2(
         PathMapTile* tile = &tiles[tile_idx];
         if(tile->penalty < tile_penalty_threshold){
             // edge_cost is a float stored in an 32bit int
-            float edge_cost = *(float*)&neighbor_idxs[i + 4];
+            float edge_cost = *(const float*)&neighbor_idxs[i + 4];
             edges.emplace_back(PathMapTileEdge(tile_idx, edge_cost));
         }
 
@@ -58,6 +58,66 @@ double statistics::chi2_counting(
     return chi2;
 }
 
+void statistics::chi2_counting_derivatives(
+        std::vector<double> &data,
+        std::vector<double> &model,
+        std::vector<double> &data_noise,
+        int x_min, int x_max,
+        const char* type,
+        double *gradient,
+        double *curvature
+){
+    double *d = data.data();
+    double *mu = model.data();
+    for(int i = x_min; i < x_max; i++){
+        gradient[i] = 0.0;
+        curvature[i] = 0.0;
+    }
+    if(strcmp(type, "neyman") == 0){
+        for(int i = x_min; i < x_max; i++){
+            double m = std::max(1., d[i]);
+            gradient[i] = 2. * (mu[i] - m) / m;
+            curvature[i] = 2. / m;
+        }
+    } else if(strcmp(type, "poisson") == 0){
+        for(int i = x_min; i < x_max; i++){
+            gradient[i] = (mu[i] < 0) ? -2. : 2.;
+            if(mu[i] > 1.) gradient[i] -= 2. * d[i] / mu[i];
+            // Fisher information of the Poisson deviance
+            curvature[i] = 2. / std::max(1., mu[i]);
+        }
+    } else if(strcmp(type, "pearson") == 0){
+        for(int i = x_min; i < x_max; i++){
+            if(mu[i] > 0) gradient[i] = d[i] / (mu[i] * mu[i]);
+        }
+    } else if(strcmp(type, "gauss") == 0){
+        for(int i = x_min; i < x_max; i++){
+            double m = d[i];
+            double mu_p = std::sqrt(.25 + m * m) - 0.5;
+            if(mu_p <= 1.e-12) continue;
+            double u = mu[i];
+            gradient[i] = 1. - m * m / (u * u) + 1. / u;
+            curvature[i] = std::max(0., 2. * m * m / (u * u * u) - 1. / (u * u));
+        }
+    } else if(strcmp(type, "cnp") == 0){
+        for(int i = x_min; i < x_max; i++){
+            double m = d[i];
+            if(m <= 1e-12) continue;
+            double u = mu[i];
+            double r = u - m;
+            gradient[i] = (2. * r / m + 2. * r * (u + m) / (u * u)) / 3.;
+            curvature[i] = (2. / m + 4. * m * m / (u * u * u)) / 3.;
+        }
+    } else{
+        double *e = data_noise.data();
+        for(int i = x_min; i < x_max; i++){
+            double w = 1. / (e[i] * e[i]);
+            gradient[i] = -2. * (d[i] - mu[i]) * w;
+            curvature[i] = 2. * w;
+        }
+    }
+}
+
 void init_fact()
 {
   double f = 1.;
@@ -102,3 +102,345 @@ class Tests(unittest.TestCase):
             experiment.append(d['distance'])
         np.testing.assert_almost_equal(model_ref, model, decimal=0)
         np.testing.assert_almost_equal(experiment_ref, experiment_ref, decimal=0)
+
+    def test_derivatives(self):
+        fps_json_path = IMP.bff.get_example_path("structure/T4L/fret.fps.json")
+        fret_restraint = IMP.bff.AVNetworkRestraint(
+            hier, str(fps_json_path),
+            score_set="chi2_C2_33p",
+            n_samples=10000
+        )
+        fret_restraint.evaluate(True)
+        avs = fret_restraint.get_used_avs()
+        g = [IMP.core.XYZ(av.get_source()).get_derivatives() for av in avs]
+        g = np.array([list(v) for v in g])
+        self.assertTrue(np.any(np.abs(g) > 0.0))
+
+        # gradient of the Gaussian distance by finite differences
+        av1, av2 = get_av(hier), get_av(hier, residue_index=55)
+        t = IMP.bff.DYE_PAIR_DISTANCE_MEAN
+        grad = np.array(IMP.bff.av_distance_gradient(av1, av2, 52.0, t))
+        d = np.array(av1.get_density_mean()) - np.array(av2.get_density_mean())
+        self.assertAlmostEqual(np.dot(grad, d / np.linalg.norm(d)), 1.0, places=1)
+
+    def test_derivatives_finite_differences(self):
+        # asymmetric errors: the error depends on the sign of the deviation
+        m = IMP.bff.AVPairDistanceMeasurement()
+        m.distance = 50.0
+        m.error_neg = 2.0
+        m.error_pos = 6.0
+        h = 1e-4
+        for model in (44.0, 47.0, 53.0, 58.0):
+            fd = (m.score_model(model + h) - m.score_model(model - h)) / (2 * h)
+            self.assertAlmostEqual(m.score_model_derivative(model), fd, places=4)
+
+        # accumulated derivatives of a source and a displaced source
+        fps_json_path = str(IMP.bff.get_example_path("structure/T4L/fret.fps.json"))
+        with open(fps_json_path) as fp:
+            fps = json.load(fp)
+        key = "5-44_C3"
+        d = dict(fps["Distances"][key])
+        d["distance_type"] = "Rmp"
+        d["error_neg"], d["error_pos"] = 2.0, 6.0
+        m = IMP.Model()
+        hier = IMP.atom.read_pdb(IMP.bff.get_example_path('structure/T4L/3GUN.pdb'), m)
+        with tempfile.TemporaryDirectory() as tmp:
+            fn = tmp + "/rmp.fps.json"
+            fps_rmp = dict(fps)
+            fps_rmp["χ²"] = {"rmp": {"distances": [key]}}
+            for distance in (10.0, 40.0):
+                d["distance"] = distance
+                fps_rmp["Distances"] = {key: d}
+                with open(fn, "w") as fp:
+                    json.dump(fps_rmp, fp)
+                r = IMP.bff.AVNetworkRestraint(hier, fn, score_set="rmp")
+                avs = dict([(av.get_name(), av) for av in r.get_used_avs()])
+                source = IMP.core.XYZ(avs[d["position1_name"]].get_source())
+                x0 = source.get_coordinates()
+                r.evaluate(True)
+                g = np.array(source.get_derivatives())
+                u = g / np.linalg.norm(g)
+                dx = 0.5
+                s = list()
+                for sign in (1.0, -1.0):
+                    source.set_coordinates(x0 + IMP.algebra.Vector3D(*(sign * dx * u)))
+                    s.append(r.evaluate(False))
+                source.set_coordinates(x0)
+                fd = (s[0] - s[1]) / (2 * dx)
+                self.assertAlmostEqual(fd, np.dot(g, u), delta=0.25 * abs(np.dot(g, u)))
+
+    def test_lazy_evaluation(self):
+        mdl = IMP.Model()
+        hier = IMP.atom.read_pdb(
+            IMP.bff.get_example_path('structure/T4L/3GUN.pdb'),
+            mdl
+        )
+        fps_json_path = IMP.bff.get_example_path("structure/T4L/fret.fps.json")
+        fret_restraint = IMP.bff.AVNetworkRestraint(
+            hier, str(fps_json_path),
+            score_set="chi2_C2_33p",
+            n_samples=10000
+        )
+        self.assertFalse(fret_restraint.get_lazy_evaluation())
+        fret_restraint.set_lazy_evaluation(True)
+        n_avs = len(fret_restraint.get_used_avs())
+        v1 = fret_restraint.unprotected_evaluate(None)
+        self.assertEqual(fret_restraint.get_number_of_updated_avs(), n_avs)
+
+        # nothing moved: score from cached terms
+        v2 = fret_restraint.unprotected_evaluate(None)
+        self.assertEqual(fret_restraint.get_number_of_updated_avs(), 0)
+        self.assertEqual(v1, v2)
+
+        # move a single atom close to one labeling site
+        av = fret_restraint.get_used_avs()[0]
+        xyz = IMP.core.XYZ(av.get_source())
+        xyz.set_coordinates(xyz.get_coordinates() + IMP.algebra.Vector3D(0.5, 0, 0))
+        fret_restraint.unprotected_evaluate(None)
+        n_updated = fret_restraint.get_number_of_updated_avs()
+        self.assertGreater(n_updated, 0)
+        self.assertLess(n_updated, n_avs)
+
+    def test_av_updater(self):
+        mdl = IMP.Model()
+        hier = IMP.atom.read_pdb(
+            IMP.bff.get_example_path('structure/T4L/3GUN.pdb'),
+            mdl
+        )
+        fps_json_path = str(IMP.bff.get_example_path("structure/T4L/fret.fps.json"))
+        updater = IMP.bff.AVUpdater(mdl)
+        self.assertFalse(updater.get_lazy_evaluation())
+        updater.set_lazy_evaluation(True)
+        r1 = IMP.bff.AVNetworkRestraint(hier, fps_json_path, score_set="chi2_C2_33p")
+        r2 = IMP.bff.AVNetworkRestraint(hier, fps_json_path, score_set="chi2_C1_33p")
+        r1.set_av_updater(updater)
+        r2.set_av_updater(updater)
+
+        # AVs of the same labeling sites are shared
+        n1, n2 = len(r1.get_used_avs()), len(r2.get_used_avs())
+        self.assertLessEqual(len(updater.get_avs()), n1 + n2)
+
+        # inputs are the particles of the hierarchy of the labeling sites
+        n_leaves = len(IMP.atom.get_leaves(hier))
+        self.assertEqual(len(updater.get_inputs()), n_leaves)
+        other = IMP.atom.read_pdb(
+            IMP.bff.get_example_path('structure/T4L/3GUN.pdb'),
+            mdl
+        )
+        IMP.bff.AVNetworkRestraint(other, fps_json_path, score_set="chi2_C2_33p")
+        self.assertEqual(len(updater.get_inputs()), n_leaves)
+
+        # the AVs are resampled once per model update
+        rs = IMP.RestraintSet(mdl)
+        rs.add_restraints([r1, r2])
+        rs.evaluate(False)
+        for av in updater.get_avs():
+            self.assertEqual(updater.get_update_count(av.get_particle_index()), 1)
+        rs.evaluate(False)
+        for av in updater.get_avs():
+            self.assertEqual(updater.get_update_count(av.get_particle_index()), 1)
+
+    def test_batched_scores(self):
+        fps_json_path = str(IMP.bff.get_example_path("structure/T4L/fret.fps.json"))
+        score_sets = ["chi2_C2_33p", "chi2_C3", "chi2_C2_1p"]
+        # the rigid body of the first model is moved by its score states
+        t = IMP.algebra.Transformation3D(
+            IMP.algebra.get_rotation_about_axis(IMP.algebra.Vector3D(0, 0, 1), 0.5),
+            IMP.algebra.Vector3D(10.0, -5.0, 3.0)
+        )
+
+        def get_restraints():
+            restraints, members = list(), list()
+            for i, score_set in enumerate(score_sets):
+                m = IMP.Model()
+                h = IMP.atom.read_pdb(
+                    IMP.bff.get_example_path('structure/T4L/3GUN.pdb'), m
+                )
+                if i == 0:
+                    rb = IMP.atom.create_rigid_body(h)
+                    members.append(IMP.core.XYZ(rb.get_member(0)))
+                    members.append(members[0].get_coordinates())
+                    IMP.core.transform(rb, t)
+                restraints.append(
+                    IMP.bff.AVNetworkRestraint(h, fps_json_path, score_set=score_set)
+                )
+            return restraints, members
+
+        restraints, (member, x0) = get_restraints()
+        scores = IMP.bff.get_av_network_scores(restraints)
+        self.assertEqual(len(scores), 3)
+        np.testing.assert_allclose(
+            member.get_coordinates(), t.get_transformed(x0), atol=1e-3
+        )
+
+        # reference: identical models scored serially
+        references, _ = get_restraints()
+        for s, r in zip(scores, references):
+            ref = r.evaluate(False)
+            self.assertAlmostEqual(s, ref, delta=0.05 * abs(ref) + 0.1)
+
+    def test_av_registry(self):
+        mdl = IMP.Model()
+        hier = IMP.atom.read_pdb(
+            IMP.bff.get_example_path('structure/T4L/3GUN.pdb'),
+            mdl
+        )
+        fps_json_path = str(IMP.bff.get_example_path("structure/T4L/fret.fps.json"))
+        r1 = IMP.bff.AVNetworkRestraint(hier, fps_json_path, score_set="chi2_C2_33p")
+        r2 = IMP.bff.AVNetworkRestraint(hier, fps_json_path, score_set="chi2_C1_33p")
+        avs1 = dict([(av.get_name(), av.get_particle_index()) for av in r1.get_used_avs()])
+        avs2 = dict([(av.get_name(), av.get_particle_index()) for av in r2.get_used_avs()])
+        for name in set(avs1) & set(avs2):
+            self.assertEqual(avs1[name], avs2[name])
+        registry = IMP.bff.AVRegistry.get_registry(mdl)
+        self.assertEqual(registry.get_number_of_avs(), len(set(avs1) | set(avs2)))
+
+        # AVs shared by the restraints are resampled once
+        r1.set_lazy_evaluation(True)
+        r2.set_lazy_evaluation(True)
+        r1.unprotected_evaluate(None)
+        r2.unprotected_evaluate(None)
+        for av in registry.get_avs():
+            self.assertEqual(av.get_update_count(), 1)
+
+        # settings made through a decorator are seen by all decorators
+        av = r1.get_used_avs()[0]
+        av.set_parameter_variants([10.0, 20.0], [3.5, 3.5])
+        self.assertEqual(r1.get_used_avs()[0].get_number_of_parameter_variants(), 2)
+        av.clear_parameter_variants()
+
+    def test_av_network_screener(self):
+        pdb_fn = str(IMP.bff.get_example_path('structure/T4L/3GUN.pdb'))
+        fps_json_path = str(IMP.bff.get_example_path("structure/T4L/fret.fps.json"))
+        screener = IMP.bff.AVNetworkScreener(
+            pdb_fn, fps_json_path, "chi2_C2_33p", n_workers=2
+        )
+        self.assertEqual(screener.get_number_of_workers(), 2)
+
+        mdl = IMP.Model()
+        hier = IMP.atom.read_pdb(pdb_fn, mdl)
+        restraint = IMP.bff.AVNetworkRestraint(hier, fps_json_path, score_set="chi2_C2_33p")
+        xyz = np.array([IMP.core.XYZ(h).get_coordinates() for h in IMP.atom.get_leaves(hier)]).flatten()
+        self.assertEqual(len(xyz), screener.get_number_of_coordinates())
+
+        # Translated frames have the same score
+        frames = np.array([xyz + 5.0 * i for i in range(4)])
+        scores = screener.score_frames(frames)
+        self.assertEqual(len(scores), 4)
+        ref = restraint.unprotected_evaluate(None)
+        for s in scores:
+            self.assertAlmostEqual(s, ref, delta=0.05 * abs(ref) + 0.1)
+
+        model_values = screener.get_model_values()
+        names = screener.get_distance_names()
+        self.assertEqual(model_values.shape, (4, len(names)))
+
+        with tempfile.TemporaryDirectory() as d:
+            fn = d + "/screen.npy"
+            screener.write(fn)
+            results = np.load(fn)
+            np.testing.assert_allclose(results['score'], scores)
+            for i, n in enumerate(names):
+                np.testing.assert_allclose(results[n], model_values[:, i])
+
+    def test_av_network_screener_names(self):
+        pdb_fn = str(IMP.bff.get_example_path('structure/T4L/3GUN.pdb'))
+        fps_json_path = str(IMP.bff.get_example_path("structure/T4L/fret.fps.json"))
+        with open(fps_json_path) as fp:
+            fps = json.load(fp)
+        # names that need to be escaped in the .npy header
+        key = "5-44_C3"
+        names = ["5-44'C3", "5-44\\C3", "5-44_χ²"]
+        fps["Distances"] = dict([(n, fps["Distances"][key]) for n in names])
+        fps["χ²"] = {"names": {"distances": names}}
+        with tempfile.TemporaryDirectory() as d:
+            fn = d + "/names.fps.json"
+            with open(fn, "w") as fp:
+                json.dump(fps, fp)
+            screener = IMP.bff.AVNetworkScreener(pdb_fn, fn, "names", n_workers=1)
+            mdl = IMP.Model()
+            hier = IMP.atom.read_pdb(pdb_fn, mdl)
+            xyz = np.array([IMP.core.XYZ(h).get_coordinates() for h in IMP.atom.get_leaves(hier)]).flatten()
+            scores = screener.score_frames(np.array([xyz]))
+            fn = d + "/screen.npy"
+            screener.write(fn)
+            results = np.load(fn)
+            self.assertEqual(sorted(results.dtype.names[1:]), sorted(screener.get_distance_names()))
+            self.assertEqual(sorted(results.dtype.names[1:]), sorted(names))
+            np.testing.assert_allclose(results['score'], scores)
+
+    def test_parameter_variants(self):
+        fps_json_path = str(IMP.bff.get_example_path("structure/T4L/fret.fps.json"))
+        m = IMP.Model()
+        h = IMP.atom.read_pdb(IMP.bff.get_example_path('structure/T4L/3GUN.pdb'), m)
+        r = IMP.bff.AVNetworkRestraint(h, fps_json_path, score_set="chi2_C2_33p")
+        names = [av.get_name() for av in r.get_used_avs()]
+        for n in names:
+            r.set_parameter_variants(n, [20.0], [3.5])
+        s1 = r.unprotected_evaluate(None)
+        # identical variants do not change the marginal score
+        for n in names:
+            r.set_parameter_variants(n, [20.0, 20.0], [3.5, 3.5], [0.5, 0.5])
+        s2 = r.unprotected_evaluate(None)
+        self.assertAlmostEqual(s1, s2, delta=0.05 * abs(s1) + 0.1)
+        # linker length uncertainty
+        for n in names:
+            r.set_parameter_variants(n, [15.0, 20.0, 25.0], [3.5, 3.5, 3.5])
+        s3 = r.unprotected_evaluate(None)
+        self.assertTrue(np.isfinite(s3))
+
+    def test_distance_distribution(self):
+        fps_json_path = str(IMP.bff.get_example_path("structure/T4L/fret.fps.json"))
+        with open(fps_json_path) as fp:
+            fps = json.load(fp)
+        key = "5-44_C3"
+        d = fps["Distances"][key]
+        m = IMP.Model()
+        h = IMP.atom.read_pdb(IMP.bff.get_example_path('structure/T4L/3GUN.pdb'), m)
+
+        # experimental distribution from the model
+        axis = np.arange(0.5, 100.0, 1.0)
+        r = IMP.bff.AVNetworkRestraint(h, fps_json_path, score_set="chi2_C3")
+        avs = dict([(av.get_name(), av) for av in r.get_used_avs()])
+        p_model = np.array(IMP.bff.av_distance_histogram(
+            avs[d["position1_name"]], avs[d["position2_name"]], list(axis)
+        ))
+        self.assertAlmostEqual(p_model.sum(), 1.0)
+
+        scores = list()
+        for shift in (0, 10):
+            fps_pda = dict(fps)
+            fps_pda["Distances"] = {key: dict(d)}
+            fps_pda["Distances"][key]["distance_type"] = "pRDA"
+            fps_pda["Distances"][key]["distribution_axis"] = list(axis)
+            fps_pda["Distances"][key]["distribution"] = list(np.roll(p_model, shift))
+            fps_pda["Distances"][key]["distribution_weight"] = 10.0
+            fps_pda["χ²"] = {"pda": {"distances": [key]}}
+            with tempfile.TemporaryDirectory() as tmp:
+                fn = tmp + "/pda.fps.json"
+                with open(fn, "w") as fp:
+                    json.dump(fps_pda, fp)
+                r_pda = IMP.bff.AVNetworkRestraint(h, fn, score_set="pda")
+                scores.append(r_pda.unprotected_evaluate(None))
+        self.assertLess(scores[0], 1.0)
+        self.assertLess(scores[0], scores[1])
+
+    def test_distance_distribution_chi2(self):
+        axis = np.arange(0.5, 10.0, 1.0)
+        p_exp = np.exp(-0.5 * (axis - 5.0)**2)
+        p_model = np.exp(-0.5 * (axis - 4.0)**2)
+        error = np.full(len(axis), 0.01)
+        m = IMP.bff.AVPairDistanceMeasurement()
+        m.distribution_axis = list(axis)
+        m.distribution = list(p_exp)
+        m.distribution_error = list(error)
+        dev = (p_model / p_model.sum() - p_exp / p_exp.sum()) / error
+        chi2 = 0.5 * np.sum(dev**2)
+        self.assertAlmostEqual(m.score_distribution(list(p_model)), chi2, places=6)
+        # the weight scales the chi2 and the divergence
+        m.distribution_weight = 10.0
+        self.assertAlmostEqual(m.score_distribution(list(p_model)), 10.0 * chi2, places=5)
+        m.distribution_error = []
+        kl = np.sum(p_exp / p_exp.sum() * np.log(
+            (p_exp / p_exp.sum()) / (p_model / p_model.sum())))
+        self.assertAlmostEqual(m.score_distribution(list(p_model)), 10.0 * kl, places=6)
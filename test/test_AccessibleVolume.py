@@ -87,6 +87,225 @@ class Tests(unittest.TestCase):
         ref = (0.31708, -25.513668, -1.132486)
         np.testing.assert_allclose(av_mp.get_coordinates(), ref, rtol=0.1)
 
+    def test_av_density_moments(self):
+        av1 = get_av(hier)
+        m = av1.get_map()
+        xyzd = np.array(m.get_xyz_density())
+        w = xyzd[:, 3]
+        self.assertEqual(m.get_number_of_accessible_voxels(), len(w))
+        self.assertAlmostEqual(m.get_accessible_density_sum(), w.sum(), places=2)
+        mean = np.average(xyzd[:, :3], weights=w, axis=0)
+        np.testing.assert_allclose(m.get_accessible_density_mean(), mean, atol=1e-3)
+        cov = np.cov(xyzd[:, :3].T, aweights=w, bias=True)
+        np.testing.assert_allclose(np.array(av1.get_covariance()), cov, atol=1e-2)
+
+    def test_av_obstacle_clearance(self):
+        av1 = get_av(hier)
+        m = av1.get_map()
+        c = np.array(m.get_obstacle_clearance())
+        self.assertEqual(len(c), m.get_number_of_voxels())
+        idx = range(0, len(c), 7)
+        # the obstacles of the dye radius are a threshold of the clearance
+        r = av_parameter["radii"][0]
+        mask = np.array([m.get_value(i) > 0 for i in idx])
+        np.testing.assert_array_equal(mask, c[idx] <= r)
+        # same obstacles as the sampling with the map kernel
+        m.sample_obstacles(r)
+        mask = np.array([m.get_value(i) > 0 for i in idx])
+        np.testing.assert_array_equal(mask, c[idx] <= r)
+
+    def test_av_contact_volume(self):
+        av1 = get_av(hier)
+        p = dict(av_parameter)
+        p["contact_volume_thickness"] = 2.0
+        p["contact_volume_trapped_fraction"] = 0.5
+        av2 = get_av(hier, av_parameter=p)
+        m1, m2 = av1.get_map(), av2.get_map()
+        # contact volume preserves the accessible density
+        self.assertEqual(
+            m1.get_number_of_accessible_voxels(),
+            m2.get_number_of_accessible_voxels()
+        )
+        self.assertAlmostEqual(
+            m1.get_accessible_density_sum(),
+            m2.get_accessible_density_sum(),
+            places=2
+        )
+        xyzd = np.array(m2.get_xyz_density())
+        mean = np.average(xyzd[:, :3], weights=xyzd[:, 3], axis=0)
+        np.testing.assert_allclose(m2.get_accessible_density_mean(), mean, atol=1e-3)
+        # resampling does not accumulate the weights
+        av2.resample()
+        xyzd_2 = np.array(m2.get_xyz_density())
+        np.testing.assert_allclose(xyzd, xyzd_2)
+
+    def test_av_parameter_variants(self):
+        av_ref = get_av(hier)
+        n_ref = len(av_ref.get_xyz_density())
+
+        av = get_av(hier)
+        av.set_parameter_variants([10.0, 15.0, 20.0], [3.5, 3.5, 3.5])
+        av.resample()
+        self.assertEqual(av.get_number_of_parameter_variants(), 3)
+        n = [len(av.get_xyz_density(i)) for i in range(3)]
+        # nested linker lengths share one path search
+        self.assertLess(n[0], n[1])
+        self.assertLess(n[1], n[2])
+        # the variants use the obstacles of a single AV
+        self.assertAlmostEqual(n[2] / n_ref, 1.0, delta=0.05)
+
+        # larger dye radii remove more tiles
+        av.set_parameter_variants([20.0, 20.0], [2.0, 4.0], [0.3, 0.7])
+        av.resample()
+        self.assertGreater(len(av.get_xyz_density(0)), len(av.get_xyz_density(1)))
+        self.assertAlmostEqual(av.get_parameter_variant_weight(1), 0.7)
+
+        av.clear_parameter_variants()
+        av.resample()
+        self.assertEqual(av.get_number_of_parameter_variants(), 0)
+        self.assertEqual(len(av.get_xyz_density()), n_ref)
+
+    def test_path_map_pool(self):
+        pool = IMP.bff.PathMapPool.get_default_pool()
+        pool.clear()
+        av1 = get_av(hier)
+        n_ref = len(av1.get_xyz_density())
+        av1.release_map()
+        self.assertFalse(av1.get_has_map())
+        self.assertEqual(pool.get_number_of_idle_maps(), 1)
+        # the density is kept after releasing the map
+        self.assertEqual(len(av1.get_xyz_density()), n_ref)
+
+        # an AV with the same parameters recycles the grid
+        n_reused = pool.get_number_of_reused_maps()
+        av2 = get_av(hier, residue_index=55)
+        av2.resample()
+        self.assertEqual(pool.get_number_of_reused_maps(), n_reused + 1)
+        self.assertEqual(pool.get_number_of_idle_maps(), 0)
+
+        # idle maps are freed above the memory cap
+        av2.release_map()
+        self.assertGreater(pool.get_idle_memory(), 0)
+        max_memory = pool.get_maximum_idle_memory()
+        pool.set_maximum_idle_memory(0)
+        self.assertEqual(pool.get_number_of_idle_maps(), 0)
+        pool.set_maximum_idle_memory(max_memory)
+
+        # the map is reacquired on resample
+        av1.resample()
+        self.assertTrue(av1.get_has_map())
+        self.assertEqual(len(av1.get_xyz_density()), n_ref)
+
+    def test_av_cache(self):
+        cache = IMP.bff.AVCache()
+        av1 = get_av(hier)
+        p1 = np.array(cache.get_xyz_density(av1))
+        self.assertEqual(cache.get_number_of_misses(), 1)
+        self.assertTrue(cache.get_is_cached(av1))
+        p2 = np.array(cache.get_xyz_density(av1))
+        self.assertEqual(cache.get_number_of_hits(), 1)
+        np.testing.assert_allclose(p1, p2, atol=1e-3)
+        # AVs consult their cache on resample
+        av3 = get_av(hier)
+        av3.set_cache(cache)
+        av3.resample()
+        self.assertEqual(cache.get_number_of_hits(), 2)
+        np.testing.assert_allclose(np.array(av3.get_xyz_density()), p1, atol=1e-3)
+        # different AV parameters are different entries
+        p = dict(av_parameter)
+        p["linker_length"] = 15.0
+        av2 = get_av(hier, av_parameter=p)
+        self.assertFalse(cache.get_is_cached(av2))
+        cache.get_xyz_density(av2)
+        self.assertEqual(cache.get_number_of_entries(), 2)
+        # LRU eviction under memory budget
+        cache.set_memory_budget(cache.get_memory_usage() - 1)
+        self.assertEqual(cache.get_number_of_entries(), 1)
+        self.assertTrue(cache.get_is_cached(av2))
+
+    def test_av_cache_transformed(self):
+        m = IMP.Model()
+        h = IMP.atom.read_pdb(IMP.bff.get_example_path('structure/T4L/3GUN.pdb'), m)
+        sel = IMP.atom.Selection(h)
+        sel.set_atom_type(IMP.atom.AtomType("CB"))
+        sel.set_residue_index(132)
+        source = sel.get_selected_particles()[0]
+        av_p = IMP.Particle(m)
+        IMP.bff.AV.do_setup_particle(m, av_p, source, **av_parameter)
+        av = IMP.bff.AV(m, av_p)
+        cache = IMP.bff.AVCache()
+        p_ref = np.array(cache.get_xyz_density(av))
+        self.assertEqual(cache.get_number_of_misses(), 1)
+
+        # the AV is stored in the local frame of the labeling site, thus
+        # a rigidly transformed structure hits the cache
+        t = IMP.algebra.Transformation3D(
+            IMP.algebra.get_rotation_about_axis(IMP.algebra.Vector3D(1, 1, 0), 0.7),
+            IMP.algebra.Vector3D(12.0, -4.0, 7.0)
+        )
+        for leaf in IMP.atom.get_leaves(h):
+            xyz = IMP.core.XYZ(leaf)
+            xyz.set_coordinates(t.get_transformed(xyz.get_coordinates()))
+        av.resample()
+        self.assertEqual(cache.get_number_of_hits(), 1)
+        self.assertEqual(cache.get_number_of_misses(), 1)
+        p = np.array(av.get_xyz_density())
+        self.assertEqual(p.shape, p_ref.shape)
+        xyz_ref = np.array([t.get_transformed(IMP.algebra.Vector3D(*v[:3])) for v in p_ref])
+        np.testing.assert_allclose(p[:, :3], xyz_ref, atol=1e-4)
+        np.testing.assert_allclose(p[:, 3], p_ref[:, 3])
+
+    def test_av_rigid_body_mode(self):
+        mdl = IMP.Model()
+        hier = IMP.atom.read_pdb(
+            IMP.bff.get_example_path('structure/T4L/3GUN.pdb'),
+            mdl
+        )
+        rb = IMP.atom.create_rigid_body(hier)
+        av_p = IMP.Particle(mdl)
+        sel = IMP.atom.Selection(hier)
+        sel.set_atom_type(IMP.atom.AtomType("CB"))
+        sel.set_residue_index(132)
+        source = sel.get_selected_particles()[0]
+        IMP.bff.AV.do_setup_particle(mdl, av_p, source, **av_parameter)
+        av = IMP.bff.AV(mdl, av_p)
+        av.set_rigid_body_mode(True)
+        self.assertTrue(av.get_rigid_body_mode())
+        av.resample()
+        mean_1 = av.get_density_mean()
+        sum_1 = av.get_density_sum()
+
+        # only the reference frame of the body is applied
+        t = IMP.algebra.Transformation3D(
+            IMP.algebra.get_rotation_about_axis(IMP.algebra.Vector3D(0, 0, 1), 0.5),
+            IMP.algebra.Vector3D(10.0, -5.0, 3.0)
+        )
+        IMP.core.transform(rb, t)
+        mdl.update()
+        av.resample()
+        self.assertAlmostEqual(av.get_density_sum(), sum_1, places=3)
+        np.testing.assert_allclose(
+            av.get_density_mean(), t.get_transformed(mean_1), atol=1e-3
+        )
+        self.assertEqual(len(av.get_xyz_density()), len(av.get_map().get_xyz_density()))
+
+    def test_av_gaussian_distance(self):
+        av1 = get_av(hier)
+        av2 = get_av(hier, residue_index=55)
+        forster_radius = 52.0
+        for t in [IMP.bff.DYE_PAIR_DISTANCE_MEAN, IMP.bff.DYE_PAIR_DISTANCE_E]:
+            approx, exact, rel_error = IMP.bff.av_gaussian_distance_error(
+                av1, av2,
+                forster_radius=forster_radius,
+                distance_type=t,
+                n_samples=100000
+            )
+            self.assertAlmostEqual(
+                approx,
+                IMP.bff.av_gaussian_distance(av1, av2, forster_radius, t)
+            )
+            self.assertLess(abs(rel_error), 0.05)
+
     def test_access_av_feature(self):
         av1 = get_av(hier)
         av1_map = av1.get_map()
@@ -218,3 +437,63 @@ class Tests(unittest.TestCase):
         ssdev = np.sum((p_rda_ref - p_rda)**2.)
         self.assertEqual(ssdev < 30000, True)
 
+
+    def test_kappasq_all_delta(self):
+        hist = np.array(
+            IMP.bff.kappasq_all_delta(
+                delta=0.2, sD2=0.15, sA2=0.25, step=2.0, n_bins=31
+            )
+        )
+        ref = np.zeros(30)
+        ref[4:8] = [3205.72877776, 1001.19048825, 611.44917432, 252.97166906]
+        np.testing.assert_allclose(hist, ref, rtol=1e-6, atol=1e-6)
+        # the histogram counts the kappa2 values of the angle grid
+        k2 = IMP.bff.kappasq_all_delta_values(
+            delta=0.2, sD2=0.15, sA2=0.25, step=2.0
+        )
+        self.assertEqual(k2.shape, (45, 180))
+        beta1, phi = 0.001, 0.001
+        beta2 = math.acos(abs(
+            math.cos(beta1) * math.cos(0.2) -
+            math.sin(beta1) * math.sin(0.2) * math.cos(phi)
+        ))
+        self.assertAlmostEqual(
+            k2[0, 0], IMP.bff.kappasq(0.2, 0.15, 0.25, beta1, beta2)
+        )
+        # values at k2_max are in the last bin (closed as in np.histogram)
+        k2_max = k2.max()
+        beta1 = 0.001 + np.radians(2.0) * np.arange(k2.shape[0])
+        ref, _ = np.histogram(
+            k2.ravel(), bins=np.linspace(0.0, k2_max, 11),
+            weights=np.repeat(np.sin(beta1), k2.shape[1])
+        )
+        hist_closed = IMP.bff.kappasq_all_delta(
+            delta=0.2, sD2=0.15, sA2=0.25, step=2.0, n_bins=11,
+            k2_min=0.0, k2_max=k2_max
+        )
+        np.testing.assert_allclose(hist_closed, ref, rtol=1e-6)
+        # many parameter sets at once
+        params = np.array([[0.2, 0.15, 0.25], [0.5, -0.3, 0.6]], dtype=np.float64)
+        hists = IMP.bff.kappasq_all_delta_histograms(params, step=2.0, n_bins=31)
+        self.assertEqual(hists.shape, (2, 30))
+        np.testing.assert_allclose(hists[0], hist)
+        np.testing.assert_allclose(
+            hists[1],
+            IMP.bff.kappasq_all_delta(delta=0.5, sD2=-0.3, sA2=0.6, step=2.0, n_bins=31)
+        )
+
+    def test_kappa_distance(self):
+        d, k = IMP.bff.kappa_distance(
+            IMP.algebra.Vector3D(0.0, 0.0, 0.0), IMP.algebra.Vector3D(1.0, 0.0, 0.0),
+            IMP.algebra.Vector3D(0.0, 0.5, 0.0), IMP.algebra.Vector3D(0.0, 0.5, 1.0)
+        )
+        self.assertAlmostEqual(d, 0.8660254037844386)
+        self.assertAlmostEqual(k, 1.0)
+        xyz = np.array(
+            [[0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.0, 0.5, 1.0]] * 3,
+            dtype=np.float64
+        )
+        r = IMP.bff.kappa_distances(xyz, aid1=0, aid2=1, aia1=2, aia2=3)
+        self.assertEqual(r.shape, (3, 2))
+        np.testing.assert_allclose(r[:, 0], 0.8660254037844386)
+        np.testing.assert_allclose(r[:, 1], 1.0)
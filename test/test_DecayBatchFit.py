@@ -0,0 +1,86 @@
+from __future__ import division
+import unittest
+
+import numpy as np
+import IMP.bff
+
+
+def norm_pdf(x, mu, sigma):
+    variance = sigma**2
+    num = x - mu
+    denom = 2*variance
+    pdf = ((1/(np.sqrt(2*np.pi)*sigma))*np.exp(-(num**2)/denom))
+    return pdf
+
+
+x = np.linspace(0, 20, 128)
+irf_y = norm_pdf(x, 2.0, 0.1)
+
+
+def make_stack(irf, lifetimes, n_photons=1e4):
+    decays = list()
+    for tau in lifetimes:
+        lh = IMP.bff.DecayLifetimeHandler([1.0, tau])
+        dc = IMP.bff.DecayConvolution(
+            lifetime_handler=lh,
+            instrument_response_function=irf,
+            convolution_method=IMP.bff.DecayConvolution.FAST
+        )
+        decay = IMP.bff.DecayCurve(x)
+        dc.add(decay)
+        y = np.array(decay.y)
+        decays.append(n_photons * y / y.sum() + 1.0)
+    return np.array(decays)
+
+
+class Tests(unittest.TestCase):
+
+    def test_DecayBatchFit_init(self):
+        irf = IMP.bff.DecayCurve(x, irf_y)
+        bf = IMP.bff.DecayBatchFit(irf, [1.0, 2.0], n_workers=2)
+        self.assertEqual(bf.get_number_of_channels(), len(x))
+        self.assertEqual(bf.get_number_of_workers(), 2)
+        self.assertEqual(bf.get_number_of_parameters(), 2)
+        self.assertEqual(bf.score_type, "poisson")
+        bf.max_iterations = 20
+        self.assertEqual(bf.max_iterations, 20)
+
+    def test_fit(self):
+        irf = IMP.bff.DecayCurve(x, irf_y)
+        # image of 4 x 4 pixels
+        lifetimes = np.linspace(1.0, 4.0, 16)
+        stack = make_stack(irf, lifetimes).reshape((4, 4, len(x)))
+
+        results = list()
+        for n_workers in [1, 3]:
+            bf = IMP.bff.DecayBatchFit(
+                irf, [1.0, 2.0],
+                convolution_method=IMP.bff.DecayConvolution.FAST,
+                n_workers=n_workers
+            )
+            bf.set_fixed([1, 0])
+            bf.set_bounds([0.0, 0.1], [2.0, 10.0])
+            bf.constant_background = 1.0
+            scores = bf.fit(stack.reshape((-1, len(x))))
+            self.assertEqual(len(scores), 16)
+            self.assertTrue(np.all(np.array(bf.get_number_of_iterations()) > 0))
+            parameters = bf.get_parameters()
+            self.assertEqual(parameters.shape, (16, 2))
+            np.testing.assert_allclose(parameters[:, 1], lifetimes, rtol=1e-4)
+            results.append(parameters)
+        # the result does not depend on the distribution over the workers
+        np.testing.assert_array_equal(results[0], results[1])
+
+    def test_min_number_of_photons(self):
+        irf = IMP.bff.DecayCurve(x, irf_y)
+        stack = make_stack(irf, [2.0, 3.0])
+        stack[0] *= 1e-4
+        bf = IMP.bff.DecayBatchFit(irf, [1.0, 2.0], n_workers=1)
+        bf.set_fixed([1, 0])
+        bf.min_number_of_photons = 100.0
+        bf.fit(stack)
+        self.assertTrue(np.isnan(bf.scores[0]))
+        self.assertFalse(np.isnan(bf.scores[1]))
+        parameters = bf.get_parameters()
+        np.testing.assert_allclose(parameters[0], [1.0, 2.0])
+        self.assertEqual(bf.get_number_of_iterations()[0], 0)
@@ -1,6 +1,5 @@
 from __future__ import division
 import unittest
-import platform
 
 import numpy as np
 import numpy.testing
@@ -86,15 +85,11 @@ class Tests(unittest.TestCase):
             IMP.bff.DecayConvolution.FAST_PERIODIC,
             IMP.bff.DecayConvolution.FAST
         ]
-        conv_methods_fast = [
+        # The AVX methods use the kernels of the CPU (scalar without AVX2)
+        conv_methods += [
             IMP.bff.DecayConvolution.FAST_AVX,
             IMP.bff.DecayConvolution.FAST_PERIODIC_AVX
         ]
-        if "AMD64" in platform.machine():
-            if platform.system() == "Linux":
-                conv_methods += conv_methods_fast
-            elif platform.system() == "Windows":
-                conv_methods += conv_methods_fast
         for i in conv_methods:
             settings["convolution_method"] = i
             dc = IMP.bff.DecayConvolution(**settings)
@@ -102,6 +97,149 @@ class Tests(unittest.TestCase):
             dc.add(decay)
             np.testing.assert_allclose(decay.y[::8], ref[i])
 
+    def test_convolve_lifetime_spectra(self):
+        irf = IMP.bff.DecayCurve(x, irf_y)
+        lifetime_spectra = np.array(
+            [
+                [1.0, 4.0, 0.0, 0.0],
+                [0.5, 1.0, 0.5, 3.0],
+                [0.2, 0.5, 0.8, 6.0],
+                [1.0, 2.0, 0.0, 0.0],
+                [0.3, 4.0, 0.1, 1.0],
+                [0.7, 8.0, 0.0, 0.0]
+            ]
+        )
+        for cm in [IMP.bff.DecayConvolution.FAST, IMP.bff.DecayConvolution.FAST_PERIODIC]:
+            dc = IMP.bff.DecayConvolution(
+                instrument_response_function=irf,
+                convolution_method=cm,
+                excitation_period=16.0
+            )
+            decays = dc.convolve_lifetime_spectra(lifetime_spectra)
+            self.assertEqual(decays.shape, (len(lifetime_spectra), len(x)))
+            for ls, y in zip(lifetime_spectra, decays):
+                lh = IMP.bff.DecayLifetimeHandler(ls[ls[::2].repeat(2) > 0])
+                dc_single = IMP.bff.DecayConvolution(
+                    lifetime_handler=lh,
+                    instrument_response_function=irf,
+                    convolution_method=cm,
+                    excitation_period=16.0
+                )
+                decay = IMP.bff.DecayCurve(x)
+                dc_single.add(decay)
+                np.testing.assert_allclose(y, decay.y, rtol=1e-9, atol=1e-12)
+
+    def test_irf_update(self):
+        # the half-step irf is kept between calls and updated with the irf
+        irf = IMP.bff.DecayCurve(x, irf_y)
+        lh = IMP.bff.DecayLifetimeHandler([1, 4])
+        for cm in [IMP.bff.DecayConvolution.FAST, IMP.bff.DecayConvolution.FAST_PERIODIC]:
+            dc = IMP.bff.DecayConvolution(
+                lifetime_handler=lh,
+                instrument_response_function=irf,
+                convolution_method=cm,
+                excitation_period=16.0
+            )
+            decay = IMP.bff.DecayCurve(x)
+            dc.add(decay)
+            y0 = np.copy(decay.y)
+            dc.add(decay)
+            np.testing.assert_allclose(decay.y, y0)
+
+            dc.irf_shift_channels = 2.0
+            dc.irf_background_counts = 1e-3
+            decay = IMP.bff.DecayCurve(x)
+            dc.add(decay)
+            ref = IMP.bff.DecayConvolution(
+                lifetime_handler=lh,
+                instrument_response_function=irf,
+                convolution_method=cm,
+                excitation_period=16.0,
+                irf_shift_channels=2.0,
+                irf_background_counts=1e-3
+            )
+            decay_ref = IMP.bff.DecayCurve(x)
+            ref.add(decay_ref)
+            np.testing.assert_allclose(decay.y, decay_ref.y)
+            self.assertFalse(np.allclose(decay.y, y0))
+
+            # a decay with other channel width
+            x2 = np.linspace(0, 10, len(x))
+            decay = IMP.bff.DecayCurve(x2)
+            dc.add(decay)
+            decay_ref = IMP.bff.DecayCurve(x2)
+            ref.add(decay_ref)
+            np.testing.assert_allclose(decay.y, decay_ref.y)
+
+    def test_fft(self):
+        irf = IMP.bff.DecayCurve(x, irf_y)
+        lh = IMP.bff.DecayLifetimeHandler([0.6, 1.0, 0.4, 4.0])
+        for cm_fft, cm_ref in [
+            (IMP.bff.DecayConvolution.FFT, IMP.bff.DecayConvolution.FAST),
+            (IMP.bff.DecayConvolution.FFT_PERIODIC, IMP.bff.DecayConvolution.FAST_PERIODIC)
+        ]:
+            decays = list()
+            for cm in cm_fft, cm_ref:
+                dc = IMP.bff.DecayConvolution(
+                    lifetime_handler=lh,
+                    instrument_response_function=irf,
+                    convolution_method=cm,
+                    excitation_period=100.0
+                )
+                self.assertEqual(dc.convolution_method, cm)
+                decay = IMP.bff.DecayCurve(x)
+                dc.add(decay)
+                decays.append(decay.y)
+            np.testing.assert_allclose(decays[0], decays[1], rtol=1e-9, atol=1e-12)
+            if cm_fft == IMP.bff.DecayConvolution.FFT:
+                ref = decays[1]
+
+        # arbitrary model histograms
+        dc = IMP.bff.DecayConvolution(
+            instrument_response_function=irf,
+            convolution_method=IMP.bff.DecayConvolution.FFT
+        )
+        t = np.arange(len(x)) * irf.get_average_dx()
+        model = 0.6 * np.exp(-t / 1.0) + 0.4 * np.exp(-t / 4.0)
+        np.testing.assert_allclose(dc.convolve_model(model), ref, rtol=1e-9, atol=1e-12)
+
+    def test_jacobian(self):
+        irf = IMP.bff.DecayCurve(x, irf_y)
+        data = IMP.bff.DecayCurve(x, 100.0 * np.exp(-x / 3.0) + 5.0)
+        pattern = IMP.bff.DecayCurve(x, np.ones_like(x))
+        lifetime_spectrum = [0.6, 1.0, 0.4, 4.0]
+
+        def model(lifetime_spectrum, jacobian=None):
+            lh = IMP.bff.DecayLifetimeHandler(lifetime_spectrum)
+            modifiers = [
+                IMP.bff.DecayConvolution(
+                    lifetime_handler=lh,
+                    instrument_response_function=irf,
+                    convolution_method=IMP.bff.DecayConvolution.FAST_PERIODIC,
+                    excitation_period=100.0
+                ),
+                IMP.bff.DecayPattern(constant_offset=1.0, pattern=pattern, pattern_fraction=0.1),
+                IMP.bff.DecayScale(data=data)
+            ]
+            decay = IMP.bff.DecayCurve(x)
+            for m in modifiers:
+                if jacobian is None:
+                    m.add(decay)
+                else:
+                    m.add_jacobian(decay, jacobian)
+            return decay.y
+
+        jacobian = np.zeros((len(lifetime_spectrum), len(x)))
+        y = model(lifetime_spectrum, jacobian)
+        np.testing.assert_allclose(y, model(lifetime_spectrum))
+        h = 1e-6
+        for i in range(len(lifetime_spectrum)):
+            lp, lm = list(lifetime_spectrum), list(lifetime_spectrum)
+            lp[i] += h
+            lm[i] -= h
+            ref = (model(lp) - model(lm)) / (2 * h)
+            np.testing.assert_allclose(jacobian[i], ref, rtol=1e-4, atol=1e-6)
+
     def test_irf(self):
         irf = IMP.bff.DecayCurve(x=x, y=irf_y)
         dc = IMP.bff.DecayConvolution()
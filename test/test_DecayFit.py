@@ -0,0 +1,90 @@
+from __future__ import division
+import unittest
+
+import numpy as np
+import IMP.bff
+
+
+def norm_pdf(x, mu, sigma):
+    variance = sigma**2
+    num = x - mu
+    denom = 2*variance
+    pdf = ((1/(np.sqrt(2*np.pi)*sigma))*np.exp(-(num**2)/denom))
+    return pdf
+
+
+x = np.linspace(0, 20, 128)
+irf_y = norm_pdf(x, 2.0, 0.1)
+
+
+def make_modifiers(lh, irf, pattern):
+    return [
+        IMP.bff.DecayConvolution(
+            lifetime_handler=lh,
+            instrument_response_function=irf,
+            convolution_method=IMP.bff.DecayConvolution.FAST_PERIODIC,
+            excitation_period=30.0
+        ),
+        IMP.bff.DecayPattern(constant_offset=0.0, pattern=pattern, pattern_fraction=0.1)
+    ]
+
+
+class Tests(unittest.TestCase):
+
+    def setUp(self):
+        self.irf = IMP.bff.DecayCurve(x, irf_y)
+        self.pattern = IMP.bff.DecayCurve(x, np.ones_like(x))
+        lh = IMP.bff.DecayLifetimeHandler([0.6, 1.0, 0.4, 4.0])
+        decay = IMP.bff.DecayCurve(x)
+        for m in make_modifiers(lh, self.irf, self.pattern):
+            m.add(decay)
+        y = np.array(decay.y)
+        self.data = IMP.bff.DecayCurve(x, 1e5 * y / y.sum())
+
+    def make_fit(self, score_type):
+        lh = IMP.bff.DecayLifetimeHandler([0.5, 2.0, 0.5, 3.0])
+        model = IMP.bff.DecayCurve(x)
+        score = IMP.bff.DecayScore(model, self.data, score_type)
+        modifiers = make_modifiers(lh, self.irf, self.pattern)
+        modifiers.append(IMP.bff.DecayScale(data=self.data))
+        dm = IMP.bff.DecayModel(score, lh)
+        for m in modifiers:
+            dm.add_modifier(m)
+        fit = IMP.bff.DecayFit(dm)
+        # the model does not own the curves and modifiers
+        self._keep = lh, model, score, modifiers, dm
+        return fit
+
+    def test_DecayFit_init(self):
+        fit = IMP.bff.DecayFit(max_iterations=20, tolerance=1e-6)
+        self.assertEqual(fit.max_iterations, 20)
+        self.assertAlmostEqual(fit.tolerance, 1e-6)
+        fit.set_bounds([0.0, 0.1], [1.0, 10.0])
+        np.testing.assert_allclose(fit.get_lower_bounds(), [0.0, 0.1])
+        np.testing.assert_allclose(fit.get_upper_bounds(), [1.0, 10.0])
+
+    def test_fit(self):
+        for score_type in ["poisson", "default", "cnp"]:
+            fit = self.make_fit(score_type)
+            fit.set_bounds([0.0, 0.1, 0.0, 0.1], [1.0, 10.0, 1.0, 10.0])
+            # amplitudes are relative (the model is scaled to the data)
+            fit.set_fixed([1, 0, 0, 0])
+            fit.fit()
+            self.assertTrue(fit.converged)
+            p = fit.parameters
+            self.assertAlmostEqual(p[0], 0.5)
+            self.assertAlmostEqual(p[1], 1.0, places=4)
+            self.assertAlmostEqual(p[2] / p[0], 0.4 / 0.6, places=4)
+            self.assertAlmostEqual(p[3], 4.0, places=4)
+            # lifetime spectrum of the model at the optimum
+            lh = fit.get_model().get_lifetime_handler()
+            np.testing.assert_allclose(lh.get_lifetime_spectrum(), p)
+
+    def test_bounds(self):
+        fit = self.make_fit("poisson")
+        fit.set_bounds([0.0, 0.1, 0.0, 2.0], [1.0, 10.0, 1.0, 3.5])
+        fit.set_fixed([1, 0, 0, 0])
+        fit.fit(np.array([0.5, 2.0, 0.5, 3.0]))
+        p = fit.parameters
+        self.assertGreater(p[3], 2.0)
+        self.assertLessEqual(p[3], 3.5)
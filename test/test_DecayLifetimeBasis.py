@@ -0,0 +1,56 @@
+from __future__ import division
+import unittest
+
+import numpy as np
+import IMP.bff
+
+
+def norm_pdf(x, mu, sigma):
+    variance = sigma**2
+    num = x - mu
+    denom = 2*variance
+    pdf = ((1/(np.sqrt(2*np.pi)*sigma))*np.exp(-(num**2)/denom))
+    return pdf
+
+
+time_axis = np.linspace(0, 25, 512)
+dt = time_axis[1] - time_axis[0]
+irf = norm_pdf(time_axis, 2.0, 0.15)
+lifetimes = list(np.geomspace(0.1, 10.0, 300))
+
+
+class Tests(unittest.TestCase):
+
+    def test_DecayLifetimeBasis_init(self):
+        basis = IMP.bff.DecayLifetimeBasis()
+        self.assertEqual(basis.get_number_of_lifetimes(), 0)
+        self.assertFalse(basis.is_valid())
+
+        basis = IMP.bff.DecayLifetimeBasis(lifetimes)
+        np.testing.assert_allclose(basis.lifetimes, lifetimes)
+        basis.compute(irf=irf, dt=dt)
+        self.assertTrue(basis.is_valid())
+        self.assertEqual(basis.get_number_of_channels(), len(irf))
+        self.assertEqual(basis.get_basis().shape, (len(lifetimes), len(irf)))
+
+        # a new lifetime grid needs a new basis
+        basis.lifetimes = lifetimes[:10]
+        self.assertFalse(basis.is_valid())
+
+    def test_evaluate(self):
+        basis = IMP.bff.DecayLifetimeBasis(lifetimes)
+        rng = np.random.default_rng(1)
+        amplitudes = rng.uniform(size=len(lifetimes))
+        amplitudes[::3] = 0.0
+        x = np.vstack([amplitudes, lifetimes]).T[amplitudes > 0].flatten()
+        for period in -1.0, 12.0:
+            basis.compute(irf=irf, dt=dt, period=period)
+            ref = np.zeros_like(irf)
+            if period > 0:
+                IMP.bff.decay_fconv_per(fit=ref, irf=irf, x=x, period=period, dt=dt)
+            else:
+                IMP.bff.decay_fconv(fit=ref, irf=irf, x=x, dt=dt)
+            model = basis.evaluate(amplitudes)
+            np.testing.assert_allclose(model, ref, rtol=1e-9, atol=1e-12)
+            # the basis is the derivative by the amplitudes
+            np.testing.assert_allclose(basis.get_basis().T @ amplitudes, ref, rtol=1e-9, atol=1e-12)
@@ -0,0 +1,105 @@
+from __future__ import division
+import unittest
+
+import numpy as np
+import IMP.bff
+
+
+def norm_pdf(x, mu, sigma):
+    variance = sigma**2
+    num = x - mu
+    denom = 2*variance
+    pdf = ((1/(np.sqrt(2*np.pi)*sigma))*np.exp(-(num**2)/denom))
+    return pdf
+
+
+x = np.linspace(0, 20, 128)
+irf_y = norm_pdf(x, 2.0, 0.1)
+data_y = np.round(200.0 * np.exp(-x / 3.0) * (x > 2.0) + 5.0)
+
+
+class Tests(unittest.TestCase):
+
+    def make_chain(self, lifetime_spectrum):
+        irf = IMP.bff.DecayCurve(x, irf_y)
+        data = IMP.bff.DecayCurve(x, data_y)
+        pattern = IMP.bff.DecayCurve(x, np.ones_like(x))
+        lh = IMP.bff.DecayLifetimeHandler(lifetime_spectrum)
+        modifiers = [
+            IMP.bff.DecayConvolution(
+                lifetime_handler=lh,
+                instrument_response_function=irf,
+                convolution_method=IMP.bff.DecayConvolution.FAST_PERIODIC,
+                excitation_period=30.0
+            ),
+            IMP.bff.DecayPattern(constant_offset=1.0, pattern=pattern, pattern_fraction=0.1),
+            IMP.bff.DecayScale(data=data)
+        ]
+        # the model does not own the curves and modifiers
+        return irf, data, pattern, lh, modifiers
+
+    def test_DecayModel_init(self):
+        dm = IMP.bff.DecayModel()
+        self.assertEqual(dm.number_of_modifiers, 0)
+        self.assertEqual(dm.number_of_parameters, 0)
+        lh = IMP.bff.DecayLifetimeHandler([1.0, 4.0])
+        dm.set_lifetime_handler(lh)
+        self.assertEqual(dm.number_of_parameters, 2)
+
+    def test_update(self):
+        lifetime_spectrum = [0.6, 1.0, 0.4, 4.0]
+        irf, data, pattern, lh, modifiers = self.make_chain(lifetime_spectrum)
+        dm = IMP.bff.DecayModel(lifetime_handler=lh)
+        for m in modifiers:
+            dm.add_modifier(m)
+        self.assertEqual(dm.number_of_modifiers, len(modifiers))
+        dm.update()
+
+        ref = IMP.bff.DecayCurve(x)
+        for m in modifiers:
+            m.add(ref)
+        np.testing.assert_allclose(dm.model.y, ref.y)
+
+    def test_evaluate(self):
+        lifetime_spectrum = [0.6, 1.0, 0.4, 4.0]
+        irf, data, pattern, lh, modifiers = self.make_chain(lifetime_spectrum)
+        model = IMP.bff.DecayCurve(x)
+        score = IMP.bff.DecayScore(model, data, "poisson")
+        dm = IMP.bff.DecayModel(score, lh)
+        for m in modifiers:
+            dm.add_modifier(m)
+
+        ref = IMP.bff.DecayCurve(x)
+        for m in modifiers:
+            m.add(ref)
+        ref_score = IMP.bff.DecayScore(ref, data, "poisson").score
+        self.assertAlmostEqual(dm.score(), ref_score)
+
+        # evaluate sets the lifetime spectrum
+        v = np.array([1.0, 3.0])
+        s = dm.evaluate(v)
+        np.testing.assert_allclose(lh.get_lifetime_spectrum(), v)
+        self.assertAlmostEqual(s, score.score)
+        self.assertLess(s, ref_score)
+
+    def test_jacobian(self):
+        lifetime_spectrum = [0.6, 1.0, 0.4, 4.0]
+        irf, data, pattern, lh, modifiers = self.make_chain(lifetime_spectrum)
+        dm = IMP.bff.DecayModel(lifetime_handler=lh)
+        for m in modifiers:
+            dm.add_modifier(m)
+        jacobian = dm.get_jacobian()
+        self.assertEqual(jacobian.shape, (len(lifetime_spectrum), len(x)))
+
+        h = 1e-6
+        for i in range(len(lifetime_spectrum)):
+            lp, lm = list(lifetime_spectrum), list(lifetime_spectrum)
+            lp[i] += h
+            lm[i] -= h
+            lh.set_lifetime_spectrum(lp)
+            dm.update()
+            yp = np.array(dm.model.y)
+            lh.set_lifetime_spectrum(lm)
+            dm.update()
+            ym = np.array(dm.model.y)
+            np.testing.assert_allclose(jacobian[i], (yp - ym) / (2 * h), rtol=1e-4, atol=1e-6)
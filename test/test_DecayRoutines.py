@@ -2,7 +2,6 @@ from __future__ import division
 
 import unittest
 import numpy as np
-import platform
 
 import IMP.bff
 
@@ -146,15 +145,15 @@ class Tests(unittest.TestCase):
 
         np.testing.assert_array_almost_equal(model_ref, model_fconv)
 
-        if "AMD64" in platform.machine():
-            model_fconv_avx = np.zeros_like(irf)
-            IMP.bff.decay_fconv_avx(
-                fit=model_fconv_avx,
-                irf=irf,
-                x=lifetime_spectrum,
-                dt=dt
-            )
-            np.testing.assert_array_almost_equal(model_fconv_avx, model_fconv)
+        # falls back to the scalar kernel on CPUs without AVX2
+        model_fconv_avx = np.zeros_like(irf)
+        IMP.bff.decay_fconv_avx(
+            fit=model_fconv_avx,
+            irf=irf,
+            x=lifetime_spectrum,
+            dt=dt
+        )
+        np.testing.assert_array_almost_equal(model_fconv_avx, model_fconv)
 
     def test_fconv_per(self):
         period = 13.0
@@ -194,19 +193,127 @@ class Tests(unittest.TestCase):
         )
         np.testing.assert_array_almost_equal(model_fconv_per, ref)
 
-        # AVX won't be supported on Apple -> M1
-        if "AMD64" in platform.machine():
-            model_fconv_avx = np.zeros_like(irf)
-            IMP.bff.decay_fconv_per_avx(
-                fit=model_fconv_avx,
-                irf=irf,
-                x=lifetime_spectrum,
-                period=period,
-                start=0,
-                stop=-1,
-                dt=dt
-            )
-            np.testing.assert_array_almost_equal(model_fconv_avx, model_fconv_per)
+        model_fconv_avx = np.zeros_like(irf)
+        IMP.bff.decay_fconv_per_avx(
+            fit=model_fconv_avx,
+            irf=irf,
+            x=lifetime_spectrum,
+            period=period,
+            start=0,
+            stop=-1,
+            dt=dt
+        )
+        np.testing.assert_array_almost_equal(model_fconv_avx, model_fconv_per)
+
+    def test_fconv_simd_levels(self):
+        period = 13.0
+        irf, time_axis = model_irf(
+            n_channels=32,
+            period=period,
+            irf_position_p=2.0,
+            irf_position_s=2.0,
+            irf_width=0.15
+        )
+        irf[irf < 0.001] = 0.0
+        dt = time_axis[1] - time_axis[0]
+        level = IMP.bff.get_simd_level()
+        self.assertEqual(level, IMP.bff.get_supported_simd_level())
+        # few lifetimes use the kernels with time channels in the lanes
+        lifetime_spectra = [
+            np.array([1.0, 4.1]),
+            np.array([1.0, 4.1, 0.5, 1.2]),
+            np.array([1.0, 4.1, 0.5, 1.2, 0.3, 0.4, 2.0, 2.5, 0.1, 8.0]),
+            np.tile([0.1, 1.5], 9)
+        ]
+        for lifetime_spectrum in lifetime_spectra:
+            models = list()
+            try:
+                for lvl in range(IMP.bff.get_supported_simd_level() + 1):
+                    IMP.bff.set_simd_level(lvl)
+                    self.assertEqual(IMP.bff.get_simd_level(), lvl)
+                    m = np.zeros_like(irf)
+                    IMP.bff.decay_fconv(fit=m, irf=irf, x=lifetime_spectrum, dt=dt)
+                    m_per = np.zeros_like(irf)
+                    IMP.bff.decay_fconv_per(
+                        fit=m_per, irf=irf, x=lifetime_spectrum, period=period, dt=dt
+                    )
+                    models.append((m, m_per))
+                # levels above the supported level are clamped
+                IMP.bff.set_simd_level(IMP.bff.SIMD_AVX512 + 1)
+                self.assertEqual(
+                    IMP.bff.get_simd_level(), IMP.bff.get_supported_simd_level()
+                )
+            finally:
+                IMP.bff.set_simd_level(level)
+            for m, m_per in models[1:]:
+                np.testing.assert_allclose(m, models[0][0], rtol=1e-12, atol=1e-12)
+                np.testing.assert_allclose(m_per, models[0][1], rtol=1e-12, atol=1e-12)
+
+    def test_fconv_batch(self):
+        period = 13.0
+        irf, time_axis = model_irf(
+            n_channels=32,
+            period=period,
+            irf_position_p=2.0,
+            irf_position_s=2.0,
+            irf_width=0.15
+        )
+        irf[irf < 0.001] = 0.0
+        dt = time_axis[1] - time_axis[0]
+        # more spectra than lanes of a register, the last row is zero padded
+        lifetime_spectra = np.array(
+            [[0.1 * (i + 1), 0.5 + 0.3 * i, 1.0, 4.1] for i in range(10)] +
+            [[1.0, 4.1, 0.0, 0.0]]
+        )
+        models = IMP.bff.decay_fconv_batch(irf=irf, lifetime_spectra=lifetime_spectra, dt=dt)
+        models_per = IMP.bff.decay_fconv_per_batch(
+            irf=irf, lifetime_spectra=lifetime_spectra, period=period, dt=dt
+        )
+        self.assertEqual(models.shape, (len(lifetime_spectra), len(irf)))
+        self.assertEqual(models_per.shape, (len(lifetime_spectra), len(irf)))
+        for x, m, m_per in zip(lifetime_spectra, models, models_per):
+            x = x[np.repeat(x[::2] > 0, 2)]
+            ref = np.zeros_like(irf)
+            IMP.bff.decay_fconv(fit=ref, irf=irf, x=x, dt=dt)
+            np.testing.assert_allclose(m, ref, rtol=1e-12, atol=1e-12)
+            ref = np.zeros_like(irf)
+            IMP.bff.decay_fconv_per(fit=ref, irf=irf, x=x, period=period, dt=dt)
+            np.testing.assert_allclose(m_per, ref, rtol=1e-12, atol=1e-12)
+
+    def test_fconv_jacobian(self):
+        period = 13.0
+        irf, time_axis = model_irf(
+            n_channels=32,
+            period=period,
+            irf_position_p=2.0,
+            irf_position_s=2.0,
+            irf_width=0.15
+        )
+        irf[irf < 0.001] = 0.0
+        dt = time_axis[1] - time_axis[0]
+        x = np.array([0.6, 1.3, 0.4, 3.0])
+
+        def model(x, periodic):
+            fit = np.zeros_like(irf)
+            if periodic:
+                IMP.bff.decay_fconv_per(fit=fit, irf=irf, x=x, period=period, dt=dt)
+            else:
+                IMP.bff.decay_fconv(fit=fit, irf=irf, x=x, dt=dt)
+            return fit
+
+        for periodic in False, True:
+            if periodic:
+                jacobian = IMP.bff.decay_fconv_per_jacobian(irf=irf, x=x, period=period, dt=dt)
+            else:
+                jacobian = IMP.bff.decay_fconv_jacobian(irf=irf, x=x, dt=dt)
+            self.assertEqual(jacobian.shape, (len(x), len(irf)))
+            h = 1e-6
+            for i in range(len(x)):
+                xp, xm = np.copy(x), np.copy(x)
+                xp[i] += h
+                xm[i] -= h
+                ref = (model(xp, periodic) - model(xm, periodic)) / (2 * h)
+                np.testing.assert_allclose(jacobian[i], ref, rtol=1e-5, atol=1e-7)
 
     def test_fconv_per_cs(self):
         period = 13.0
@@ -280,6 +387,35 @@ class Tests(unittest.TestCase):
                         1.05504424e+00, 1.00715054e+00, 9.61430968e-01, 9.17786836e-01])
         np.testing.assert_array_almost_equal(ref, model_sconv)
 
+    def test_fftconv(self):
+        irf, time_axis = model_irf(
+            n_channels=32,
+            period=12.0,
+            irf_position_p=2.0,
+            irf_position_s=7.0,
+            irf_width=0.25
+        )
+        # model of arbitrary shape
+        model = np.exp(-time_axis / 4.1) + 0.5 * np.sin(time_axis) ** 2
+        ref = np.zeros_like(irf)
+        IMP.bff.decay_sconv(fit=ref, irf=irf, model=model)
+        model_fft = np.zeros_like(irf)
+        IMP.bff.decay_fftconv(fit=model_fft, irf=irf, model=model)
+        np.testing.assert_allclose(model_fft, ref, rtol=1e-9, atol=1e-12)
+
+        # circular convolution of one period with the wrapped irf
+        n_period = 20
+        model_per = model[:n_period]
+        irf_wrapped = np.zeros(n_period)
+        np.add.at(irf_wrapped, np.arange(len(irf)) % n_period, irf)
+        ref = np.array([
+            sum(irf_wrapped[j] * model_per[(i - j) % n_period] for j in range(n_period))
+            for i in range(len(irf))
+        ])
+        model_fft = np.zeros_like(irf)
+        IMP.bff.decay_fftconv_per(fit=model_fft, irf=irf, model=model_per)
+        np.testing.assert_allclose(model_fft, ref, rtol=1e-9, atol=1e-12)
+
     # def test_convolve_lifetime_spectrum_periodic(self):
     #     period = 25
     #     time_axis = np.linspace(0, period, 10)